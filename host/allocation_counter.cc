@@ -0,0 +1,33 @@
+#include "allocation_counter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+std::atomic<size_t> allocation_count(0);
+std::atomic<size_t> allocation_bytes(0);
+
+}  // namespace
+
+allocation_counts allocations_so_far() {
+  allocation_counts result;
+  result.allocations = allocation_count.load(std::memory_order_relaxed);
+  result.bytes = allocation_bytes.load(std::memory_order_relaxed);
+  return result;
+}
+
+void* operator new(size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+  if (void* result = malloc(size ? size : 1)) return result;
+  throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+
+// Counts heap allocations made through operator new, in every thread of a
+// tool that links allocation_counter.cc.
+
+struct allocation_counts {
+  size_t allocations = 0;
+  size_t bytes = 0;
+};
+
+// Returns the allocations made since the process started.
+allocation_counts allocations_so_far();
+
+// Returns the allocations made since `start`.
+inline allocation_counts allocations_since(const allocation_counts& start) {
+  const auto now = allocations_so_far();
+  allocation_counts result;
+  result.allocations = now.allocations - start.allocations;
+  result.bytes = now.bytes - start.bytes;
+  return result;
+}
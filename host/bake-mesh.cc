@@ -0,0 +1,47 @@
+// Pre-bakes sphere mesh files, for shipping with the application.
+//
+// Usage: bake-mesh QUALITY OUTPUT
+
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+#include "sphere_mesh.h"
+#include "utils/mesh_file.h"
+
+namespace {
+
+// Uses the index type the renderer loads the quality with.
+template <typename IndexType>
+void bake(size_t quality, const char* path) {
+  std::vector<vertex> vertices;
+  std::vector<IndexType> indices;
+  make_sphere_mesh(quality, &vertices, &indices);
+
+  write_mesh_file(path, sphere_mesh_key(quality), vertices.data(),
+                  vertices.size(), indices.data(), indices.size());
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s QUALITY OUTPUT\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const auto quality = strtoul(argv[1], nullptr, 10);
+
+  try {
+    if (sphere_fits_uint16(quality))
+      bake<uint16_t>(quality, argv[2]);
+    else
+      bake<uint32_t>(quality, argv[2]);
+  } catch (std::runtime_error& e) {
+    fprintf(stderr, "%s\n", e.what());
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,148 @@
+// Measures frustum culling throughput for random scenes of 1k, 10k and 100k
+// spheres, comparing a scalar loop, the SIMD kernel and the bounding volume
+// hierarchy, on one thread and on the job system.
+//
+// Usage: cull-bench
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "geometry/culling.h"
+#include "geometry/vector.h"
+#include "utils/job_system.h"
+
+namespace {
+
+// Spheres scattered in a cube around the camera, of which a few percent are
+// visible at a time.
+bounding_spheres random_spheres(size_t count, std::mt19937& rng) {
+  std::uniform_real_distribution<float> position(-1000.0f, 1000.0f);
+  std::uniform_real_distribution<float> radius(1.0f, 10.0f);
+
+  bounding_spheres result;
+  result.reserve(count);
+  for (size_t i = 0; i < count; ++i)
+    result.push_back(
+        {vec3(position(rng), position(rng), position(rng)), radius(rng)});
+  return result;
+}
+
+size_t cull_scalar(const frustum& f, const bounding_spheres& spheres,
+                   uint32_t* out) {
+  const auto begin = out;
+  for (size_t i = 0; i < spheres.size(); ++i) {
+    const auto s = spheres[i];
+    if (f.intersects(s.center, s.radius)) *out++ = i;
+  }
+  return out - begin;
+}
+
+// Runs `cull` for at least 200 ms, and returns the number of objects culled
+// per millisecond.
+template <typename Function>
+double measure(size_t object_count, Function cull) {
+  typedef std::chrono::steady_clock clock;
+
+  size_t iterations = 0;
+  const auto start = clock::now();
+  auto elapsed = clock::duration::zero();
+  do {
+    cull();
+    ++iterations;
+    elapsed = clock::now() - start;
+  } while (elapsed < std::chrono::milliseconds(200));
+
+  const auto ms =
+      std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(
+          elapsed)
+          .count();
+  return object_count * iterations / ms;
+}
+
+}  // namespace
+
+int main() {
+  std::mt19937 rng(1);
+  job_system jobs;
+
+  const auto projection = mat4x4::projection(1.0f, M_PI / 8.0f, 16.0f / 9.0f);
+
+  printf("%-8s %8s %16s %16s %16s %16s\n", "objects", "visible", "scalar/ms",
+         "simd/ms", "bvh/ms", "bvh-jobs/ms");
+
+  for (size_t count : {1000, 10000, 100000}) {
+    const auto spheres = random_spheres(count, rng);
+
+    sphere_bvh bvh;
+    bvh.build(spheres);
+
+    std::vector<uint32_t> visible(count), expected(count);
+    size_t visible_count = 0;
+
+    // A new camera orientation for every call, so that the BVH cannot
+    // benefit from a warm cache of one view.
+    size_t frame = 0;
+    auto next_frustum = [&frame, &projection] {
+      const auto angle = (frame++ % 360) * 2 * M_PI / 360;
+      const auto camera = rigid_transform::from_rotation(
+          vec4::rotation(0.0f, 1.0f, 0.0f, angle));
+      return frustum::from_matrix(projection * camera.invert().to_mat4x4());
+    };
+
+    // Check that all methods agree before timing them.
+    for (size_t i = 0; i < 360; ++i) {
+      const auto f = next_frustum();
+      const auto expected_count = cull_scalar(f, spheres, expected.data());
+      visible_count += expected_count;
+
+      const auto simd_count = cull_spheres(f, spheres, visible.data());
+      if (!std::equal(expected.begin(), expected.begin() + expected_count,
+                      visible.begin(), visible.begin() + simd_count)) {
+        fprintf(stderr, "SIMD result differs from scalar for %zu objects\n",
+                count);
+        return EXIT_FAILURE;
+      }
+
+      const auto bvh_count = bvh.cull(f, visible.data());
+      std::sort(visible.begin(), visible.begin() + bvh_count);
+      if (!std::equal(expected.begin(), expected.begin() + expected_count,
+                      visible.begin(), visible.begin() + bvh_count)) {
+        fprintf(stderr, "BVH result differs from scalar for %zu objects\n",
+                count);
+        return EXIT_FAILURE;
+      }
+
+      const auto jobs_count = bvh.cull(f, visible.data(), jobs);
+      std::sort(visible.begin(), visible.begin() + jobs_count);
+      if (!std::equal(expected.begin(), expected.begin() + expected_count,
+                      visible.begin(), visible.begin() + jobs_count)) {
+        fprintf(stderr,
+                "Parallel BVH result differs from scalar for %zu objects\n",
+                count);
+        return EXIT_FAILURE;
+      }
+    }
+
+    const auto scalar = measure(count, [&] {
+      cull_scalar(next_frustum(), spheres, visible.data());
+    });
+    const auto simd = measure(count, [&] {
+      cull_spheres(next_frustum(), spheres, visible.data());
+    });
+    const auto hierarchy =
+        measure(count, [&] { bvh.cull(next_frustum(), visible.data()); });
+
+    const auto parallel = measure(
+        count, [&] { bvh.cull(next_frustum(), visible.data(), jobs); });
+
+    printf("%-8zu %8zu %16.0f %16.0f %16.0f %16.0f\n", count,
+           visible_count / 360, scalar, simd, hierarchy, parallel);
+  }
+
+  return EXIT_SUCCESS;
+}
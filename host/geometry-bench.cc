@@ -0,0 +1,260 @@
+// Microbenchmarks for geometry/vector.h, sphere(), make_sphere_mesh() and
+// transform_hierarchy, reporting time, heap allocations and bytes allocated
+// per operation.  With --json, results are also written as JSON, one
+// benchmark per line, so that runs from two commits can be compared with
+// diff.
+//
+// Usage: geometry-bench [--json FILE] [--min-time MS] [--max-quality Q]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "allocation_counter.h"
+#include "geometry/sphere.h"
+#include "geometry/transform_hierarchy.h"
+#include "geometry/vector.h"
+#include "sphere_mesh.h"
+#include "utils/arena.h"
+
+namespace {
+
+// Keeps the compiler from discarding `value`, or from assuming it is
+// unchanged afterwards.
+template <typename T>
+void keep(T& value) {
+  asm volatile("" : : "r"(&value) : "memory");
+}
+
+struct result {
+  std::string name;
+  size_t iterations;
+  double ns_per_op;
+  double allocs_per_op;
+  double bytes_per_op;
+};
+
+// Calls `op(i)` once to warm up, then in batches of growing size until
+// `min_time` has passed, and reports the averages of the last batch.
+template <typename Function>
+result measure(std::string name, std::chrono::milliseconds min_time,
+               Function op) {
+  typedef std::chrono::steady_clock clock;
+
+  op(0);
+
+  for (size_t batch = 1;; batch *= 2) {
+    const auto allocations = allocations_so_far();
+    const auto start = clock::now();
+    for (size_t i = 0; i < batch; ++i) op(i);
+    const auto elapsed = clock::now() - start;
+
+    if (elapsed >= min_time || batch >= (size_t(1) << 40)) {
+      const auto ns =
+          std::chrono::duration<double, std::nano>(elapsed).count();
+      const auto allocated = allocations_since(allocations);
+      return {std::move(name), batch, ns / batch,
+              double(allocated.allocations) / batch,
+              double(allocated.bytes) / batch};
+    }
+  }
+}
+
+// Inputs, so that nothing can be folded at compile time.  The sizes are
+// powers of two so that `i & kMask` picks one.
+constexpr size_t kInputs = 256;
+constexpr size_t kMask = kInputs - 1;
+
+struct inputs {
+  std::vector<vec3> vectors;
+  std::vector<vec4> quats;
+  std::vector<mat4x4> matrices;
+  std::vector<float> aspects;
+};
+
+inputs random_inputs() {
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+  std::uniform_real_distribution<float> angle(0.0f, 2.0f * M_PI);
+  std::uniform_real_distribution<float> aspect(0.5f, 2.0f);
+
+  inputs result;
+  for (size_t i = 0; i < kInputs; ++i) {
+    const vec3 v(unit(rng), unit(rng), unit(rng));
+    result.vectors.push_back(v);
+
+    const auto axis = v.normalize();
+    const auto q = vec4::rotation(axis.x, axis.y, axis.z, angle(rng));
+    result.quats.push_back(q);
+    result.matrices.push_back(
+        mat4x4::translation(unit(rng), unit(rng), unit(rng)) *
+        mat4x4::from_quat(q));
+    result.aspects.push_back(aspect(rng));
+  }
+  return result;
+}
+
+void print(const result& r) {
+  printf("%-28s %12zu %12.2f %12.2f %14.1f\n", r.name.c_str(), r.iterations,
+         r.ns_per_op, r.allocs_per_op, r.bytes_per_op);
+  fflush(stdout);
+}
+
+bool write_json(const std::string& path, const std::vector<result>& results) {
+  FILE* f = fopen(path.c_str(), "w");
+  if (!f) return false;
+
+  fprintf(f, "{\"benchmarks\": [\n");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto& r = results[i];
+    fprintf(f,
+            "  {\"name\": \"%s\", \"iterations\": %zu, \"ns_per_op\": %.3f, "
+            "\"allocs_per_op\": %.3f, \"bytes_per_op\": %.1f}%s\n",
+            r.name.c_str(), r.iterations, r.ns_per_op, r.allocs_per_op,
+            r.bytes_per_op, i + 1 < results.size() ? "," : "");
+  }
+  fprintf(f, "]}\n");
+
+  return !ferror(f) & !fclose(f);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string json_path;
+  std::chrono::milliseconds min_time(200);
+  size_t max_quality = 7;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--json") && i + 1 < argc) {
+      json_path = argv[++i];
+    } else if (!strcmp(argv[i], "--min-time") && i + 1 < argc) {
+      min_time = std::chrono::milliseconds(atoi(argv[++i]));
+    } else if (!strcmp(argv[i], "--max-quality") && i + 1 < argc) {
+      max_quality = atoi(argv[++i]);
+    } else {
+      fprintf(stderr,
+              "Usage: %s [--json FILE] [--min-time MS] [--max-quality Q]\n",
+              argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  const auto in = random_inputs();
+  std::vector<result> results;
+
+  printf("%-28s %12s %12s %12s %14s\n", "benchmark", "iterations", "ns/op",
+         "allocs/op", "bytes/op");
+
+  auto run = [&](std::string name, auto op) {
+    results.push_back(measure(std::move(name), min_time, op));
+    print(results.back());
+  };
+
+  run("mat4x4::operator*", [&](size_t i) {
+    auto m = in.matrices[i & kMask] * in.matrices[(i + 1) & kMask];
+    keep(m);
+  });
+  run("mat4x4::invert", [&](size_t i) {
+    auto m = in.matrices[i & kMask].invert();
+    keep(m);
+  });
+  run("mat4x4::from_quat", [&](size_t i) {
+    auto m = mat4x4::from_quat(in.quats[i & kMask]);
+    keep(m);
+  });
+  run("mat4x4::projection", [&](size_t i) {
+    auto m = mat4x4::projection(1.0f, M_PI / 8.0f, in.aspects[i & kMask]);
+    keep(m);
+  });
+  run("vec3::normalize", [&](size_t i) {
+    auto v = in.vectors[i & kMask].normalize();
+    keep(v);
+  });
+
+  // Each call starts from empty vectors, so that their allocations are
+  // included.  The arena versions reuse one arena, reset before each call,
+  // and should not allocate once it has grown.
+  arena scratch;
+  for (size_t quality = 0; quality <= max_quality; ++quality) {
+    const auto q = std::to_string(quality);
+    run("sphere/q" + q, [&](size_t) {
+      std::vector<vec3> vertices;
+      std::vector<uint32_t> indices;
+      sphere(quality, &vertices, &indices);
+      keep(vertices);
+      keep(indices);
+    });
+    run("sphere/q" + q + "/arena", [&](size_t) {
+      scratch.reset();
+      std::vector<vec3, arena_allocator<vec3>> vertices(
+          (arena_allocator<vec3>(&scratch)));
+      std::vector<uint32_t, arena_allocator<uint32_t>> indices(
+          (arena_allocator<uint32_t>(&scratch)));
+      sphere(quality, &vertices, &indices);
+      keep(vertices);
+      keep(indices);
+    });
+  }
+
+  // The renderer's mesh pipeline, which has 16-bit indices.  The arena
+  // version reuses its outputs as well.
+  std::vector<vertex> mesh_vertices;
+  std::vector<uint16_t> mesh_indices;
+  for (size_t quality = 0; quality <= std::min<size_t>(max_quality, 6);
+       ++quality) {
+    const auto q = std::to_string(quality);
+    run("make_sphere_mesh/q" + q, [&](size_t) {
+      std::vector<vertex> vertices;
+      std::vector<uint16_t> indices;
+      make_sphere_mesh(quality, &vertices, &indices);
+      keep(vertices);
+      keep(indices);
+    });
+    run("make_sphere_mesh/q" + q + "/arena", [&](size_t) {
+      scratch.reset();
+      make_sphere_mesh(quality, &mesh_vertices, &mesh_indices,
+                       arena_allocator<vec3>(&scratch));
+      keep(mesh_vertices);
+      keep(mesh_indices);
+    });
+  }
+
+  // A scene of 100 groups of 1000 objects, of which 0, 100 or all move
+  // each frame.  The cost should follow the number that moved.
+  transform_hierarchy hierarchy;
+  for (size_t group = 0; group < 100; ++group) {
+    const auto parent = hierarchy.add(
+        affine_transform(in.quats[group & kMask], in.vectors[group & kMask],
+                         1.0f));
+    for (size_t i = 0; i < 999; ++i)
+      hierarchy.add(affine_transform(in.quats[i & kMask],
+                                     in.vectors[i & kMask], 0.1f),
+                    parent);
+  }
+  hierarchy.update();
+
+  for (const size_t moved : {size_t(0), size_t(100), hierarchy.size()}) {
+    run("transform_hierarchy/" + std::to_string(moved), [&](size_t i) {
+      for (size_t j = 0; j < moved; ++j) {
+        const auto node = (i * 7919 + j * 104729) % hierarchy.size();
+        hierarchy.set_local(node, hierarchy.local(node));
+      }
+      const auto& changed = hierarchy.update();
+      keep(changed);
+    });
+  }
+
+  if (!json_path.empty() && !write_json(json_path, results)) {
+    fprintf(stderr, "%s: could not write results\n", json_path.c_str());
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,874 @@
+#include "gles2_recorder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+#include <EGL/egl.h>
+#include <GLES2/gl2ext.h>
+#include <android/log.h>
+
+#include "gl/vertex_format.h"
+#include "rasterizer.h"
+
+namespace {
+
+void format_args(std::ostringstream&) {}
+
+template <typename T>
+void format_arg(std::ostringstream& out, const T& arg) {
+  out << arg;
+}
+
+void format_arg(std::ostringstream& out, const void* arg) {
+  out << arg;
+}
+
+void format_arg(std::ostringstream& out, const char* arg) {
+  out << '"' << arg << '"';
+}
+
+template <typename T, typename... Args>
+void format_args(std::ostringstream& out, const T& arg, const Args&... args) {
+  format_arg(out, arg);
+  if (sizeof...(args)) out << ", ";
+  format_args(out, args...);
+}
+
+// What glGetProgramBinaryOES() returns for every program.
+const char kProgramBinary[] = "GLES2 recorder program";
+const GLenum kProgramBinaryFormat = 0x5245;
+
+// The last program given a binary that did not match, which then fails to
+// link, as it would on a driver update.
+GLuint rejected_binary_program = 0;
+
+// Arguments are only formatted for the log, so that counting calls does not
+// allocate.
+template <typename... Args>
+void record(const char* name, gl_call_kind kind, size_t bytes,
+            const Args&... args) {
+  auto& recorder = gl_recorder::instance();
+  if (!recorder.logging()) {
+    recorder.record(name, kind, std::string(), bytes);
+    return;
+  }
+
+  std::ostringstream out;
+  format_args(out, args...);
+  recorder.record(name, kind, out.str(), bytes);
+}
+
+size_t uniform_bytes(const char* name, GLsizei count) {
+  // glUniform{1,2,3,4}{f,i}v, and glUniformMatrix{2,3,4}fv.
+  const auto matrix = !strncmp(name, "glUniformMatrix", 15);
+  const size_t n = name[matrix ? 15 : 9] - '0';
+  return count * (matrix ? n * n : n) * 4;
+}
+
+std::vector<uint8_t>* bound_buffer(GLenum target) {
+  auto& r = gl_recorder::instance();
+  const auto buffer = (target == GL_ARRAY_BUFFER) ? r.bound_array_buffer
+                                                  : r.bound_element_buffer;
+  if (!buffer) return nullptr;
+  if (r.buffers.size() <= buffer) r.buffers.resize(buffer + 1);
+  return &r.buffers[buffer];
+}
+
+gl_attribute* attribute(GLuint index) {
+  auto& r = gl_recorder::instance();
+  if (index >= r.attributes.size()) {
+    r.set_error(GL_INVALID_VALUE);
+    return nullptr;
+  }
+  return &r.attributes[index];
+}
+
+void set_capability(GLenum cap, bool enable) {
+  auto& r = gl_recorder::instance();
+  if (cap == GL_CULL_FACE) r.cull_face = enable;
+  if (cap == GL_DEPTH_TEST) r.depth_test = enable;
+}
+
+// Reads element `index` of an attribute array as GL passes it to the vertex
+// shader.  Returns false if it lies outside the buffer.
+bool fetch_attribute(const gl_attribute& a, size_t index, float out[4]) {
+  const auto& r = gl_recorder::instance();
+
+  size_t component_size;
+  switch (a.type) {
+    case GL_BYTE:
+    case GL_UNSIGNED_BYTE:
+      component_size = 1;
+      break;
+    case GL_SHORT:
+    case GL_UNSIGNED_SHORT:
+    case GL_HALF_FLOAT_OES:
+      component_size = 2;
+      break;
+    default:
+      component_size = 4;
+  }
+
+  const auto stride = a.stride ? a.stride : a.size * component_size;
+  const auto begin = a.offset + index * stride;
+  if (a.buffer >= r.buffers.size() ||
+      begin + a.size * component_size > r.buffers[a.buffer].size())
+    return false;
+  const auto data = r.buffers[a.buffer].data() + begin;
+
+  out[0] = out[1] = out[2] = 0.0f;
+  out[3] = 1.0f;
+  for (GLint i = 0; i < a.size; ++i) {
+    const auto p = data + i * component_size;
+    switch (a.type) {
+      case GL_BYTE: {
+        const auto v = static_cast<int8_t>(*p);
+        out[i] = a.normalized ? (2.0f * v + 1.0f) / 255.0f : v;
+        break;
+      }
+      case GL_UNSIGNED_BYTE:
+        out[i] = a.normalized ? *p / 255.0f : *p;
+        break;
+      case GL_SHORT: {
+        int16_t v;
+        memcpy(&v, p, sizeof(v));
+        out[i] = a.normalized ? (2.0f * v + 1.0f) / 65535.0f : v;
+        break;
+      }
+      case GL_UNSIGNED_SHORT: {
+        uint16_t v;
+        memcpy(&v, p, sizeof(v));
+        out[i] = a.normalized ? v / 65535.0f : v;
+        break;
+      }
+      case GL_HALF_FLOAT_OES: {
+        uint16_t v;
+        memcpy(&v, p, sizeof(v));
+        out[i] = half_to_float(v);
+        break;
+      }
+      default:
+        memcpy(&out[i], p, sizeof(float));
+    }
+  }
+  return true;
+}
+
+// Runs the vertex shader built by the renderer from
+// instanced_mesh::shader_prelude(), vertex_format::shader_prelude() and
+// kVertexShader on the vertices of a draw call, and passes the triangles to
+// the rasterizer.  Draws with other programs are ignored.
+void rasterize(GLenum mode, GLsizei count, GLenum type, const void* indices,
+               GLsizei instance_count) {
+  auto& r = gl_recorder::instance();
+  const auto rasterizer = r.rasterizer();
+  if (!rasterizer || mode != GL_TRIANGLES || count <= 0) return;
+
+  const auto program = r.current_program;
+  const auto attribute = [&r, program](const char* name) {
+    const auto location = r.find_location(program, name);
+    const gl_attribute* result = nullptr;
+    if (location >= 0 && static_cast<size_t>(location) < r.attributes.size() &&
+        r.attributes[location].enabled)
+      result = &r.attributes[location];
+    return result;
+  };
+
+  const auto position = attribute("attr_VertexPosition");
+  const auto color = attribute("attr_VertexColor");
+  const auto morph_position = attribute("attr_VertexMorphPosition");
+  const auto morph_color = attribute("attr_VertexMorphColor");
+  const auto instance_rotation = attribute("attr_InstanceRotation");
+  const auto instance_translation_scale =
+      attribute("attr_InstanceTranslationScale");
+  const auto instance_color_morph = attribute("attr_InstanceColorMorph");
+  const auto instance_index = attribute("attr_InstanceIndex");
+
+  const auto mvp = r.uniform(program, "uniform_ModelViewProjection");
+  const auto position_scale = r.uniform(program, "uniform_PositionScale");
+  const auto position_offset = r.uniform(program, "uniform_PositionOffset");
+  const auto instances = r.uniform(program, "uniform_Instances");
+
+  if (!position || !color || !mvp || mvp->size() < 16) return;
+
+  // The index range, which is shaded once per instance.
+  if (r.bound_element_buffer >= r.buffers.size())
+    return r.set_error(GL_INVALID_OPERATION);
+  const auto& element_buffer = r.buffers[r.bound_element_buffer];
+  const auto index_size = (type == GL_UNSIGNED_BYTE)    ? 1
+                          : (type == GL_UNSIGNED_SHORT) ? 2
+                                                        : 4;
+  const auto first = reinterpret_cast<uintptr_t>(indices);
+  if (first + count * index_size > element_buffer.size())
+    return r.set_error(GL_INVALID_OPERATION);
+
+  std::vector<uint32_t> vertex_indices(count);
+  for (GLsizei i = 0; i < count; ++i) {
+    const auto p = element_buffer.data() + first + i * index_size;
+    if (index_size == 1) {
+      vertex_indices[i] = *p;
+    } else if (index_size == 2) {
+      uint16_t v;
+      memcpy(&v, p, sizeof(v));
+      vertex_indices[i] = v;
+    } else {
+      memcpy(&vertex_indices[i], p, sizeof(uint32_t));
+    }
+  }
+  const auto min_index =
+      *std::min_element(vertex_indices.begin(), vertex_indices.end());
+  const auto max_index =
+      *std::max_element(vertex_indices.begin(), vertex_indices.end());
+  for (auto& i : vertex_indices) i -= min_index;
+
+  const auto decode_position = [&](float* p) {
+    if (!position_scale || !position_offset) return;
+    for (int i = 0; i < 3; ++i)
+      p[i] = p[i] * (*position_scale)[i] + (*position_offset)[i];
+  };
+
+  std::vector<clip_vertex> shaded(max_index - min_index + 1);
+  const float* m = mvp->data();
+
+  rasterizer->set_viewport(r.viewport[0], r.viewport[1], r.viewport[2],
+                           r.viewport[3]);
+  rasterizer->set_cull_face(r.cull_face);
+  rasterizer->set_depth_test(r.depth_test);
+
+  for (GLsizei instance = 0; instance < instance_count; ++instance) {
+    for (size_t v = min_index; v <= max_index; ++v) {
+      const auto fetch = [&](const gl_attribute* a, float out[4]) {
+        return fetch_attribute(*a, a->divisor ? instance / a->divisor : v,
+                               out);
+      };
+
+      float q[4] = {0, 0, 0, 1}, ts[4] = {0, 0, 0, 1}, cm[4] = {1, 1, 1, 1};
+      if (instance_rotation && instance_translation_scale &&
+          instance_color_morph) {
+        if (!fetch(instance_rotation, q) ||
+            !fetch(instance_translation_scale, ts) ||
+            !fetch(instance_color_morph, cm))
+          return r.set_error(GL_INVALID_OPERATION);
+      } else if (instance_index && instances) {
+        float index[4];
+        if (!fetch(instance_index, index))
+          return r.set_error(GL_INVALID_OPERATION);
+        const auto base = 12 * static_cast<size_t>(index[0]);
+        if (base + 12 > instances->size()) continue;
+        std::copy_n(&(*instances)[base], 4, q);
+        std::copy_n(&(*instances)[base + 4], 4, ts);
+        std::copy_n(&(*instances)[base + 8], 4, cm);
+      }
+      const auto morph = cm[3];
+
+      float p[4], c[4];
+      if (!fetch(position, p) || !fetch(color, c))
+        return r.set_error(GL_INVALID_OPERATION);
+      decode_position(p);
+      if (morph_position && morph_color) {
+        float mp[4], mc[4];
+        if (!fetch(morph_position, mp) || !fetch(morph_color, mc))
+          return r.set_error(GL_INVALID_OPERATION);
+        decode_position(mp);
+        for (int i = 0; i < 3; ++i) {
+          p[i] = mp[i] + (p[i] - mp[i]) * morph;
+          c[i] = mc[i] + (c[i] - mc[i]) * morph;
+        }
+      }
+
+      // instance_position(): scale, rotate by the quaternion, translate.
+      float s[3] = {p[0] * ts[3], p[1] * ts[3], p[2] * ts[3]};
+      const auto cross = [](const float* a, const float* b, float* out) {
+        out[0] = a[1] * b[2] - a[2] * b[1];
+        out[1] = a[2] * b[0] - a[0] * b[2];
+        out[2] = a[0] * b[1] - a[1] * b[0];
+      };
+      float t[3], u[3];
+      cross(q, s, t);
+      for (auto& x : t) x *= 2.0f;
+      cross(q, t, u);
+      float world[3];
+      for (int i = 0; i < 3; ++i) world[i] = s[i] + q[3] * t[i] + u[i] + ts[i];
+
+      auto& out = shaded[v - min_index];
+      float clip[4];
+      for (int i = 0; i < 4; ++i)
+        clip[i] = m[i] * world[0] + m[4 + i] * world[1] +
+                  m[8 + i] * world[2] + m[12 + i];
+      out = clip_vertex{clip[0],     clip[1],     clip[2],    clip[3],
+                        c[0] * cm[0], c[1] * cm[1], c[2] * cm[2]};
+    }
+
+    rasterizer->draw(shaded.data(), vertex_indices.data(), count);
+  }
+}
+
+}  // namespace
+
+gl_frame_counters& gl_frame_counters::operator+=(const gl_frame_counters& rhs) {
+  calls += rhs.calls;
+  state_changes += rhs.state_changes;
+  uploads += rhs.uploads;
+  bytes_uploaded += rhs.bytes_uploaded;
+  uniform_bytes += rhs.uniform_bytes;
+  draw_calls += rhs.draw_calls;
+  indices_drawn += rhs.indices_drawn;
+  return *this;
+}
+
+gl_recorder& gl_recorder::instance() {
+  static gl_recorder recorder;
+  return recorder;
+}
+
+void gl_recorder::begin_frame() { frame_ = gl_frame_counters(); }
+
+void gl_recorder::reset_context() {
+  current_program = 0;
+  bound_array_buffer = 0;
+  bound_element_buffer = 0;
+  buffers.clear();
+  attributes.assign(16, gl_attribute());
+  cull_face = false;
+  depth_test = false;
+  std::fill_n(viewport, 4, 0);
+  std::fill_n(clear_color, 4, 0.0f);
+  locations_.clear();
+  uniforms_.clear();
+  error_ = GL_NO_ERROR;
+  debug_callback = nullptr;
+}
+
+void gl_recorder::record(const char* name, gl_call_kind kind, std::string args,
+                         size_t bytes) {
+  gl_frame_counters delta;
+  delta.calls = 1;
+  switch (kind) {
+    case gl_call_kind::other:
+      break;
+    case gl_call_kind::state:
+      delta.state_changes = 1;
+      delta.uniform_bytes = bytes;
+      break;
+    case gl_call_kind::upload:
+      delta.uploads = 1;
+      delta.bytes_uploaded = bytes;
+      break;
+    case gl_call_kind::draw:
+      delta.draw_calls = 1;
+      break;
+  }
+
+  frame_ += delta;
+  total_ += delta;
+
+  if (logging_) log_.push_back(gl_call{name, kind, std::move(args), bytes});
+
+  if (!failing_call_.empty() && failing_call_ == name) {
+    set_error(GL_INVALID_OPERATION);
+    if (fail_once_) failing_call_.clear();
+  }
+}
+
+void gl_recorder::count_indices(size_t count) {
+  frame_.indices_drawn += count;
+  total_.indices_drawn += count;
+}
+
+void gl_recorder::set_error(GLenum error) {
+  if (debug_callback) {
+    const auto message = "GL error " + std::to_string(error);
+    debug_callback(GL_DEBUG_SOURCE_API_KHR, GL_DEBUG_TYPE_ERROR_KHR, error,
+                   GL_DEBUG_SEVERITY_HIGH_KHR, message.size(), message.c_str(),
+                   nullptr);
+  }
+
+  // Like GL, only the first error is kept until it has been read.
+  if (error_ == GL_NO_ERROR) error_ = error;
+}
+
+GLenum gl_recorder::take_error() {
+  const auto result = error_;
+  error_ = GL_NO_ERROR;
+  return result;
+}
+
+GLint gl_recorder::location(GLuint program, const char* name) {
+  GLint next = 0;
+  for (const auto& entry : locations_) {
+    if (entry.program != program) continue;
+    if (entry.name == name) return entry.location;
+    ++next;
+  }
+  locations_.push_back(location_entry{program, name, next});
+  return next;
+}
+
+GLint gl_recorder::find_location(GLuint program, const char* name) const {
+  for (const auto& entry : locations_)
+    if (entry.program == program && entry.name == name) return entry.location;
+  return -1;
+}
+
+void gl_recorder::set_uniform(GLint location, const GLfloat* values,
+                              size_t count) {
+  if (location < 0) return;
+  for (auto& entry : uniforms_) {
+    if (entry.program == current_program && entry.location == location) {
+      entry.values.assign(values, values + count);
+      return;
+    }
+  }
+  uniforms_.push_back(uniform_entry{current_program, location,
+                                    std::vector<GLfloat>(values,
+                                                         values + count)});
+}
+
+const std::vector<GLfloat>* gl_recorder::uniform(GLuint program,
+                                                 const char* name) const {
+  const auto location = find_location(program, name);
+  for (const auto& entry : uniforms_)
+    if (entry.program == program && entry.location == location)
+      return &entry.values;
+  return nullptr;
+}
+
+std::ostream& operator<<(std::ostream& out, const gl_call& call) {
+  out << call.name << '(' << call.args << ')';
+  if (call.bytes) out << "  [" << call.bytes << " bytes]";
+  return out;
+}
+
+extern "C" {
+
+int __android_log_print(int, const char* tag, const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  fprintf(stderr, "%s: ", tag);
+  const auto result = vfprintf(stderr, fmt, args);
+  fputc('\n', stderr);
+  va_end(args);
+  return result;
+}
+
+// Objects.
+
+GLuint GL_APIENTRY glCreateShader(GLenum type) {
+  record("glCreateShader", gl_call_kind::other, 0, type);
+  return gl_recorder::instance().next_name();
+}
+
+void GL_APIENTRY glDeleteShader(GLuint shader) {
+  record("glDeleteShader", gl_call_kind::other, 0, shader);
+}
+
+void GL_APIENTRY glShaderSource(GLuint shader, GLsizei count,
+                                const GLchar* const* string,
+                                const GLint* length) {
+  size_t bytes = 0;
+  for (GLsizei i = 0; i < count; ++i)
+    bytes += (length && length[i] >= 0) ? length[i] : strlen(string[i]);
+  record("glShaderSource", gl_call_kind::upload, bytes, shader, count);
+}
+
+void GL_APIENTRY glCompileShader(GLuint shader) {
+  record("glCompileShader", gl_call_kind::other, 0, shader);
+}
+
+void GL_APIENTRY glGetShaderiv(GLuint shader, GLenum pname, GLint* params) {
+  record("glGetShaderiv", gl_call_kind::other, 0, shader, pname);
+  *params = (pname == GL_COMPILE_STATUS) ? GL_TRUE : 0;
+}
+
+void GL_APIENTRY glGetShaderInfoLog(GLuint shader, GLsizei bufSize,
+                                    GLsizei* length, GLchar* infoLog) {
+  record("glGetShaderInfoLog", gl_call_kind::other, 0, shader, bufSize);
+  if (length) *length = 0;
+  if (bufSize > 0) infoLog[0] = 0;
+}
+
+GLuint GL_APIENTRY glCreateProgram() {
+  record("glCreateProgram", gl_call_kind::other, 0);
+  return gl_recorder::instance().next_name();
+}
+
+void GL_APIENTRY glDeleteProgram(GLuint program) {
+  record("glDeleteProgram", gl_call_kind::other, 0, program);
+}
+
+void GL_APIENTRY glAttachShader(GLuint program, GLuint shader) {
+  record("glAttachShader", gl_call_kind::other, 0, program, shader);
+}
+
+void GL_APIENTRY glDetachShader(GLuint program, GLuint shader) {
+  record("glDetachShader", gl_call_kind::other, 0, program, shader);
+}
+
+void GL_APIENTRY glBindAttribLocation(GLuint program, GLuint index,
+                                      const GLchar* name) {
+  record("glBindAttribLocation", gl_call_kind::other, 0, program, index, name);
+}
+
+void GL_APIENTRY glLinkProgram(GLuint program) {
+  record("glLinkProgram", gl_call_kind::other, 0, program);
+}
+
+void GL_APIENTRY glGetProgramiv(GLuint program, GLenum pname, GLint* params) {
+  record("glGetProgramiv", gl_call_kind::other, 0, program, pname);
+  switch (pname) {
+    case GL_LINK_STATUS:
+      *params = (program == rejected_binary_program) ? GL_FALSE : GL_TRUE;
+      break;
+    case GL_PROGRAM_BINARY_LENGTH_OES:
+      *params = sizeof(kProgramBinary);
+      break;
+    default:
+      *params = 0;
+  }
+}
+
+void GL_APIENTRY glGetProgramInfoLog(GLuint program, GLsizei bufSize,
+                                     GLsizei* length, GLchar* infoLog) {
+  record("glGetProgramInfoLog", gl_call_kind::other, 0, program, bufSize);
+  if (length) *length = 0;
+  if (bufSize > 0) infoLog[0] = 0;
+}
+
+GLint GL_APIENTRY glGetAttribLocation(GLuint program, const GLchar* name) {
+  record("glGetAttribLocation", gl_call_kind::other, 0, program, name);
+  return gl_recorder::instance().location(program, name);
+}
+
+GLint GL_APIENTRY glGetUniformLocation(GLuint program, const GLchar* name) {
+  record("glGetUniformLocation", gl_call_kind::other, 0, program, name);
+  return gl_recorder::instance().location(program, name);
+}
+
+void GL_APIENTRY glGenBuffers(GLsizei n, GLuint* buffers) {
+  record("glGenBuffers", gl_call_kind::other, 0, n);
+  for (GLsizei i = 0; i < n; ++i)
+    buffers[i] = gl_recorder::instance().next_name();
+}
+
+void GL_APIENTRY glDeleteBuffers(GLsizei n, const GLuint* buffers) {
+  record("glDeleteBuffers", gl_call_kind::other, 0, n);
+  auto& r = gl_recorder::instance();
+  for (GLsizei i = 0; i < n; ++i) {
+    if (r.bound_array_buffer == buffers[i]) r.bound_array_buffer = 0;
+    if (r.bound_element_buffer == buffers[i]) r.bound_element_buffer = 0;
+    if (buffers[i] < r.buffers.size()) r.buffers[buffers[i]].clear();
+  }
+}
+
+// State.
+
+void GL_APIENTRY glUseProgram(GLuint program) {
+  record("glUseProgram", gl_call_kind::state, 0, program);
+  gl_recorder::instance().current_program = program;
+}
+
+void GL_APIENTRY glBindBuffer(GLenum target, GLuint buffer) {
+  record("glBindBuffer", gl_call_kind::state, 0, target, buffer);
+  auto& r = gl_recorder::instance();
+  if (target == GL_ARRAY_BUFFER)
+    r.bound_array_buffer = buffer;
+  else if (target == GL_ELEMENT_ARRAY_BUFFER)
+    r.bound_element_buffer = buffer;
+  else
+    r.set_error(GL_INVALID_ENUM);
+}
+
+void GL_APIENTRY glEnable(GLenum cap) {
+  record("glEnable", gl_call_kind::state, 0, cap);
+  set_capability(cap, true);
+}
+
+void GL_APIENTRY glDisable(GLenum cap) {
+  record("glDisable", gl_call_kind::state, 0, cap);
+  set_capability(cap, false);
+}
+
+void GL_APIENTRY glViewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+  record("glViewport", gl_call_kind::state, 0, x, y, width, height);
+  auto& viewport = gl_recorder::instance().viewport;
+  viewport[0] = x;
+  viewport[1] = y;
+  viewport[2] = width;
+  viewport[3] = height;
+}
+
+void GL_APIENTRY glClearColor(GLfloat red, GLfloat green, GLfloat blue,
+                              GLfloat alpha) {
+  record("glClearColor", gl_call_kind::state, 0, red, green, blue, alpha);
+  auto& color = gl_recorder::instance().clear_color;
+  color[0] = red;
+  color[1] = green;
+  color[2] = blue;
+  color[3] = alpha;
+}
+
+void GL_APIENTRY glVertexAttribPointer(GLuint index, GLint size, GLenum type,
+                                       GLboolean normalized, GLsizei stride,
+                                       const void* pointer) {
+  record("glVertexAttribPointer", gl_call_kind::state, 0, index, size, type,
+         int(normalized), stride, pointer);
+  auto a = attribute(index);
+  if (!a) return;
+  a->buffer = gl_recorder::instance().bound_array_buffer;
+  a->size = size;
+  a->type = type;
+  a->normalized = normalized;
+  a->stride = stride;
+  a->offset = reinterpret_cast<uintptr_t>(pointer);
+}
+
+void GL_APIENTRY glEnableVertexAttribArray(GLuint index) {
+  record("glEnableVertexAttribArray", gl_call_kind::state, 0, index);
+  if (auto a = attribute(index)) a->enabled = true;
+}
+
+void GL_APIENTRY glDisableVertexAttribArray(GLuint index) {
+  record("glDisableVertexAttribArray", gl_call_kind::state, 0, index);
+  if (auto a = attribute(index)) a->enabled = false;
+}
+
+void GL_APIENTRY glUniform1i(GLint location, GLint v0) {
+  record("glUniform1i", gl_call_kind::state, 4, location, v0);
+}
+
+void GL_APIENTRY glUniform1f(GLint location, GLfloat v0) {
+  record("glUniform1f", gl_call_kind::state, 4, location, v0);
+  gl_recorder::instance().set_uniform(location, &v0, 1);
+}
+
+void GL_APIENTRY glUniform3fv(GLint location, GLsizei count,
+                              const GLfloat* value) {
+  record("glUniform3fv", gl_call_kind::state,
+         uniform_bytes("glUniform3fv", count), location, count);
+  gl_recorder::instance().set_uniform(location, value, 3 * count);
+}
+
+void GL_APIENTRY glUniform4fv(GLint location, GLsizei count,
+                              const GLfloat* value) {
+  record("glUniform4fv", gl_call_kind::state,
+         uniform_bytes("glUniform4fv", count), location, count);
+  gl_recorder::instance().set_uniform(location, value, 4 * count);
+}
+
+void GL_APIENTRY glUniformMatrix4fv(GLint location, GLsizei count,
+                                    GLboolean transpose, const GLfloat* value) {
+  record("glUniformMatrix4fv", gl_call_kind::state,
+         uniform_bytes("glUniformMatrix4fv", count), location, count,
+         int(transpose));
+  if (transpose) return gl_recorder::instance().set_error(GL_INVALID_VALUE);
+  gl_recorder::instance().set_uniform(location, value, 16 * count);
+}
+
+// Data transfer.
+
+void GL_APIENTRY glBufferData(GLenum target, GLsizeiptr size, const void* data,
+                              GLenum usage) {
+  record("glBufferData", gl_call_kind::upload, data ? size : 0, target, size,
+         usage);
+  auto buffer = bound_buffer(target);
+  if (!buffer) return gl_recorder::instance().set_error(GL_INVALID_OPERATION);
+  if (data) {
+    const auto bytes = static_cast<const uint8_t*>(data);
+    buffer->assign(bytes, bytes + size);
+  } else {
+    buffer->assign(size, 0);
+  }
+}
+
+void GL_APIENTRY glBufferSubData(GLenum target, GLintptr offset,
+                                 GLsizeiptr size, const void* data) {
+  record("glBufferSubData", gl_call_kind::upload, size, target, offset, size);
+  auto buffer = bound_buffer(target);
+  if (!buffer) return gl_recorder::instance().set_error(GL_INVALID_OPERATION);
+  if (offset < 0 || size < 0 ||
+      offset + size > static_cast<GLintptr>(buffer->size()))
+    return gl_recorder::instance().set_error(GL_INVALID_VALUE);
+  memcpy(buffer->data() + offset, data, size);
+}
+
+// Drawing.
+
+void GL_APIENTRY glClear(GLbitfield mask) {
+  record("glClear", gl_call_kind::other, 0, mask);
+  auto& r = gl_recorder::instance();
+  if (r.rasterizer())
+    r.rasterizer()->clear(mask & GL_COLOR_BUFFER_BIT,
+                          mask & GL_DEPTH_BUFFER_BIT, r.clear_color, 1.0f);
+}
+
+void GL_APIENTRY glDrawArrays(GLenum mode, GLint first, GLsizei count) {
+  record("glDrawArrays", gl_call_kind::draw, 0, mode, first, count);
+}
+
+void GL_APIENTRY glDrawElements(GLenum mode, GLsizei count, GLenum type,
+                                const void* indices) {
+  record("glDrawElements", gl_call_kind::draw, 0, mode, count, type, indices);
+  auto& r = gl_recorder::instance();
+  if (!r.bound_element_buffer) return r.set_error(GL_INVALID_OPERATION);
+  r.count_indices(count);
+  rasterize(mode, count, type, indices, 1);
+}
+
+// GL_EXT_instanced_arrays, returned by eglGetProcAddress().
+
+void GL_APIENTRY glDrawElementsInstancedEXT(GLenum mode, GLsizei count,
+                                            GLenum type, const void* indices,
+                                            GLsizei primcount) {
+  record("glDrawElementsInstancedEXT", gl_call_kind::draw, 0, mode, count,
+         type, indices, primcount);
+  auto& r = gl_recorder::instance();
+  if (!r.bound_element_buffer) return r.set_error(GL_INVALID_OPERATION);
+  r.count_indices(count * primcount);
+  rasterize(mode, count, type, indices, primcount);
+}
+
+void GL_APIENTRY glVertexAttribDivisorEXT(GLuint index, GLuint divisor) {
+  record("glVertexAttribDivisorEXT", gl_call_kind::state, 0, index, divisor);
+  if (auto a = attribute(index)) a->divisor = divisor;
+}
+
+// GL_EXT_disjoint_timer_query, returned by eglGetProcAddress().  Results are
+// available at once, and always zero.
+
+void GL_APIENTRY glGenQueriesEXT(GLsizei n, GLuint* ids) {
+  record("glGenQueriesEXT", gl_call_kind::other, 0, n);
+  for (GLsizei i = 0; i < n; ++i) ids[i] = gl_recorder::instance().next_name();
+}
+
+void GL_APIENTRY glBeginQueryEXT(GLenum target, GLuint id) {
+  record("glBeginQueryEXT", gl_call_kind::other, 0, target, id);
+}
+
+void GL_APIENTRY glEndQueryEXT(GLenum target) {
+  record("glEndQueryEXT", gl_call_kind::other, 0, target);
+}
+
+void GL_APIENTRY glGetQueryObjectuivEXT(GLuint id, GLenum pname,
+                                        GLuint* params) {
+  record("glGetQueryObjectuivEXT", gl_call_kind::other, 0, id, pname);
+  *params = (pname == GL_QUERY_RESULT_AVAILABLE_EXT) ? GL_TRUE : 0;
+}
+
+void GL_APIENTRY glGetQueryObjectui64vEXT(GLuint id, GLenum pname,
+                                          GLuint64* params) {
+  record("glGetQueryObjectui64vEXT", gl_call_kind::other, 0, id, pname);
+  *params = 0;
+}
+
+// GL_OES_get_program_binary, returned by eglGetProcAddress().  Every program
+// has the same binary.  Programs given any other binary fail to link.
+
+void GL_APIENTRY glGetProgramBinaryOES(GLuint program, GLsizei bufSize,
+                                       GLsizei* length, GLenum* binaryFormat,
+                                       void* binary) {
+  record("glGetProgramBinaryOES", gl_call_kind::other, 0, program, bufSize);
+  if (bufSize < static_cast<GLsizei>(sizeof(kProgramBinary))) {
+    gl_recorder::instance().set_error(GL_INVALID_OPERATION);
+    return;
+  }
+  memcpy(binary, kProgramBinary, sizeof(kProgramBinary));
+  if (length) *length = sizeof(kProgramBinary);
+  *binaryFormat = kProgramBinaryFormat;
+}
+
+void GL_APIENTRY glProgramBinaryOES(GLuint program, GLenum binaryFormat,
+                                    const void* binary, GLint length) {
+  record("glProgramBinaryOES", gl_call_kind::upload, length, program,
+         binaryFormat, length);
+  if (binaryFormat != kProgramBinaryFormat ||
+      length != static_cast<GLint>(sizeof(kProgramBinary)) ||
+      memcmp(binary, kProgramBinary, length))
+    rejected_binary_program = program;
+}
+
+// GL_KHR_debug, returned by eglGetProcAddress().
+
+void GL_APIENTRY glDebugMessageCallbackKHR(GLDEBUGPROCKHR callback,
+                                           const void* user_param) {
+  record("glDebugMessageCallbackKHR", gl_call_kind::other, 0, user_param);
+  gl_recorder::instance().debug_callback = callback;
+}
+
+void GL_APIENTRY glFlush() { record("glFlush", gl_call_kind::other, 0); }
+
+void GL_APIENTRY glFinish() { record("glFinish", gl_call_kind::other, 0); }
+
+// Queries.
+
+GLenum GL_APIENTRY glGetError() {
+  record("glGetError", gl_call_kind::other, 0);
+  return gl_recorder::instance().take_error();
+}
+
+const GLubyte* GL_APIENTRY glGetString(GLenum name) {
+  record("glGetString", gl_call_kind::other, 0, name);
+  switch (name) {
+    case GL_VENDOR:
+      return reinterpret_cast<const GLubyte*>("hello-world");
+    case GL_RENDERER:
+      return reinterpret_cast<const GLubyte*>("GLES2 recorder");
+    case GL_VERSION:
+      return reinterpret_cast<const GLubyte*>("OpenGL ES 2.0 recorder");
+    case GL_SHADING_LANGUAGE_VERSION:
+      return reinterpret_cast<const GLubyte*>("OpenGL ES GLSL ES 1.00");
+    case GL_EXTENSIONS:
+      return reinterpret_cast<const GLubyte*>(
+          gl_recorder::instance().extensions().c_str());
+  }
+  gl_recorder::instance().set_error(GL_INVALID_ENUM);
+  return nullptr;
+}
+
+void GL_APIENTRY glGetIntegerv(GLenum pname, GLint* data) {
+  record("glGetIntegerv", gl_call_kind::other, 0, pname);
+  switch (pname) {
+    case GL_MAX_VERTEX_ATTRIBS:
+      *data = 16;
+      break;
+    case GL_MAX_VERTEX_UNIFORM_VECTORS:
+      *data = 256;
+      break;
+    case GL_NUM_PROGRAM_BINARY_FORMATS_OES:
+      *data = 1;
+      break;
+    default:
+      *data = 0;
+  }
+}
+
+__eglMustCastToProperFunctionPointerType EGLAPIENTRY
+eglGetProcAddress(const char* name) {
+  typedef __eglMustCastToProperFunctionPointerType function;
+  if (!strcmp(name, "glDrawElementsInstancedEXT"))
+    return reinterpret_cast<function>(glDrawElementsInstancedEXT);
+  if (!strcmp(name, "glVertexAttribDivisorEXT"))
+    return reinterpret_cast<function>(glVertexAttribDivisorEXT);
+  if (!strcmp(name, "glDebugMessageCallbackKHR"))
+    return reinterpret_cast<function>(glDebugMessageCallbackKHR);
+  if (!strcmp(name, "glGetProgramBinaryOES"))
+    return reinterpret_cast<function>(glGetProgramBinaryOES);
+  if (!strcmp(name, "glProgramBinaryOES"))
+    return reinterpret_cast<function>(glProgramBinaryOES);
+  if (!strcmp(name, "glGenQueriesEXT"))
+    return reinterpret_cast<function>(glGenQueriesEXT);
+  if (!strcmp(name, "glBeginQueryEXT"))
+    return reinterpret_cast<function>(glBeginQueryEXT);
+  if (!strcmp(name, "glEndQueryEXT"))
+    return reinterpret_cast<function>(glEndQueryEXT);
+  if (!strcmp(name, "glGetQueryObjectuivEXT"))
+    return reinterpret_cast<function>(glGetQueryObjectuivEXT);
+  if (!strcmp(name, "glGetQueryObjectui64vEXT"))
+    return reinterpret_cast<function>(glGetQueryObjectui64vEXT);
+  return nullptr;
+}
+
+}  // extern "C"
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+class tiled_rasterizer;
+
+// Host implementation of the GLES2 entry points used by the renderer, and of
+// eglGetProcAddress() for the extension functions it looks up.  Every call
+// is appended to a log together with its arguments, and summarized in
+// per-frame counters.  Drawing only takes place if a tiled_rasterizer is
+// attached.
+
+enum class gl_call_kind {
+  // Queries, object creation, shader compilation and the like.
+  other,
+  // Calls that change pipeline state: bindings, capabilities, uniforms,
+  // attribute setup, clear color and so on.
+  state,
+  // Calls that transfer data from the CPU to GL memory.
+  upload,
+  draw,
+};
+
+struct gl_call {
+  const char* name;
+  gl_call_kind kind;
+  std::string args;
+  // Number of bytes transferred to GL memory by an upload, or set by a
+  // uniform call.
+  size_t bytes;
+};
+
+struct gl_frame_counters {
+  size_t calls = 0;
+  size_t state_changes = 0;
+  size_t uploads = 0;
+  size_t bytes_uploaded = 0;
+  // Uniform values set, which are counted as state changes, not uploads.
+  size_t uniform_bytes = 0;
+  size_t draw_calls = 0;
+  size_t indices_drawn = 0;
+
+  gl_frame_counters& operator+=(const gl_frame_counters& rhs);
+};
+
+// A vertex attribute array, as set by glVertexAttribPointer().
+struct gl_attribute {
+  bool enabled = false;
+  GLuint buffer = 0;
+  GLint size = 4;
+  GLenum type = GL_FLOAT;
+  bool normalized = false;
+  GLsizei stride = 0;
+  uintptr_t offset = 0;
+  GLuint divisor = 0;
+};
+
+class gl_recorder {
+ public:
+  static gl_recorder& instance();
+
+  // Starts a new frame, resetting the frame counters.
+  void begin_frame();
+
+  const gl_frame_counters& frame() const { return frame_; }
+  const gl_frame_counters& total() const { return total_; }
+
+  // Returns every call recorded since the last clear_log().
+  const std::vector<gl_call>& log() const { return log_; }
+  void clear_log() { log_.clear(); }
+
+  // Disables the call log, keeping only counters.  Useful for long runs.
+  void set_logging(bool enable) { logging_ = enable; }
+  bool logging() const { return logging_; }
+
+  // Sets the string returned by glGetString(GL_EXTENSIONS).
+  void set_extensions(std::string extensions) {
+    extensions_ = std::move(extensions);
+  }
+  const std::string& extensions() const { return extensions_; }
+
+  // Makes every call to the entry point `name` raise GL_INVALID_OPERATION,
+  // or with `once`, only the first, for testing error handling.
+  void set_failing_call(std::string name, bool once = false) {
+    failing_call_ = std::move(name);
+    fail_once_ = once;
+  }
+
+  // Forgets all objects, as if the GL context had been destroyed.
+  void reset_context();
+
+  // Renders draw calls with `rasterizer`, or with nothing if it is null.
+  // Vertices are shaded by a C++ version of the renderer's sphere shader.
+  void set_rasterizer(tiled_rasterizer* rasterizer) {
+    rasterizer_ = rasterizer;
+  }
+  tiled_rasterizer* rasterizer() const { return rasterizer_; }
+
+  // Used by the entry points.
+  void record(const char* name, gl_call_kind kind, std::string args,
+              size_t bytes = 0);
+  void count_indices(size_t count);
+  void set_error(GLenum error);
+  GLenum take_error();
+
+  GLuint next_name() { return ++last_name_; }
+
+  // Returns a stable location for `name` in `program`.
+  GLint location(GLuint program, const char* name);
+
+  // Returns the location of `name` if the renderer has asked for it, or -1.
+  GLint find_location(GLuint program, const char* name) const;
+
+  // Stores the value of a uniform of the current program.
+  void set_uniform(GLint location, const GLfloat* values, size_t count);
+
+  // Returns the value last set for a uniform, or null.
+  const std::vector<GLfloat>* uniform(GLuint program, const char* name) const;
+
+  GLuint current_program = 0;
+  GLuint bound_array_buffer = 0;
+  GLuint bound_element_buffer = 0;
+
+  // Contents of buffer objects, indexed by name.
+  std::vector<std::vector<uint8_t>> buffers;
+
+  std::vector<gl_attribute> attributes;
+  bool cull_face = false;
+  bool depth_test = false;
+  GLint viewport[4] = {0, 0, 0, 0};
+  GLfloat clear_color[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+
+  // Set by glDebugMessageCallbackKHR(), and called synchronously for every
+  // error.
+  GLDEBUGPROCKHR debug_callback = nullptr;
+
+ private:
+  gl_recorder() { reset_context(); }
+
+  gl_frame_counters frame_;
+  gl_frame_counters total_;
+  std::vector<gl_call> log_;
+  bool logging_ = true;
+
+  std::string extensions_;
+  std::string failing_call_;
+  bool fail_once_ = false;
+  GLenum error_ = GL_NO_ERROR;
+  GLuint last_name_ = 0;
+
+  struct location_entry {
+    GLuint program;
+    std::string name;
+    GLint location;
+  };
+  std::vector<location_entry> locations_;
+
+  struct uniform_entry {
+    GLuint program;
+    GLint location;
+    std::vector<GLfloat> values;
+  };
+  std::vector<uniform_entry> uniforms_;
+
+  tiled_rasterizer* rasterizer_ = nullptr;
+};
+
+std::ostream& operator<<(std::ostream& out, const gl_call& call);
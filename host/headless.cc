@@ -0,0 +1,250 @@
+// Runs the native renderer against the recording GLES2 backend, and prints
+// per-frame GL traffic and heap allocations.  With --check-allocations, fails
+// if any frame after the first allocates.  Reports the first frame after
+// which drawFrame() found the picture still, which with --still, stopping the
+// camera, should come early.  --fail-call makes every call to a GL entry
+// point fail, and --fail-once only its first call in the second frame.  With
+// --image or --compare, frames are also drawn by the software rasterizer, and
+// the last one is written to a PPM file or compared against one.
+//
+// Usage: headless [--frames N] [--width W] [--height H] [--quality Q]
+//                 [--spheres N] [--extensions LIST] [--cache-dir DIR]
+//                 [--fail-call NAME] [--fail-once NAME] [--trace]
+//                 [--image FILE] [--compare FILE] [--tolerance N]
+//                 [--raster-threads N] [--check-allocations] [--still]
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "allocation_counter.h"
+#include "gles2_recorder.h"
+#include "rasterizer.h"
+#include "renderer.h"
+#include "utils/job_system.h"
+
+namespace {
+
+void print_counters(const char* label, const gl_frame_counters& c,
+                    size_t allocations) {
+  printf("%-8s calls=%zu state_changes=%zu uploads=%zu bytes_uploaded=%zu "
+         "uniform_bytes=%zu draw_calls=%zu indices=%zu allocations=%zu\n",
+         label, c.calls, c.state_changes, c.uploads, c.bytes_uploaded,
+         c.uniform_bytes, c.draw_calls, c.indices_drawn, allocations);
+}
+
+void print_log(gl_recorder& recorder) {
+  for (const auto& call : recorder.log()) std::cout << "  " << call << '\n';
+  std::cout.flush();
+  recorder.clear_log();
+}
+
+// Compares the rasterizer's image against a PPM file, allowing each channel
+// to differ by `tolerance`.  Returns false, and describes the difference, if
+// they do not match.
+bool compare_image(const tiled_rasterizer& rasterizer, const std::string& path,
+                   int tolerance) {
+  std::vector<uint32_t> expected;
+  int width, height;
+  if (!read_ppm(path, &expected, &width, &height)) {
+    fprintf(stderr, "%s: could not read image\n", path.c_str());
+    return false;
+  }
+  if (width != rasterizer.width() || height != rasterizer.height()) {
+    fprintf(stderr, "%s: image is %dx%d, expected %dx%d\n", path.c_str(),
+            width, height, rasterizer.width(), rasterizer.height());
+    return false;
+  }
+
+  const auto actual = rasterizer.read_pixels();
+  size_t differing = 0;
+  int max_difference = 0;
+  for (size_t i = 0; i < actual.size(); ++i) {
+    int difference = 0;
+    for (int shift = 0; shift < 24; shift += 8) {
+      const int a = (actual[i] >> shift) & 0xff;
+      const int b = (expected[i] >> shift) & 0xff;
+      difference = std::max(difference, abs(a - b));
+    }
+    if (difference > tolerance) ++differing;
+    max_difference = std::max(max_difference, difference);
+  }
+
+  if (differing) {
+    fprintf(stderr, "%s: %zu pixels differ by more than %d, up to %d\n",
+            path.c_str(), differing, tolerance, max_difference);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int frames = 10;
+  int width = 1280, height = 720;
+  bool trace = false;
+  std::string image_path, compare_path, fail_once;
+  int tolerance = 0;
+  int raster_threads = -1;
+  bool check_allocations = false;
+
+  auto& recorder = gl_recorder::instance();
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+      frames = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--width") && i + 1 < argc) {
+      width = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--height") && i + 1 < argc) {
+      height = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--quality") && i + 1 < argc) {
+      setSphereQuality(atoi(argv[++i]));
+    } else if (!strcmp(argv[i], "--spheres") && i + 1 < argc) {
+      setSphereCount(atoi(argv[++i]));
+    } else if (!strcmp(argv[i], "--extensions") && i + 1 < argc) {
+      recorder.set_extensions(argv[++i]);
+    } else if (!strcmp(argv[i], "--cache-dir") && i + 1 < argc) {
+      setCacheDirectory(argv[++i]);
+    } else if (!strcmp(argv[i], "--fail-call") && i + 1 < argc) {
+      recorder.set_failing_call(argv[++i]);
+    } else if (!strcmp(argv[i], "--fail-once") && i + 1 < argc) {
+      fail_once = argv[++i];
+    } else if (!strcmp(argv[i], "--trace")) {
+      trace = true;
+    } else if (!strcmp(argv[i], "--image") && i + 1 < argc) {
+      image_path = argv[++i];
+    } else if (!strcmp(argv[i], "--compare") && i + 1 < argc) {
+      compare_path = argv[++i];
+    } else if (!strcmp(argv[i], "--tolerance") && i + 1 < argc) {
+      tolerance = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--raster-threads") && i + 1 < argc) {
+      raster_threads = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--check-allocations")) {
+      check_allocations = true;
+    } else if (!strcmp(argv[i], "--still")) {
+      setCameraAnimation(false);
+    } else {
+      fprintf(stderr,
+              "Usage: %s [--frames N] [--width W] [--height H] [--quality Q] "
+              "[--spheres N] [--extensions LIST] [--cache-dir DIR] "
+              "[--fail-call NAME] [--fail-once NAME] [--trace] [--image FILE] "
+              "[--compare FILE] [--tolerance N] [--raster-threads N] "
+              "[--check-allocations] [--still]\n",
+              argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  recorder.set_logging(trace);
+
+  std::unique_ptr<job_system> raster_jobs;
+  std::unique_ptr<tiled_rasterizer> rasterizer;
+  if (!image_path.empty() || !compare_path.empty()) {
+    raster_jobs.reset(new job_system(raster_threads < 0
+                                         ? job_system::default_thread_count()
+                                         : raster_threads));
+    rasterizer.reset(new tiled_rasterizer(raster_jobs.get()));
+    rasterizer->resize(width, height);
+    recorder.set_rasterizer(rasterizer.get());
+  }
+
+  try {
+    auto allocations = allocations_so_far();
+    recorder.begin_frame();
+    surfaceCreated();
+    surfaceChanged(width, height);
+    print_counters("setup", recorder.frame(),
+                   allocations_since(allocations).allocations);
+    if (trace) print_log(recorder);
+
+    gl_frame_counters frame_total;
+    size_t allocation_total = 0, steady_allocations = 0;
+    int first_still = -1;
+    for (int i = 0; i < frames; ++i) {
+      // Setup marks the first frame for checking call by call, so the error
+      // comes in the second.
+      if (i == 1 && !fail_once.empty())
+        recorder.set_failing_call(fail_once, true);
+
+      allocations = allocations_so_far();
+      recorder.begin_frame();
+      const auto animating = drawFrame();
+      if (animating)
+        first_still = -1;
+      else if (first_still < 0)
+        first_still = i;
+      if (rasterizer) rasterizer->flush();
+      const auto frame_allocations =
+          allocations_since(allocations).allocations;
+
+      char label[32];
+      snprintf(label, sizeof(label), "frame %d", i);
+      print_counters(label, recorder.frame(), frame_allocations);
+      if (trace) print_log(recorder);
+
+      frame_total += recorder.frame();
+      allocation_total += frame_allocations;
+      if (i) steady_allocations += frame_allocations;
+    }
+
+    if (frames > 0) {
+      gl_frame_counters average;
+      average.calls = frame_total.calls / frames;
+      average.state_changes = frame_total.state_changes / frames;
+      average.uploads = frame_total.uploads / frames;
+      average.bytes_uploaded = frame_total.bytes_uploaded / frames;
+      average.uniform_bytes = frame_total.uniform_bytes / frames;
+      average.draw_calls = frame_total.draw_calls / frames;
+      average.indices_drawn = frame_total.indices_drawn / frames;
+      print_counters("average", average, allocation_total / frames);
+
+      std::array<float, frame_stats::kSnapshotSize> stats;
+      getFrameStats(&stats);
+      const auto cpu =
+          &stats[1 + 3 * static_cast<size_t>(frame_metric::cpu_total)];
+      printf("cpu_total p50=%.3fms p95=%.3fms p99=%.3fms\n", cpu[0], cpu[1],
+             cpu[2]);
+
+      if (first_still >= 0)
+        printf("still    after frame %d\n", first_still);
+      else
+        printf("still    never\n");
+    }
+
+    // The call log and the software rasterizer allocate on their own.
+    if (check_allocations && steady_allocations) {
+      fprintf(stderr, "%zu allocations after the first frame\n",
+              steady_allocations);
+      return EXIT_FAILURE;
+    }
+
+    if (rasterizer) {
+      const auto& stats = rasterizer->stats();
+      printf("raster   triangles=%zu binned=%zu pixels=%zu\n",
+             stats.triangles_in, stats.triangles_binned, stats.pixels_written);
+
+      const auto pixels = rasterizer->read_pixels();
+      if (!image_path.empty() &&
+          !write_ppm(image_path, pixels.data(), width, height)) {
+        fprintf(stderr, "%s: could not write image\n", image_path.c_str());
+        return EXIT_FAILURE;
+      }
+      if (!compare_path.empty() &&
+          !compare_image(*rasterizer, compare_path, tolerance))
+        return EXIT_FAILURE;
+    }
+  } catch (std::runtime_error& e) {
+    fprintf(stderr, "Runtime error: %s\n", e.what());
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
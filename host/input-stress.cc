@@ -0,0 +1,169 @@
+// Stress test for the touch event ring: a producer thread pushes numbered
+// events in bursts while the main thread drains them at random intervals,
+// checking that every event arrives once, intact and in order, also as the
+// counters wrap.  Also checks that the last free slot is kept for ups, and
+// which events drain_coalesced() passes on.
+// Exits with an error on the first wrong result.
+//
+// Usage: input-stress [--events N] [--capacity N]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "utils/input_ring.h"
+
+namespace {
+
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+              #cond);                                                   \
+      exit(EXIT_FAILURE);                                               \
+    }                                                                   \
+  } while (0)
+
+// Buffer aligned like a direct ByteBuffer.
+std::vector<uint32_t> make_buffer(size_t capacity) {
+  return std::vector<uint32_t>(input_ring::buffer_size(capacity) / 4);
+}
+
+input_event numbered_event(uint32_t n) {
+  return {float(n % 4096), float(n / 4096),
+          static_cast<input_action>(n % 3), int32_t(n * 7)};
+}
+
+void test_ordering(size_t count, size_t capacity) {
+  auto buffer = make_buffer(capacity);
+  input_ring producer(buffer.data(), buffer.size() * 4);
+  input_ring consumer(buffer.data(), buffer.size() * 4);
+  CHECK(producer.capacity() == capacity);
+
+  // Starts near the wrapping point of the counters.
+  const uint32_t start = ~uint32_t(0) - uint32_t(count / 2);
+  buffer[input_ring::kWriteOffset / 4] = start;
+  buffer[input_ring::kReadOffset / 4] = start;
+
+  std::thread thread([&producer, count, start] {
+    std::mt19937 rng(2);
+    for (size_t i = 0; i < count;) {
+      const auto burst = rng() % 64;
+      for (size_t j = 0; j < burst && i < count; ++i, ++j) {
+        while (!producer.push(numbered_event(start + i)))
+          std::this_thread::yield();
+      }
+      if (rng() % 8 == 0) std::this_thread::yield();
+    }
+  });
+
+  std::mt19937 rng(3);
+  uint32_t next = start;
+  size_t received = 0;
+  while (received < count) {
+    received += consumer.drain([&next](const input_event& event) {
+      const auto expected = numbered_event(next++);
+      CHECK(!memcmp(&event, &expected, sizeof(event)));
+    });
+    if (rng() % 4 == 0)
+      std::this_thread::sleep_for(std::chrono::microseconds(rng() % 100));
+  }
+  thread.join();
+
+  CHECK(received == count);
+  CHECK(next == uint32_t(start + count));
+  CHECK(consumer.drain([](const input_event&) { CHECK(false); }) == 0);
+}
+
+input_event action_event(input_action action) {
+  return {0.0f, 0.0f, action, 0};
+}
+
+void test_full(size_t capacity) {
+  auto buffer = make_buffer(capacity);
+  input_ring ring(buffer.data(), buffer.size() * 4);
+  for (size_t i = 0; i + 1 < capacity; ++i)
+    CHECK(ring.push(action_event(input_action::move)));
+
+  // The last slot is kept for an up.
+  CHECK(!ring.push(action_event(input_action::move)));
+  CHECK(!ring.push(action_event(input_action::down)));
+  CHECK(ring.push(action_event(input_action::up)));
+  CHECK(!ring.push(action_event(input_action::up)));
+  CHECK(ring.drain([](const input_event&) {}) == capacity);
+
+  // However the ring fills after a down, its up still fits.
+  CHECK(ring.push(action_event(input_action::down)));
+  while (ring.push(action_event(input_action::move))) {
+  }
+  CHECK(!ring.push(action_event(input_action::down)));
+  CHECK(ring.push(action_event(input_action::up)));
+  input_action last = input_action::move;
+  CHECK(ring.drain([&last](const input_event& event) {
+    last = event.action;
+  }) == capacity);
+  CHECK(last == input_action::up);
+}
+
+void test_coalescing() {
+  auto buffer = make_buffer(16);
+  input_ring ring(buffer.data(), buffer.size() * 4);
+
+  const input_action actions[] = {
+      input_action::move, input_action::move, input_action::down,
+      input_action::move, input_action::move, input_action::move,
+      input_action::up,   input_action::down, input_action::move};
+  for (size_t i = 0; i < sizeof(actions) / sizeof(actions[0]); ++i)
+    CHECK(ring.push({float(i), 0.0f, actions[i], 0}));
+
+  // The last move of each run, and every down and up.
+  const float expected[] = {1, 2, 5, 6, 7, 8};
+  std::vector<float> passed;
+  const auto drained = ring.drain_coalesced(
+      [&passed](const input_event& event) { passed.push_back(event.x); });
+  CHECK(drained == sizeof(actions) / sizeof(actions[0]));
+  CHECK(passed == std::vector<float>(std::begin(expected), std::end(expected)));
+}
+
+void test_detached() {
+  input_ring ring;
+  CHECK(!ring.attached());
+  CHECK(ring.drain([](const input_event&) { CHECK(false); }) == 0);
+
+  uint32_t small[4] = {};
+  CHECK(!input_ring(small, sizeof(small)).attached());
+  auto one_slot = make_buffer(1);
+  CHECK(!input_ring(one_slot.data(), one_slot.size() * 4).attached());
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t events = 1000000;
+  size_t capacity = 256;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--events") && i + 1 < argc) {
+      events = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--capacity") && i + 1 < argc) {
+      capacity = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "Usage: %s [--events N] [--capacity N]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  CHECK(capacity >= 2 && !(capacity & (capacity - 1)));
+
+  test_detached();
+  test_coalescing();
+  test_full(capacity);
+  test_ordering(events, capacity);
+  test_ordering(events / 10, 2);
+
+  printf("ok\n");
+  return EXIT_SUCCESS;
+}
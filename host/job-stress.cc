@@ -0,0 +1,192 @@
+// Stress test for the job system: random dependency graphs, nested
+// parallel loops, exceptions, submission from several threads, and pools
+// created and destroyed under load.  Exits with an error on the first wrong
+// result.
+//
+// Usage: job-stress [--threads N] [--rounds N]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "utils/job_system.h"
+
+namespace {
+
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+              #cond);                                                   \
+      exit(EXIT_FAILURE);                                               \
+    }                                                                   \
+  } while (0)
+
+void test_parallel_for(job_system& jobs) {
+  const size_t count = 1000003;
+  std::vector<uint8_t> visits(count);
+  for (size_t grain : {1, 7, 1000, 65536, 2000000}) {
+    std::fill(visits.begin(), visits.end(), 0);
+    jobs.parallel_for(count, grain, [&visits](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) ++visits[i];
+    });
+    for (size_t i = 0; i < count; ++i) CHECK(visits[i] == 1);
+  }
+
+  size_t calls = 0;
+  jobs.parallel_for(0, 16, [&calls](size_t, size_t) { ++calls; });
+  CHECK(calls == 0);
+}
+
+// Builds a random graph where each job depends on up to four earlier ones,
+// and checks that every job starts after all of its dependencies finished.
+void test_dependencies(job_system& jobs, std::mt19937& rng) {
+  const size_t count = 5000;
+  std::vector<std::atomic<bool>> finished(count);
+  std::vector<std::vector<size_t>> dependencies(count);
+  std::vector<job_system::handle> handles(count);
+  std::atomic<size_t> violations(0);
+
+  for (size_t i = 0; i < count; ++i) {
+    finished[i] = false;
+    if (i) {
+      std::uniform_int_distribution<size_t> earlier(0, i - 1);
+      const auto n = rng() % 5;
+      for (size_t j = 0; j < n; ++j) dependencies[i].push_back(earlier(rng));
+    }
+
+    std::vector<job_system::handle> after;
+    for (const auto d : dependencies[i]) after.push_back(handles[d]);
+
+    handles[i] = jobs.run(
+        [&, i] {
+          for (const auto d : dependencies[i])
+            if (!finished[d]) ++violations;
+          finished[i] = true;
+        },
+        after.begin(), after.end());
+  }
+
+  for (const auto& handle : handles) jobs.wait(handle);
+  CHECK(violations == 0);
+  for (size_t i = 0; i < count; ++i) CHECK(finished[i]);
+}
+
+// Jobs that run parallel loops of their own, waiting on the pool from inside
+// it.
+void test_nested(job_system& jobs) {
+  std::atomic<size_t> total(0);
+  std::vector<job_system::handle> handles;
+  for (size_t i = 0; i < 64; ++i)
+    handles.push_back(jobs.run([&jobs, &total] {
+      jobs.parallel_for(1000, 10, [&total](size_t begin, size_t end) {
+        total += end - begin;
+      });
+    }));
+  for (const auto& handle : handles) jobs.wait(handle);
+  CHECK(total == 64 * 1000);
+}
+
+void test_exceptions(job_system& jobs) {
+  auto failing = jobs.run([] { throw std::runtime_error("job"); });
+  // Dependents of a failed job still run.
+  std::atomic<bool> ran(false);
+  auto dependent = jobs.run([&ran] { ran = true; }, {failing});
+
+  bool caught = false;
+  try {
+    jobs.wait(failing);
+  } catch (std::runtime_error& e) {
+    caught = !strcmp(e.what(), "job");
+  }
+  CHECK(caught);
+  jobs.wait(dependent);
+  CHECK(ran);
+
+  caught = false;
+  try {
+    jobs.parallel_for(10000, 10, [](size_t begin, size_t end) {
+      if (begin <= 5000 && 5000 < end) throw std::runtime_error("loop");
+    });
+  } catch (std::runtime_error& e) {
+    caught = !strcmp(e.what(), "loop");
+  }
+  CHECK(caught);
+}
+
+// Several threads outside the pool submit and wait at once.
+void test_external_threads(job_system& jobs) {
+  std::atomic<size_t> total(0);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < 4; ++t)
+    threads.emplace_back([&jobs, &total] {
+      for (size_t round = 0; round < 100; ++round) {
+        auto a = jobs.run([&total] { ++total; });
+        auto b = jobs.run([&total] { ++total; });
+        auto c = jobs.run([&total] { ++total; }, {a, b});
+        jobs.wait(c);
+        jobs.parallel_for(100, 3, [&total](size_t begin, size_t end) {
+          total += end - begin;
+        });
+      }
+    });
+  for (auto& thread : threads) thread.join();
+  CHECK(total == 4 * 100 * (3 + 100));
+}
+
+void test_lifetime(size_t threads) {
+  for (size_t i = 0; i < 200; ++i) {
+    job_system jobs(threads);
+    std::atomic<size_t> total(0);
+    jobs.parallel_for(100, 1, [&total](size_t begin, size_t end) {
+      total += end - begin;
+    });
+    CHECK(total == 100);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  // A fixed count, so that the workers are exercised on any host.  With
+  // --threads 0, every job runs inline on the calling thread.
+  size_t threads = 4;
+  size_t rounds = 20;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--rounds") && i + 1 < argc) {
+      rounds = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "Usage: %s [--threads N] [--rounds N]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  std::mt19937 rng(1);
+
+  job_system jobs(threads);
+  for (size_t round = 0; round < rounds; ++round) {
+    test_parallel_for(jobs);
+    test_dependencies(jobs, rng);
+    test_nested(jobs);
+    test_exceptions(jobs);
+    test_external_threads(jobs);
+  }
+  test_lifetime(threads);
+
+  const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start);
+  printf("%zu rounds with %zu worker threads passed in %lld ms\n", rounds,
+         threads, static_cast<long long>(elapsed.count()));
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,192 @@
+// Checks the buffer uploads of gl/mesh.h against the recording GLES2
+// backend: a full upload first, then one glBufferSubData per buffer covering
+// every range marked dirty since the last upload, and nothing when nothing
+// is dirty.  Also checks that the buffers hold the CPU copies afterwards.
+// Exits with an error on the first wrong result.
+//
+// Usage: mesh-check
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "gl/mesh.h"
+#include "gles2_recorder.h"
+
+namespace {
+
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+              #cond);                                                   \
+      exit(EXIT_FAILURE);                                               \
+    }                                                                   \
+  } while (0)
+
+struct test_vertex {
+  float x, y, z;
+};
+
+typedef mesh<test_vertex, uint16_t> test_mesh;
+
+struct buffer_upload {
+  GLenum target;
+  size_t offset;
+  size_t size;
+
+  bool operator==(const buffer_upload& rhs) const {
+    return target == rhs.target && offset == rhs.offset && size == rhs.size;
+  }
+};
+
+// Returns the glBufferSubData calls logged since the last call, and checks
+// that there was no other upload.
+std::vector<buffer_upload> take_sub_uploads() {
+  auto& recorder = gl_recorder::instance();
+  std::vector<buffer_upload> result;
+  for (const auto& call : recorder.log()) {
+    if (call.kind != gl_call_kind::upload) continue;
+    CHECK(!strcmp(call.name, "glBufferSubData"));
+
+    buffer_upload upload;
+    CHECK(sscanf(call.args.c_str(), "%u, %zu, %zu", &upload.target,
+                 &upload.offset, &upload.size) == 3);
+    result.push_back(upload);
+  }
+  recorder.clear_log();
+  return result;
+}
+
+size_t count_calls(const char* name) {
+  size_t result = 0;
+  for (const auto& call : gl_recorder::instance().log())
+    result += !strcmp(call.name, name);
+  return result;
+}
+
+// Checks that the bound buffers hold the mesh's CPU copies.
+void check_contents(test_mesh& m) {
+  auto& recorder = gl_recorder::instance();
+  const auto& vertices = recorder.buffers[recorder.bound_array_buffer];
+  const auto& indices = recorder.buffers[recorder.bound_element_buffer];
+  CHECK(vertices.size() == m.vertex_count() * sizeof(test_vertex));
+  CHECK(indices.size() == m.index_count() * sizeof(uint16_t));
+  CHECK(!memcmp(vertices.data(), m.vertex_data(), vertices.size()));
+  CHECK(!memcmp(indices.data(), m.index_data(), indices.size()));
+}
+
+void test_dirty_ranges() {
+  auto& recorder = gl_recorder::instance();
+  recorder.reset_context();
+  gl_state::current().invalidate();
+
+  std::vector<test_vertex> vertices(100);
+  std::vector<uint16_t> indices(300);
+  for (size_t i = 0; i < vertices.size(); ++i)
+    vertices[i] = {float(i), 0.0f, 0.0f};
+  for (size_t i = 0; i < indices.size(); ++i) indices[i] = i % 100;
+
+  test_mesh m;
+  m.assign(vertices, indices);
+  m.bind_for_draw();
+  CHECK(count_calls("glBufferData") == 2);
+  CHECK(count_calls("glBufferSubData") == 0);
+  check_contents(m);
+  recorder.clear_log();
+
+  // Nothing is dirty, so nothing is uploaded.
+  m.bind_for_draw();
+  CHECK(take_sub_uploads().empty());
+
+  // Two disjoint ranges are sent as the one range spanning both.
+  m.vertices()[10].y = 1.0f;
+  m.vertices()[41].y = 2.0f;
+  m.mark_vertices_dirty(10, 5);
+  m.mark_vertices_dirty(40, 10);
+  m.bind_for_draw();
+  auto uploads = take_sub_uploads();
+  CHECK(uploads.size() == 1);
+  CHECK((uploads[0] == buffer_upload{GL_ARRAY_BUFFER, 10 * sizeof(test_vertex),
+                                     40 * sizeof(test_vertex)}));
+  check_contents(m);
+
+  m.bind_for_draw();
+  CHECK(take_sub_uploads().empty());
+
+  // Overlapping ranges, in both buffers.
+  m.vertices()[99].z = 3.0f;
+  m.indices()[20] = 7;
+  m.mark_vertices_dirty(90, 10);
+  m.mark_vertices_dirty(85, 10);
+  m.mark_indices_dirty(20, 10);
+  m.mark_indices_dirty(25, 10);
+  m.bind_for_draw();
+  uploads = take_sub_uploads();
+  CHECK(uploads.size() == 2);
+  CHECK((uploads[0] == buffer_upload{GL_ARRAY_BUFFER, 85 * sizeof(test_vertex),
+                                     15 * sizeof(test_vertex)}));
+  CHECK((uploads[1] == buffer_upload{GL_ELEMENT_ARRAY_BUFFER,
+                                     20 * sizeof(uint16_t),
+                                     15 * sizeof(uint16_t)}));
+  check_contents(m);
+
+  // Empty ranges mark nothing.
+  m.mark_vertices_dirty(50, 0);
+  m.bind_for_draw();
+  CHECK(take_sub_uploads().empty());
+
+  // After a lost context, everything is uploaded again in full, and earlier
+  // dirty ranges are dropped.
+  m.mark_vertices_dirty(0, 1);
+  recorder.reset_context();
+  gl_state::current().invalidate();
+  m.context_lost();
+  m.bind_for_draw();
+  CHECK(count_calls("glBufferData") == 2);
+  CHECK(count_calls("glBufferSubData") == 0);
+  check_contents(m);
+  recorder.clear_log();
+}
+
+void test_released_cpu_data() {
+  auto& recorder = gl_recorder::instance();
+  recorder.reset_context();
+  gl_state::current().invalidate();
+
+  test_mesh m;
+  m.assign(std::vector<test_vertex>(10), std::vector<uint16_t>(30));
+  m.bind_for_draw();
+  m.release_cpu_data();
+  recorder.clear_log();
+
+  CHECK(m.vertex_data() == nullptr && m.index_data() == nullptr);
+  CHECK(m.has_data());
+  m.bind_for_draw();
+  CHECK(recorder.log().size() <= 2);
+  CHECK(take_sub_uploads().empty());
+
+  // The data is gone, so there is nothing to mark dirty, and nothing left to
+  // draw once the context is lost.
+  bool threw = false;
+  try {
+    m.mark_vertices_dirty(0, 1);
+  } catch (const std::exception&) {
+    threw = true;
+  }
+  CHECK(threw);
+
+  m.context_lost();
+  CHECK(!m.has_data());
+}
+
+}  // namespace
+
+int main() {
+  test_dirty_ranges();
+  test_released_cpu_data();
+
+  printf("ok\n");
+  return EXIT_SUCCESS;
+}
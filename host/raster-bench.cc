@@ -0,0 +1,97 @@
+// Measures software rasterizer throughput on the renderer's own frames, on
+// one thread and on the job system.  Shading and binning happen inside
+// drawFrame(), and are reported separately from rendering the tiles.
+//
+// Usage: raster-bench [--frames N] [--width W] [--height H] [--spheres N]
+//                     [--quality Q]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include "gles2_recorder.h"
+#include "rasterizer.h"
+#include "renderer.h"
+#include "utils/job_system.h"
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+
+double seconds_since(clock_type::time_point start) {
+  return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int frames = 30;
+  int width = 1280, height = 720;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+      frames = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--width") && i + 1 < argc) {
+      width = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--height") && i + 1 < argc) {
+      height = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--spheres") && i + 1 < argc) {
+      setSphereCount(atoi(argv[++i]));
+    } else if (!strcmp(argv[i], "--quality") && i + 1 < argc) {
+      setSphereQuality(atoi(argv[++i]));
+    } else {
+      fprintf(stderr,
+              "Usage: %s [--frames N] [--width W] [--height H] [--spheres N] "
+              "[--quality Q]\n",
+              argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  auto& recorder = gl_recorder::instance();
+  recorder.set_logging(false);
+  recorder.set_extensions("GL_EXT_instanced_arrays");
+
+  printf("%-8s %12s %12s %12s %12s %12s\n", "threads", "shade/ms",
+         "raster/ms", "Mtri/s", "Mpixel/s", "frame/ms");
+
+  try {
+    surfaceCreated();
+    surfaceChanged(width, height);
+
+    for (const auto threads : {size_t(0), job_system::default_thread_count()}) {
+      job_system jobs(threads);
+      tiled_rasterizer rasterizer(&jobs);
+      rasterizer.resize(width, height);
+      recorder.set_rasterizer(&rasterizer);
+
+      double shade = 0.0, raster = 0.0;
+      for (int i = 0; i < frames; ++i) {
+        const auto start = clock_type::now();
+        drawFrame();
+        shade += seconds_since(start);
+
+        const auto flush_start = clock_type::now();
+        rasterizer.flush();
+        raster += seconds_since(flush_start);
+      }
+
+      const auto& stats = rasterizer.stats();
+      const auto total = shade + raster;
+      printf("%-8zu %12.3f %12.3f %12.2f %12.2f %12.3f\n", threads,
+             1e3 * shade / frames, 1e3 * raster / frames,
+             stats.triangles_in / total * 1e-6,
+             stats.pixels_written / total * 1e-6, 1e3 * total / frames);
+
+      recorder.set_rasterizer(nullptr);
+      if (!threads && !job_system::default_thread_count()) break;
+    }
+  } catch (std::runtime_error& e) {
+    fprintf(stderr, "Runtime error: %s\n", e.what());
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
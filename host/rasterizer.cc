@@ -0,0 +1,403 @@
+#include "rasterizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "geometry/simd.h"
+#include "utils/job_system.h"
+
+namespace {
+
+// Triangles queued before draw() renders them, which bounds memory use
+// for large scenes.
+constexpr size_t kMaxQueuedTriangles = 1 << 16;
+
+uint32_t pack_color(float r, float g, float b, float a) {
+  const auto byte = [](float v) {
+    return static_cast<uint32_t>(std::min(std::max(v, 0.0f), 1.0f) * 255.0f +
+                                 0.5f);
+  };
+  return byte(r) | byte(g) << 8 | byte(b) << 16 | byte(a) << 24;
+}
+
+// Returns the vertex where the edge from `a` to `b` crosses a plane, given
+// their signed distances to it.
+clip_vertex intersect(const clip_vertex& a, const clip_vertex& b, float da,
+                      float db) {
+  const auto t = da / (da - db);
+  const auto mix = [t](float x, float y) { return x + (y - x) * t; };
+  return clip_vertex{mix(a.x, b.x), mix(a.y, b.y), mix(a.z, b.z),
+                     mix(a.w, b.w), mix(a.r, b.r), mix(a.g, b.g),
+                     mix(a.b, b.b)};
+}
+
+// Clips a convex polygon against the plane where distance() >= 0.  Returns
+// the new vertex count.
+template <typename Distance>
+size_t clip_polygon(const clip_vertex* in, size_t count, clip_vertex* out,
+                    Distance distance) {
+  size_t result = 0;
+  for (size_t i = 0; i < count; ++i) {
+    const auto& a = in[i];
+    const auto& b = in[(i + 1) % count];
+    const auto da = distance(a);
+    const auto db = distance(b);
+    if (da >= 0.0f) out[result++] = a;
+    if ((da >= 0.0f) != (db >= 0.0f)) out[result++] = intersect(a, b, da, db);
+  }
+  return result;
+}
+
+}  // namespace
+
+void tiled_rasterizer::resize(int width, int height) {
+  width_ = width;
+  height_ = height;
+  tiles_x_ = (width + kTileSize - 1) / kTileSize;
+  tiles_y_ = (height + kTileSize - 1) / kTileSize;
+  stride_ = tiles_x_ * kTileSize;
+
+  const size_t size = static_cast<size_t>(stride_) * tiles_y_ * kTileSize;
+  color_.assign(size, 0);
+  depth_.assign(size, 1.0f);
+
+  triangles_.clear();
+  bins_.assign(tiles_x_ * tiles_y_, std::vector<uint32_t>());
+  tile_pixels_.assign(bins_.size(), 0);
+
+  set_viewport(0, 0, width, height);
+}
+
+void tiled_rasterizer::set_viewport(int x, int y, int width, int height) {
+  viewport_x_ = x;
+  viewport_y_ = y;
+  viewport_width_ = width;
+  viewport_height_ = height;
+}
+
+void tiled_rasterizer::clear(bool color, bool depth, const float rgba[4],
+                             float depth_value) {
+  flush();
+  if (color)
+    std::fill(color_.begin(), color_.end(),
+              pack_color(rgba[0], rgba[1], rgba[2], rgba[3]));
+  if (depth)
+    std::fill(depth_.begin(), depth_.end(),
+              std::min(std::max(depth_value, 0.0f), 1.0f));
+}
+
+void tiled_rasterizer::draw(const clip_vertex* vertices,
+                            const uint32_t* indices, size_t index_count) {
+  for (size_t i = 0; i + 2 < index_count; i += 3) {
+    ++stats_.triangles_in;
+
+    const auto& v0 = vertices[indices[i]];
+    const auto& v1 = vertices[indices[i + 1]];
+    const auto& v2 = vertices[indices[i + 2]];
+
+    // Near and far planes.  The others are handled by the viewport bounds.
+    const auto near = [](const clip_vertex& v) { return v.z + v.w; };
+    const auto far = [](const clip_vertex& v) { return v.w - v.z; };
+
+    if (near(v0) >= 0.0f && near(v1) >= 0.0f && near(v2) >= 0.0f &&
+        far(v0) >= 0.0f && far(v1) >= 0.0f && far(v2) >= 0.0f) {
+      setup(v0, v1, v2);
+    } else {
+      // Each plane adds at most one vertex.
+      clip_vertex polygon[5] = {v0, v1, v2};
+      clip_vertex clipped[5];
+      auto count = clip_polygon(polygon, 3, clipped, near);
+      count = clip_polygon(clipped, count, polygon, far);
+      for (size_t j = 2; j < count; ++j)
+        setup(polygon[0], polygon[j - 1], polygon[j]);
+    }
+
+    if (triangles_.size() >= kMaxQueuedTriangles) flush();
+  }
+}
+
+void tiled_rasterizer::setup(const clip_vertex& v0, const clip_vertex& v1,
+                             const clip_vertex& v2) {
+  const clip_vertex* v[3] = {&v0, &v1, &v2};
+
+  float x[3], y[3], z[3], inv_w[3];
+  for (int i = 0; i < 3; ++i) {
+    if (!(v[i]->w > 0.0f)) return;
+    inv_w[i] = 1.0f / v[i]->w;
+    x[i] = viewport_x_ + (v[i]->x * inv_w[i] + 1.0f) * 0.5f * viewport_width_;
+    y[i] = viewport_y_ + (v[i]->y * inv_w[i] + 1.0f) * 0.5f * viewport_height_;
+    z[i] = v[i]->z * inv_w[i] * 0.5f + 0.5f;
+  }
+
+  auto area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+  if (!(area != 0.0f)) return;
+
+  // Counterclockwise triangles face the viewer.
+  if (area < 0.0f) {
+    if (cull_face_) return;
+    std::swap(v[1], v[2]);
+    std::swap(x[1], x[2]);
+    std::swap(y[1], y[2]);
+    std::swap(z[1], z[2]);
+    std::swap(inv_w[1], inv_w[2]);
+    area = -area;
+  }
+
+  // Pixels whose centers may be inside.
+  const auto min_x = std::max(
+      {static_cast<int>(std::ceil(std::min({x[0], x[1], x[2]}) - 0.5f)),
+       viewport_x_, 0});
+  const auto max_x = std::min(
+      {static_cast<int>(std::floor(std::max({x[0], x[1], x[2]}) - 0.5f)),
+       viewport_x_ + viewport_width_ - 1, width_ - 1});
+  const auto min_y = std::max(
+      {static_cast<int>(std::ceil(std::min({y[0], y[1], y[2]}) - 0.5f)),
+       viewport_y_, 0});
+  const auto max_y = std::min(
+      {static_cast<int>(std::floor(std::max({y[0], y[1], y[2]}) - 0.5f)),
+       viewport_y_ + viewport_height_ - 1, height_ - 1});
+  if (min_x > max_x || min_y > max_y) return;
+
+  triangle t;
+  t.min_x = min_x;
+  t.min_y = min_y;
+  t.max_x = max_x;
+  t.max_y = max_y;
+
+  const auto inv_area = 1.0f / area;
+  for (int i = 0; i < 3; ++i) {
+    // The edge opposite vertex i.
+    const auto a = (i + 1) % 3, b = (i + 2) % 3;
+    const auto dx = x[b] - x[a];
+    const auto dy = y[b] - y[a];
+    t.edge_a[i] = -dy;
+    t.edge_b[i] = dx;
+    t.edge_c[i] = static_cast<float>(static_cast<double>(dy) * x[a] -
+                                     static_cast<double>(dx) * y[a]);
+    t.top_left[i] = dy < 0.0f || (dy == 0.0f && dx < 0.0f);
+
+    const auto k = inv_w[i] * inv_area;
+    t.z[i] = z[i] * inv_area;
+    t.inv_w[i] = k;
+    t.r[i] = v[i]->r * k;
+    t.g[i] = v[i]->g * k;
+    t.b[i] = v[i]->b * k;
+  }
+
+  const auto index = static_cast<uint32_t>(triangles_.size());
+  triangles_.push_back(t);
+  ++stats_.triangles_binned;
+
+  for (int ty = min_y / kTileSize; ty <= max_y / kTileSize; ++ty)
+    for (int tx = min_x / kTileSize; tx <= max_x / kTileSize; ++tx)
+      bins_[ty * tiles_x_ + tx].push_back(index);
+}
+
+void tiled_rasterizer::flush() {
+  if (triangles_.empty()) return;
+
+  if (jobs_) {
+    jobs_->parallel_for(bins_.size(), 1, [this](size_t begin, size_t end) {
+      for (size_t tile = begin; tile < end; ++tile) render_tile(tile);
+    });
+  } else {
+    for (size_t tile = 0; tile < bins_.size(); ++tile) render_tile(tile);
+  }
+
+  for (auto& bin : bins_) bin.clear();
+  triangles_.clear();
+  for (auto& pixels : tile_pixels_) {
+    stats_.pixels_written += pixels;
+    pixels = 0;
+  }
+}
+
+void tiled_rasterizer::render_tile(size_t tile) {
+  const auto& bin = bins_[tile];
+  if (bin.empty()) return;
+
+  const int tile_x = (tile % tiles_x_) * kTileSize;
+  const int tile_y = (tile / tiles_x_) * kTileSize;
+  size_t pixels = 0;
+
+  for (const auto index : bin) {
+    const auto& t = triangles_[index];
+    const auto x0 = std::max(t.min_x, tile_x);
+    const auto x1 = std::min(t.max_x, tile_x + kTileSize - 1);
+    const auto y0 = std::max(t.min_y, tile_y);
+    const auto y1 = std::min(t.max_y, tile_y + kTileSize - 1);
+
+#if GEOMETRY_SIMD
+    const simd::f32x4 lane_offsets = simd::set(0.5f, 1.5f, 2.5f, 3.5f);
+    simd::f32x4 edge_a[3], z[3], inv_w[3], r[3], g[3], b[3];
+    for (int i = 0; i < 3; ++i) {
+      edge_a[i] = simd::splat(t.edge_a[i]);
+      z[i] = simd::splat(t.z[i]);
+      inv_w[i] = simd::splat(t.inv_w[i]);
+      r[i] = simd::splat(t.r[i]);
+      g[i] = simd::splat(t.g[i]);
+      b[i] = simd::splat(t.b[i]);
+    }
+    const auto zero = simd::splat(0.0f);
+    const auto one = simd::splat(1.0f);
+
+    // Quads of four pixels start at multiples of 4, which the tile size is.
+    const auto quad_x0 = x0 & ~3;
+
+    for (int y = y0; y <= y1; ++y) {
+      const auto py = y + 0.5f;
+      simd::f32x4 row[3];
+      for (int i = 0; i < 3; ++i)
+        row[i] = simd::splat(t.edge_b[i] * py + t.edge_c[i]);
+
+      auto color = &color_[y * stride_];
+      auto depth = &depth_[y * stride_];
+
+      for (int x = quad_x0; x <= x1; x += 4) {
+        const auto px = simd::add(simd::splat(static_cast<float>(x)),
+                                  lane_offsets);
+
+        // Lanes within the bounding box.
+        unsigned mask = 0xf;
+        if (x < x0) mask &= 0xf << (x0 - x);
+        if (x + 3 > x1) mask &= 0xf >> (x + 3 - x1);
+
+        simd::f32x4 e[3];
+        for (int i = 0; i < 3; ++i) {
+          e[i] = simd::add(simd::mul(edge_a[i], px), row[i]);
+          // e >= 0 on top and left edges, e > 0 elsewhere.
+          mask &= t.top_left[i]
+                      ? simd::nonnegative_mask(e[i])
+                      : ~simd::nonnegative_mask(simd::sub(zero, e[i])) & 0xf;
+        }
+        if (!mask) continue;
+
+        auto fragment_z = simd::mul(e[0], z[0]);
+        fragment_z = simd::add(fragment_z, simd::mul(e[1], z[1]));
+        fragment_z = simd::add(fragment_z, simd::mul(e[2], z[2]));
+
+        if (depth_test_) {
+          // GL_LESS.
+          mask &= ~simd::nonnegative_mask(
+                      simd::sub(fragment_z, simd::load(depth + x))) &
+                  0xf;
+          if (!mask) continue;
+        }
+
+        auto w = simd::mul(e[0], inv_w[0]);
+        w = simd::add(w, simd::mul(e[1], inv_w[1]));
+        w = simd::add(w, simd::mul(e[2], inv_w[2]));
+        w = simd::div(one, w);
+
+        const auto interpolate = [&e, &w](const simd::f32x4* k) {
+          auto result = simd::mul(e[0], k[0]);
+          result = simd::add(result, simd::mul(e[1], k[1]));
+          result = simd::add(result, simd::mul(e[2], k[2]));
+          return simd::mul(result, w);
+        };
+
+        float lanes_z[4], lanes_r[4], lanes_g[4], lanes_b[4];
+        simd::store(lanes_z, fragment_z);
+        simd::store(lanes_r, interpolate(r));
+        simd::store(lanes_g, interpolate(g));
+        simd::store(lanes_b, interpolate(b));
+
+        for (int lane = 0; lane < 4; ++lane) {
+          if (!(mask & (1 << lane))) continue;
+          color[x + lane] =
+              pack_color(lanes_r[lane], lanes_g[lane], lanes_b[lane], 1.0f);
+          if (depth_test_) depth[x + lane] = lanes_z[lane];
+          ++pixels;
+        }
+      }
+    }
+#else
+    for (int y = y0; y <= y1; ++y) {
+      const auto py = y + 0.5f;
+      for (int x = x0; x <= x1; ++x) {
+        const auto px = x + 0.5f;
+        float e[3];
+        bool inside = true;
+        for (int i = 0; i < 3; ++i) {
+          e[i] = t.edge_a[i] * px + (t.edge_b[i] * py + t.edge_c[i]);
+          inside = inside && (t.top_left[i] ? e[i] >= 0.0f : e[i] > 0.0f);
+        }
+        if (!inside) continue;
+
+        const auto fragment_z = e[0] * t.z[0] + e[1] * t.z[1] + e[2] * t.z[2];
+        auto& depth = depth_[y * stride_ + x];
+        if (depth_test_) {
+          if (!(fragment_z < depth)) continue;
+          depth = fragment_z;
+        }
+
+        const auto w =
+            1.0f / (e[0] * t.inv_w[0] + e[1] * t.inv_w[1] + e[2] * t.inv_w[2]);
+        color_[y * stride_ + x] =
+            pack_color((e[0] * t.r[0] + e[1] * t.r[1] + e[2] * t.r[2]) * w,
+                       (e[0] * t.g[0] + e[1] * t.g[1] + e[2] * t.g[2]) * w,
+                       (e[0] * t.b[0] + e[1] * t.b[1] + e[2] * t.b[2]) * w,
+                       1.0f);
+        ++pixels;
+      }
+    }
+#endif
+  }
+
+  tile_pixels_[tile] += pixels;
+}
+
+std::vector<uint32_t> tiled_rasterizer::read_pixels() const {
+  std::vector<uint32_t> result(static_cast<size_t>(width_) * height_);
+  for (int y = 0; y < height_; ++y)
+    std::copy(&color_[y * stride_], &color_[y * stride_] + width_,
+              &result[y * width_]);
+  return result;
+}
+
+bool write_ppm(const std::string& path, const uint32_t* pixels, int width,
+               int height) {
+  auto file = fopen(path.c_str(), "wb");
+  if (!file) return false;
+
+  fprintf(file, "P6\n%d %d\n255\n", width, height);
+  std::vector<uint8_t> row(3 * width);
+  for (int y = height; y-- > 0;) {
+    for (int x = 0; x < width; ++x) {
+      const auto p = pixels[y * width + x];
+      row[3 * x] = p;
+      row[3 * x + 1] = p >> 8;
+      row[3 * x + 2] = p >> 16;
+    }
+    fwrite(row.data(), 1, row.size(), file);
+  }
+
+  return fclose(file) == 0;
+}
+
+bool read_ppm(const std::string& path, std::vector<uint32_t>* pixels,
+              int* width, int* height) {
+  auto file = fopen(path.c_str(), "rb");
+  if (!file) return false;
+
+  int max_value;
+  if (fscanf(file, "P6 %d %d %d", width, height, &max_value) != 3 ||
+      max_value != 255 || fgetc(file) == EOF || *width <= 0 || *height <= 0) {
+    fclose(file);
+    return false;
+  }
+
+  pixels->resize(static_cast<size_t>(*width) * *height);
+  std::vector<uint8_t> row(3 * *width);
+  bool ok = true;
+  for (int y = *height; ok && y-- > 0;) {
+    ok = fread(row.data(), 1, row.size(), file) == row.size();
+    for (int x = 0; ok && x < *width; ++x)
+      (*pixels)[y * *width + x] = row[3 * x] | row[3 * x + 1] << 8 |
+                                  row[3 * x + 2] << 16 | 0xff000000u;
+  }
+
+  fclose(file);
+  return ok;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class job_system;
+
+// A vertex after the vertex shader: clip space position and color.
+struct clip_vertex {
+  float x, y, z, w;
+  float r, g, b;
+};
+
+struct raster_stats {
+  // Triangles passed to draw(), and those left after clipping and culling.
+  size_t triangles_in = 0;
+  size_t triangles_binned = 0;
+  // Fragments that passed the depth test.
+  size_t pixels_written = 0;
+};
+
+// Renders triangles into an RGBA8 color buffer and a float depth buffer,
+// following GLES2 semantics for what the renderer uses: clipping against the
+// near and far planes, back face culling with counterclockwise front faces,
+// the top-left fill rule, GL_LESS depth testing, and perspective correct
+// color interpolation.
+//
+// draw() clips and sets up triangles, and sorts them into bins of
+// kTileSize x kTileSize pixels.  flush() renders the tiles in parallel, each
+// one visiting its triangles in submission order, so the result does not
+// depend on the number of threads.  Edge functions, depth and colors are
+// evaluated for four pixels at a time with geometry/simd.h.
+class tiled_rasterizer {
+ public:
+  static constexpr int kTileSize = 32;
+
+  // Renders tiles on `jobs`, or on the calling thread if it is null.
+  explicit tiled_rasterizer(job_system* jobs = nullptr) : jobs_(jobs) {}
+
+  // Reallocates the buffers, and sets the viewport to cover them.
+  void resize(int width, int height);
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+  void set_viewport(int x, int y, int width, int height);
+  void set_cull_face(bool enable) { cull_face_ = enable; }
+  void set_depth_test(bool enable) { depth_test_ = enable; }
+
+  // Clears the color and/or depth buffer, after rendering pending triangles.
+  void clear(bool color, bool depth, const float rgba[4], float depth_value);
+
+  // Queues `index_count / 3` triangles.
+  void draw(const clip_vertex* vertices, const uint32_t* indices,
+            size_t index_count);
+
+  // Renders all queued triangles.
+  void flush();
+
+  // Returns the color buffer as RGBA pixels, bottom row first, like
+  // glReadPixels().  Call flush() first.
+  std::vector<uint32_t> read_pixels() const;
+
+  const raster_stats& stats() const { return stats_; }
+  void reset_stats() { stats_ = raster_stats(); }
+
+ private:
+  // A triangle ready for rasterization.  Edge functions are e(x, y) = a * x +
+  // b * y + c at pixel centers, positive inside.  Depth, 1/w and colors over
+  // w are interpolated as sum(e_i * k_i), with the 1/area folded into k_i.
+  struct triangle {
+    float edge_a[3], edge_b[3], edge_c[3];
+    // Edges that own pixels exactly on them.
+    bool top_left[3];
+    float z[3];
+    float inv_w[3];
+    float r[3], g[3], b[3];
+    int min_x, min_y, max_x, max_y;
+  };
+
+  void setup(const clip_vertex& v0, const clip_vertex& v1,
+             const clip_vertex& v2);
+  void render_tile(size_t tile);
+
+  job_system* jobs_;
+
+  int width_ = 0, height_ = 0;
+  // Row length of the buffers, and their size in tiles.
+  int stride_ = 0;
+  int tiles_x_ = 0, tiles_y_ = 0;
+  std::vector<uint32_t> color_;
+  std::vector<float> depth_;
+
+  int viewport_x_ = 0, viewport_y_ = 0;
+  int viewport_width_ = 0, viewport_height_ = 0;
+  bool cull_face_ = false;
+  bool depth_test_ = false;
+
+  std::vector<triangle> triangles_;
+  // Indices into triangles_ of the triangles touching each tile.
+  std::vector<std::vector<uint32_t>> bins_;
+  // Pixels written per tile, summed after every flush().
+  std::vector<size_t> tile_pixels_;
+
+  raster_stats stats_;
+};
+
+// Writes RGBA pixels, bottom row first, as a binary PPM file.  Returns false
+// on error.
+bool write_ppm(const std::string& path, const uint32_t* pixels, int width,
+               int height);
+
+// Reads a binary PPM file into RGBA pixels, bottom row first.  Returns false
+// on error.
+bool read_ppm(const std::string& path, std::vector<uint32_t>* pixels,
+              int* width, int* height);
@@ -0,0 +1,308 @@
+// Checks the mat4x4 SIMD kernels in geometry/simd.h against the scalar
+// reference implementations in geometry/vector.h, on random, badly scaled
+// and nearly singular matrices.  Exits with an error on the first result
+// outside the tolerances below, and prints the largest errors seen.
+//
+// Usage: simd-check [--rounds N]
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+
+#include "geometry/vector.h"
+
+#if GEOMETRY_SIMD
+
+namespace {
+
+// An element of a product or transform is a dot product of 4 terms.  Each
+// path rounds it with an error of at most 4 ulps of the sum of the absolute
+// terms, in whatever order and with or without fused multiply-adds, so the
+// two differ by at most twice that.
+constexpr float kDotTolerance = 8 * FLT_EPSILON;
+
+// Inverse elements may differ by this much, relative to the largest element
+// of the inverse, per unit of condition number.  Both inverses have rounding
+// errors proportional to the condition number; the SIMD one is computed from
+// 2x2 adjugates and cancels more.
+constexpr float kInvertTolerance = 64 * FLT_EPSILON;
+
+// Largest condition number for which the inverses are compared.
+constexpr float kMaxCondition = 1e5f;
+
+float max_error[3];
+
+#define CHECK(cond, ...)                              \
+  do {                                                \
+    if (!(cond)) {                                    \
+      fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+      fprintf(stderr, __VA_ARGS__);                   \
+      fprintf(stderr, "\n");                          \
+      exit(EXIT_FAILURE);                             \
+    }                                                 \
+  } while (0)
+
+std::string to_string(const mat4x4& m) {
+  std::string result;
+  char buffer[64];
+  for (size_t i = 0; i < 4; ++i) {
+    for (size_t j = 0; j < 4; ++j) {
+      snprintf(buffer, sizeof(buffer), "%s%.9g", (i || j) ? " " : "",
+               m.m[j][i]);
+      result += buffer;
+    }
+    if (i < 3) result += ";";
+  }
+  return result;
+}
+
+// Infinity norm: the largest absolute row sum.
+float norm(const mat4x4& m) {
+  float result = 0.0f;
+  for (size_t i = 0; i < 4; ++i) {
+    float sum = 0.0f;
+    for (size_t j = 0; j < 4; ++j) sum += std::fabs(m.m[j][i]);
+    result = std::max(result, sum);
+  }
+  return result;
+}
+
+float max_element(const mat4x4& m) {
+  float result = 0.0f;
+  for (size_t i = 0; i < 4; ++i)
+    for (size_t j = 0; j < 4; ++j)
+      result = std::max(result, std::fabs(m.m[i][j]));
+  return result;
+}
+
+bool is_zero(const mat4x4& m) { return m == mat4x4::zero(); }
+
+mat4x4 scaled(mat4x4 m, float scale) {
+  for (size_t i = 0; i < 4; ++i) m.m[i] *= scale;
+  return m;
+}
+
+void check_multiply(const mat4x4& a, const mat4x4& b) {
+  mat4x4 result;
+  simd::mat4_multiply(&a.m[0][0], &b.m[0][0], &result.m[0][0]);
+  const auto expected = a.multiply_scalar(b);
+
+  for (size_t i = 0; i < 4; ++i) {
+    for (size_t j = 0; j < 4; ++j) {
+      float sum = 0.0f;
+      for (size_t k = 0; k < 4; ++k)
+        sum += std::fabs(a.m[k][i] * b.m[j][k]);
+      const auto error = std::fabs(result.m[j][i] - expected.m[j][i]);
+      CHECK(error <= kDotTolerance * sum,
+            "mat4_multiply() differs by %g at (%zu, %zu) for\n  %s\n  %s",
+            error, i, j, to_string(a).c_str(), to_string(b).c_str());
+      if (sum > 0.0f) max_error[0] = std::max(max_error[0], error / sum);
+    }
+  }
+
+  // The output may alias either input.
+  auto aliased = a;
+  simd::mat4_multiply(&aliased.m[0][0], &b.m[0][0], &aliased.m[0][0]);
+  CHECK(aliased == result, "mat4_multiply() differs when out == a");
+  aliased = b;
+  simd::mat4_multiply(&a.m[0][0], &aliased.m[0][0], &aliased.m[0][0]);
+  CHECK(aliased == result, "mat4_multiply() differs when out == b");
+}
+
+void check_transform(const mat4x4& m, const vec4& v) {
+  vec4 result;
+  simd::mat4_transform(&m.m[0][0], &v[0], &result[0]);
+  const auto expected = m.transform_scalar(v);
+
+  for (size_t i = 0; i < 4; ++i) {
+    float sum = 0.0f;
+    for (size_t k = 0; k < 4; ++k) sum += std::fabs(m.m[k][i] * v[k]);
+    const auto error = std::fabs(result[i] - expected[i]);
+    CHECK(error <= kDotTolerance * sum,
+          "mat4_transform() differs by %g in element %zu for\n  %s",
+          error, i, to_string(m).c_str());
+    if (sum > 0.0f) max_error[1] = std::max(max_error[1], error / sum);
+  }
+}
+
+// Compares the inverses of a matrix, if invert_scalar() accepts it and it is
+// well enough conditioned.
+void check_invert(const mat4x4& m) {
+  const auto expected = m.invert_scalar();
+  mat4x4 result;
+  const bool inverted = simd::mat4_invert(&m.m[0][0], &result.m[0][0]);
+
+  const auto condition = norm(m) * norm(expected);
+  if (is_zero(expected) || !(condition <= kMaxCondition)) {
+    // See mat4x4::invert() for when the two disagree on singularity.
+    if (inverted) {
+      for (size_t i = 0; i < 4; ++i)
+        for (size_t j = 0; j < 4; ++j)
+          CHECK(!std::isnan(result.m[i][j]),
+                "mat4_invert() returned NaN for\n  %s", to_string(m).c_str());
+    }
+    return;
+  }
+
+  CHECK(inverted, "mat4_invert() found an invertible matrix singular:\n  %s",
+        to_string(m).c_str());
+
+  const auto scale = max_element(expected);
+  for (size_t i = 0; i < 4; ++i) {
+    for (size_t j = 0; j < 4; ++j) {
+      const auto error = std::fabs(result.m[i][j] - expected.m[i][j]) / scale;
+      CHECK(error <= kInvertTolerance * condition,
+            "mat4_invert() differs by %g relative to the largest element at "
+            "(%zu, %zu), with condition number %g, for\n  %s",
+            error, j, i, condition, to_string(m).c_str());
+      max_error[2] = std::max(max_error[2], error / condition);
+    }
+  }
+}
+
+void check_singular(const mat4x4& m) {
+  mat4x4 result = mat4x4::identity();
+  CHECK(!simd::mat4_invert(&m.m[0][0], &result.m[0][0]),
+        "mat4_invert() inverted a singular matrix:\n  %s",
+        to_string(m).c_str());
+  CHECK(result == mat4x4::identity(),
+        "mat4_invert() wrote to its output for a singular matrix");
+}
+
+mat4x4 random_matrix(std::mt19937& rng, float scale = 1.0f) {
+  std::uniform_real_distribution<float> element(-scale, scale);
+  mat4x4 result;
+  for (size_t i = 0; i < 4; ++i)
+    for (size_t j = 0; j < 4; ++j) result.m[i][j] = element(rng);
+  return result;
+}
+
+// A rotation, scale and translation, like the model matrices in a scene.
+mat4x4 random_transform(std::mt19937& rng) {
+  std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+  std::uniform_real_distribution<float> scale(0.01f, 100.0f);
+  const auto axis = vec3(unit(rng), unit(rng), unit(rng));
+  const auto length = axis.magnitude();
+  if (length == 0.0f) return mat4x4::identity();
+  const auto rotation = vec4::rotation(axis.x / length, axis.y / length,
+                                       axis.z / length, 3.0f * unit(rng));
+  auto result = mat4x4::from_quat(rotation);
+  const auto s = scale(rng);
+  for (size_t i = 0; i < 3; ++i) result.m[i] *= s;
+  result.m[3] = vec4(100.0f * unit(rng), 100.0f * unit(rng),
+                     100.0f * unit(rng), 1.0f);
+  return result;
+}
+
+// A singular matrix whose columns are small integers, so that mat4_invert()
+// computes a determinant of exactly zero.  invert_scalar() divides, and may
+// see a pivot just above its threshold instead.  Column `k` is a combination of
+// the others, or zero.
+mat4x4 integer_singular_matrix(std::mt19937& rng, size_t k) {
+  std::uniform_int_distribution<int> element(-8, 8);
+  mat4x4 result;
+  for (size_t i = 0; i < 4; ++i)
+    for (size_t j = 0; j < 4; ++j) result.m[i][j] = element(rng);
+
+  result.m[k] = vec4(0, 0, 0, 0);
+  for (size_t i = 0; i < 4; ++i) {
+    if (i == k) continue;
+    const auto factor = float(element(rng) / 4);
+    result.m[k] += result.m[i] * factor;
+  }
+  return result;
+}
+
+// A random matrix with one column moved within `distance` of the span of
+// the others.
+mat4x4 nearly_singular_matrix(std::mt19937& rng, float distance) {
+  auto result = random_matrix(rng);
+  std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+  result.m[3] = result.m[0] * unit(rng) + result.m[1] * unit(rng);
+  result.m[3] += result.m[2] * unit(rng);
+  result.m[3] += vec4(unit(rng), unit(rng), unit(rng), unit(rng)) * distance;
+  return result;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t rounds = 100000;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--rounds") && i + 1 < argc) {
+      rounds = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "Usage: %s [--rounds N]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::mt19937 rng(4);
+  std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+  for (size_t round = 0; round < rounds; ++round) {
+    const auto a = random_matrix(rng);
+    const auto b = random_transform(rng);
+    const auto c = random_matrix(rng, 1e4f);
+
+    check_multiply(a, b);
+    check_multiply(b, c);
+    check_multiply(c, a);
+
+    const auto v = vec4(unit(rng), unit(rng), unit(rng), 1.0f) * 100.0f;
+    check_transform(a, v);
+    check_transform(b, v);
+    check_transform(c, v);
+
+    check_invert(a);
+    check_invert(b);
+    check_invert(c);
+    check_invert(b * mat4x4::projection(0.1f, 0.8f, 1.5f));
+
+    for (const auto distance : {1e-2f, 1e-4f, 1e-6f})
+      check_invert(nearly_singular_matrix(rng, distance));
+
+    check_singular(integer_singular_matrix(rng, round % 4));
+  }
+
+  // Uniformly small matrices are invertible, but invert_scalar() treats
+  // pivots below 1e-6 as zero.
+  for (const auto scale : {1e-3f, 1e-6f, 1e-8f}) {
+    mat4x4 result;
+    const auto m = mat4x4::translation(1, 2, 3);
+    const auto small = scaled(m, scale);
+    CHECK(simd::mat4_invert(&small.m[0][0], &result.m[0][0]),
+          "mat4_invert() found a matrix scaled by %g singular", scale);
+    const auto expected = m.invert_scalar();
+    for (size_t i = 0; i < 4; ++i)
+      for (size_t j = 0; j < 4; ++j)
+        CHECK(std::fabs(result.m[i][j] * scale - expected.m[i][j]) <=
+                  kInvertTolerance,
+              "mat4_invert() is inaccurate for a matrix scaled by %g", scale);
+  }
+
+  // A determinant below FLT_MIN has no finite reciprocal.
+  check_singular(scaled(mat4x4::identity(), 1e-10f));
+  check_singular(mat4x4::zero());
+
+  printf("%zu rounds passed; largest errors: multiply %.2f ulps, "
+         "transform %.2f ulps, invert %.2f ulps per unit of condition\n",
+         rounds, max_error[0] / FLT_EPSILON, max_error[1] / FLT_EPSILON,
+         max_error[2] / FLT_EPSILON);
+  return EXIT_SUCCESS;
+}
+
+#else
+
+int main() {
+  printf("Built without SIMD kernels; nothing to check\n");
+  return EXIT_SUCCESS;
+}
+
+#endif
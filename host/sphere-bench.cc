@@ -0,0 +1,100 @@
+// Checks that analytic_sphere() produces the same triangles as sphere(), and
+// compares their speed, on one thread and on the job system.
+//
+// Usage: sphere-bench [MAX_QUALITY]
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "geometry/sphere.h"
+#include "geometry/sphere_parallel.h"
+#include "utils/job_system.h"
+
+namespace {
+
+// A triangle as the bit patterns of its corners, rotated to start with the
+// smallest corner, so that equal triangles compare equal regardless of
+// vertex numbering.
+typedef std::array<std::array<uint32_t, 3>, 3> triangle_key;
+
+std::vector<triangle_key> triangle_keys(const std::vector<vec3>& vertices,
+                                        const std::vector<uint32_t>& indices) {
+  std::vector<triangle_key> result;
+  result.reserve(indices.size() / 3);
+  for (size_t i = 0; i < indices.size(); i += 3) {
+    triangle_key key;
+    for (size_t k = 0; k < 3; ++k)
+      memcpy(key[k].data(), &vertices[indices[i + k]], sizeof(key[k]));
+    std::rotate(key.begin(), std::min_element(key.begin(), key.end()),
+                key.end());
+    result.push_back(key);
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+template <typename Function>
+double milliseconds(Function function) {
+  const auto start = std::chrono::steady_clock::now();
+  function();
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const size_t max_quality = (argc > 1) ? atoi(argv[1]) : 9;
+  job_system jobs;
+
+  printf("%-8s %10s %14s %14s %14s\n", "quality", "triangles", "sphere/ms",
+         "analytic/ms", "jobs/ms");
+
+  for (size_t quality = 0; quality <= max_quality; ++quality) {
+    std::vector<vec3> expected_vertices;
+    std::vector<uint32_t> expected_indices;
+    const auto reference = milliseconds([&] {
+      sphere(quality, &expected_vertices, &expected_indices);
+    });
+
+    std::vector<vec3> vertices(sphere_vertex_count(quality));
+    std::vector<uint32_t> indices(sphere_index_count(quality));
+    const auto serial = milliseconds(
+        [&] { analytic_sphere(quality, vertices.data(), indices.data()); });
+
+    if (vertices.size() != expected_vertices.size() ||
+        indices.size() != expected_indices.size() ||
+        triangle_keys(vertices, indices) !=
+            triangle_keys(expected_vertices, expected_indices)) {
+      fprintf(stderr,
+              "analytic_sphere() differs from sphere() at quality %zu\n",
+              quality);
+      return EXIT_FAILURE;
+    }
+
+    std::vector<vec3> parallel_vertices(vertices.size());
+    std::vector<uint32_t> parallel_indices(indices.size());
+    const auto parallel = milliseconds([&] {
+      analytic_sphere(quality, parallel_vertices.data(),
+                      parallel_indices.data(), &jobs);
+    });
+
+    if (memcmp(parallel_vertices.data(), vertices.data(),
+               vertices.size() * sizeof(vec3)) ||
+        parallel_indices != indices) {
+      fprintf(stderr, "Parallel output differs at quality %zu\n", quality);
+      return EXIT_FAILURE;
+    }
+
+    printf("%-8zu %10zu %14.3f %14.3f %14.3f\n", quality, indices.size() / 3,
+           reference, serial, parallel);
+  }
+
+  return EXIT_SUCCESS;
+}
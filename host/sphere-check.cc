@@ -0,0 +1,189 @@
+// Checks that sphere() produces exactly the vertices and indices of the
+// original generator, which found midpoints by scanning every vertex with an
+// exact compare.  That generator is kept here as the reference.  Also checks
+// that constexpr_sphere() matches sphere(), and that constexpr_sqrt() rounds
+// like std::sqrt.  Exits with an error on the first difference.
+//
+// Usage: sphere-check [MAX_QUALITY]
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "geometry/sphere.h"
+
+namespace {
+
+// The original sphere(), quadratic in the number of vertices.
+template <typename IndexType>
+void reference_sphere(const size_t quality, std::vector<vec3>* vertices,
+                      std::vector<IndexType>* indices) {
+  *vertices = {{0, 0, 1}, {0, 1, 0}, {-1, 0, 0},
+               {0, -1, 0}, {1, 0, 0}, {0, 0, -1}};
+  *indices = {0, 1, 2, 0, 2, 3, 0, 3, 4, 0, 4, 1,
+              1, 5, 2, 2, 5, 3, 3, 5, 4, 4, 5, 1};
+
+  for (size_t q = 0; q < quality; ++q) {
+    std::vector<IndexType> new_indices;
+
+    while (!indices->empty()) {
+      size_t points[3];
+
+      points[2] = indices->back();
+      indices->pop_back();
+      points[1] = indices->back();
+      indices->pop_back();
+      points[0] = indices->back();
+      indices->pop_back();
+
+      vec3 midpoints[3];
+
+      midpoints[0] =
+          (((*vertices)[points[0]] + (*vertices)[points[1]]) / 2).normalize();
+      midpoints[1] =
+          (((*vertices)[points[0]] + (*vertices)[points[2]]) / 2).normalize();
+      midpoints[2] =
+          (((*vertices)[points[1]] + (*vertices)[points[2]]) / 2).normalize();
+
+      size_t midpoint_indices[3];
+
+      for (size_t i = 0; i < 3; i++) {
+        size_t j;
+
+        for (j = 0; j < vertices->size(); j++) {
+          if ((*vertices)[j] == midpoints[i]) {
+            midpoint_indices[i] = j;
+            break;
+          }
+        }
+
+        if (j == vertices->size()) {
+          midpoint_indices[i] = vertices->size();
+          vertices->emplace_back(midpoints[i]);
+        }
+      }
+
+      new_indices.emplace_back(points[0]);
+      new_indices.emplace_back(midpoint_indices[0]);
+      new_indices.emplace_back(midpoint_indices[1]);
+
+      new_indices.emplace_back(midpoint_indices[0]);
+      new_indices.emplace_back(midpoint_indices[2]);
+      new_indices.emplace_back(midpoint_indices[1]);
+
+      new_indices.emplace_back(midpoint_indices[0]);
+      new_indices.emplace_back(points[1]);
+      new_indices.emplace_back(midpoint_indices[2]);
+
+      new_indices.emplace_back(midpoint_indices[1]);
+      new_indices.emplace_back(midpoint_indices[2]);
+      new_indices.emplace_back(points[2]);
+    }
+
+    *indices = std::move(new_indices);
+  }
+}
+
+template <size_t Quality>
+bool check_constexpr_quality() {
+  static constexpr auto kTables = constexpr_sphere<uint16_t, Quality>();
+
+  std::vector<vec3> vertices;
+  std::vector<uint16_t> indices;
+  sphere(Quality, &vertices, &indices);
+
+  if (memcmp(vertices.data(), kTables.vertices.data(),
+             vertices.size() * sizeof(vec3)) ||
+      !std::equal(indices.begin(), indices.end(), kTables.indices.begin())) {
+    fprintf(stderr, "constexpr_sphere() differs at quality %zu\n", Quality);
+    return false;
+  }
+  return true;
+}
+
+template <typename IndexType>
+bool check_quality(size_t quality, const char* index_type) {
+  std::vector<vec3> expected_vertices;
+  std::vector<IndexType> expected_indices;
+  reference_sphere(quality, &expected_vertices, &expected_indices);
+
+  std::vector<vec3> vertices;
+  std::vector<IndexType> indices;
+  sphere(quality, &vertices, &indices);
+
+  if (vertices.size() != expected_vertices.size() ||
+      memcmp(vertices.data(), expected_vertices.data(),
+             vertices.size() * sizeof(vec3))) {
+    fprintf(stderr, "Vertices differ at quality %zu with %s indices\n",
+            quality, index_type);
+    return false;
+  }
+  if (indices != expected_indices) {
+    fprintf(stderr, "Indices differ at quality %zu with %s indices\n",
+            quality, index_type);
+    return false;
+  }
+  if (vertices.size() != sphere_vertex_count(quality) ||
+      indices.size() != sphere_index_count(quality)) {
+    fprintf(stderr, "Wrong closed-form counts at quality %zu\n", quality);
+    return false;
+  }
+  return true;
+}
+
+// Compares constexpr_sphere() with sphere() at each quality in `Qualities`.
+template <size_t... Qualities>
+bool check_constexpr(std::index_sequence<Qualities...>) {
+  const bool results[] = {check_constexpr_quality<Qualities>()...};
+  return std::all_of(std::begin(results), std::end(results),
+                     [](bool result) { return result; });
+}
+
+// Compares constexpr_sqrt() with std::sqrt for every float from 1/16 to 16,
+// which covers the squared lengths normalized by the sphere generators.
+bool check_sqrt() {
+  const float range[] = {1.0f / 16, 16.0f};
+  uint32_t begin, end;
+  memcpy(&begin, &range[0], sizeof(begin));
+  memcpy(&end, &range[1], sizeof(end));
+
+  for (auto bits = begin; bits < end; ++bits) {
+    float v;
+    memcpy(&v, &bits, sizeof(v));
+    if (constexpr_sqrt(v) != std::sqrt(v)) {
+      fprintf(stderr, "constexpr_sqrt(%.9g) is %.9g, not %.9g\n", v,
+              constexpr_sqrt(v), std::sqrt(v));
+      return false;
+    }
+  }
+  return true;
+}
+
+static_assert(vec3(2, 3, 6).constexpr_magnitude() == 7.0f,
+              "constexpr_magnitude() is wrong");
+static_assert(vec4(0, 0, 0, 2).constexpr_normalize().w == 1.0f,
+              "constexpr_normalize() is wrong");
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const size_t max_quality = (argc > 1) ? atoi(argv[1]) : 4;
+
+  for (size_t quality = 0; quality <= max_quality; ++quality) {
+    if (!check_quality<uint32_t>(quality, "32-bit")) return EXIT_FAILURE;
+    if (quality <= 6 && !check_quality<uint16_t>(quality, "16-bit"))
+      return EXIT_FAILURE;
+  }
+
+  if (!check_constexpr(std::make_index_sequence<4>()) || !check_sqrt())
+    return EXIT_FAILURE;
+
+  printf("sphere() matches the reference for qualities 0-%zu\n",
+         max_quality);
+  return EXIT_SUCCESS;
+}
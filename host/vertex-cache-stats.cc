@@ -0,0 +1,48 @@
+// Prints post-transform vertex cache statistics for each sphere quality,
+// before and after optimization.
+//
+// Usage: vertex-cache-stats [MAX_QUALITY]
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "geometry/sphere.h"
+#include "geometry/vertex_cache.h"
+
+namespace {
+
+const size_t kCacheSizes[] = {16, 32};
+
+void print_stats(const char* label, const std::vector<uint32_t>& indices,
+                 size_t vertex_count) {
+  printf("  %-9s", label);
+  for (const auto cache_size : kCacheSizes) {
+    printf("  fifo%-2zu acmr=%.3f atvr=%.3f", cache_size,
+           acmr(indices.data(), indices.size(), vertex_count, cache_size),
+           atvr(indices.data(), indices.size(), vertex_count, cache_size));
+  }
+  printf("\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const size_t max_quality = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 7;
+
+  for (size_t quality = 0; quality <= max_quality; ++quality) {
+    std::vector<vec3> vertices;
+    std::vector<uint32_t> indices;
+    sphere(quality, &vertices, &indices);
+
+    printf("quality %zu: %zu vertices, %zu triangles\n", quality,
+           vertices.size(), indices.size() / 3);
+    print_stats("before", indices, vertices.size());
+
+    optimize_vertex_cache(indices.data(), indices.size(), vertices.size());
+    optimize_vertex_fetch(&vertices, indices.data(), indices.size());
+    print_stats("after", indices, vertices.size());
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,382 @@
+// Checks the vertex encodings of gl/vertex_format.h.  float_to_half() must
+// round every float to the nearest half, ties to even, including subnormals
+// and overflow to infinity.  Every combination of position and color encoding
+// must decode on the CPU to within its precision, and the attributes and
+// uniforms it sets up against the recording GLES2 backend must read back the
+// same vertices, as the shader prelude declares them.  Exits with an error on
+// the first wrong result.
+//
+// Usage: vertex-format-check
+
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gl/vertex_format.h"
+#include "gles2_recorder.h"
+
+namespace {
+
+#define CHECK(cond, ...)                              \
+  do {                                                \
+    if (!(cond)) {                                    \
+      fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+      fprintf(stderr, __VA_ARGS__);                   \
+      fprintf(stderr, "\n");                          \
+      exit(EXIT_FAILURE);                             \
+    }                                                 \
+  } while (0)
+
+float from_bits(uint32_t bits) {
+  float result;
+  memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+uint32_t to_bits(float value) {
+  uint32_t result;
+  memcpy(&result, &value, sizeof(result));
+  return result;
+}
+
+void check_half(float value, uint16_t expected) {
+  const auto half = float_to_half(value);
+  CHECK(half == expected, "float_to_half(%.9g) is 0x%04x, not 0x%04x", value,
+        half, expected);
+}
+
+void check_float_to_half() {
+  check_half(0.0f, 0x0000);
+  check_half(-0.0f, 0x8000);
+  check_half(1.0f, 0x3c00);
+  check_half(-2.0f, 0xc000);
+  check_half(65504.0f, 0x7bff);
+  check_half(std::ldexp(1.0f, -14), 0x0400);
+  check_half(std::ldexp(1.0f, -24), 0x0001);
+  check_half(1023 * std::ldexp(1.0f, -24), 0x03ff);
+
+  // Ties go to the even neighbor, also where that carries into the exponent,
+  // from the subnormals to the normals and from the largest half to infinity.
+  check_half(1.0f + std::ldexp(1.0f, -11), 0x3c00);
+  check_half(1.0f + 3 * std::ldexp(1.0f, -11), 0x3c02);
+  check_half(2.0f - std::ldexp(1.0f, -12), 0x4000);
+  check_half(1023.5f * std::ldexp(1.0f, -24), 0x0400);
+  check_half(std::ldexp(1.0f, -25), 0x0000);
+  check_half(3 * std::ldexp(1.0f, -25), 0x0002);
+  check_half(65520.0f, 0x7c00);
+  check_half(std::nextafter(65520.0f, 0.0f), 0x7bff);
+
+  // Overflow, infinities and NaN.
+  check_half(1e9f, 0x7c00);
+  check_half(-FLT_MAX, 0xfc00);
+  check_half(INFINITY, 0x7c00);
+  check_half(-INFINITY, 0xfc00);
+  check_half(std::nanf(""), 0x7e00);
+  check_half(std::ldexp(1.0f, -26), 0x0000);
+  check_half(-FLT_MIN, 0x8000);
+
+  for (uint32_t sign = 0; sign <= 0x8000; sign += 0x8000) {
+    for (uint32_t h = 0; h < 0x7c00; ++h) {
+      const auto half = static_cast<uint16_t>(sign | h);
+      const auto value = half_to_float(half);
+      check_half(value, half);
+
+      // The float halfway to the next half rounds to the even one of the two,
+      // and the floats on either side of it to the nearer.  Halves have 11
+      // significant bits, so the midpoint is exact in a float.
+      const auto next =
+          (h == 0x7bff) ? std::ldexp(sign ? -1.0f : 1.0f, 16)
+                        : half_to_float(static_cast<uint16_t>(half + 1));
+      const auto midpoint = (value + next) / 2;
+      const auto next_half = static_cast<uint16_t>(half + 1);
+      check_half(midpoint, (h & 1) ? next_half : half);
+      check_half(from_bits(to_bits(midpoint) - 1), half);
+      check_half(from_bits(to_bits(midpoint) + 1), next_half);
+    }
+  }
+}
+
+// Reads element `index` of an attribute array from the recorder as GL would
+// pass it to the vertex shader, for the component types used by the formats.
+vec4 fetch(const gl_attribute& a, size_t index) {
+  const auto& recorder = gl_recorder::instance();
+  const auto& buffer = recorder.buffers[a.buffer];
+  const size_t component_size = (a.type == GL_UNSIGNED_BYTE) ? 1
+                                : (a.type == GL_FLOAT)       ? 4
+                                                             : 2;
+  const auto begin = a.offset + index * a.stride;
+  CHECK(begin + a.size * component_size <= buffer.size(),
+        "Attribute reads past the end of its buffer");
+
+  vec4 result(0.0f, 0.0f, 0.0f, 1.0f);
+  for (GLint i = 0; i < a.size; ++i) {
+    const auto p = buffer.data() + begin + i * component_size;
+    if (a.type == GL_FLOAT) {
+      memcpy(&result[i], p, sizeof(float));
+    } else if (a.type == GL_HALF_FLOAT_OES) {
+      uint16_t v;
+      memcpy(&v, p, sizeof(v));
+      result[i] = half_to_float(v);
+    } else if (a.type == GL_SHORT) {
+      CHECK(!a.normalized, "Normalized signed attributes decode differently "
+                           "in GLES 2 and 3");
+      int16_t v;
+      memcpy(&v, p, sizeof(v));
+      result[i] = v;
+    } else {
+      CHECK(a.type == GL_UNSIGNED_BYTE, "Unexpected attribute type 0x%04x",
+            a.type);
+      result[i] = a.normalized ? *p / 255.0f : *p;
+    }
+  }
+  return result;
+}
+
+float component(const vec3& v, size_t i) {
+  return (i == 0) ? v.x : (i == 1) ? v.y : v.z;
+}
+
+template <typename Format>
+typename Format::vertex encode_vertex(
+    const vec3& position, const std::array<uint8_t, 3>& color, const vec3&,
+    const std::array<uint8_t, 3>&, const position_bounds& bounds,
+    std::false_type) {
+  return Format::encode(position, color, bounds);
+}
+
+template <typename Format>
+typename Format::vertex encode_vertex(
+    const vec3& position, const std::array<uint8_t, 3>& color,
+    const vec3& morph_position, const std::array<uint8_t, 3>& morph_color,
+    const position_bounds& bounds, std::true_type) {
+  return Format::encode(position, color, morph_position, morph_color,
+                        bounds);
+}
+
+bool contains(const std::string& s, const std::string& part) {
+  return s.find(part) != std::string::npos;
+}
+
+// Largest error allowed when decoding `p`, encoded with `Position`.
+template <typename Position>
+float position_tolerance(float p, float half_extent);
+
+template <>
+float position_tolerance<float_position>(float, float) {
+  return 0.0f;
+}
+
+template <>
+float position_tolerance<half_position>(float p, float) {
+  return std::max(std::fabs(p) * std::ldexp(1.0f, -11), std::ldexp(1.0f, -25));
+}
+
+template <>
+float position_tolerance<snorm16_position>(float p, float half_extent) {
+  return half_extent / 32767.0f / 2 + std::fabs(p) * 4 * FLT_EPSILON;
+}
+
+template <typename Position, typename Color, bool Morph>
+void check_format(const char* name) {
+  typedef vertex_format<Position, Color, Morph> format;
+  typedef typename format::vertex vertex;
+
+  auto& recorder = gl_recorder::instance();
+  recorder.reset_context();
+  auto& state = gl_state::current();
+  state.invalidate();
+
+  const position_bounds bounds{vec3(1.0f, -2.0f, 3.0f),
+                               vec3(10.0f, 20.0f, 5.0f)};
+  std::mt19937 rng(9);
+  std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+  std::uniform_int_distribution<int> byte(0, 255);
+
+  std::vector<vec3> positions = {bounds.center,
+                                 bounds.center + bounds.half_extent,
+                                 bounds.center - bounds.half_extent};
+  while (positions.size() < 100) {
+    positions.push_back(bounds.center +
+                        vec3(unit(rng) * bounds.half_extent.x,
+                             unit(rng) * bounds.half_extent.y,
+                             unit(rng) * bounds.half_extent.z));
+  }
+
+  std::vector<std::array<uint8_t, 3>> colors;
+  std::vector<vertex> vertices;
+  for (size_t i = 0; i < positions.size(); ++i) {
+    colors.push_back({{static_cast<uint8_t>(byte(rng)),
+                       static_cast<uint8_t>(byte(rng)),
+                       static_cast<uint8_t>(byte(rng))}});
+  }
+  for (size_t i = 0; i < positions.size(); ++i) {
+    // Each vertex morphs towards the next one.
+    const auto j = (i + 1) % positions.size();
+    vertices.push_back(encode_vertex<format>(
+        positions[i], colors[i], positions[j], colors[j], bounds,
+        std::integral_constant<bool, Morph>()));
+  }
+
+  for (size_t i = 0; i < vertices.size(); ++i) {
+    const auto j = Morph ? (i + 1) % positions.size() : i;
+    const auto decoded = format::position(vertices[i], bounds);
+    const auto morph = format::morph_position(vertices[i], bounds);
+    for (size_t k = 0; k < 3; ++k) {
+      const auto half_extent = component(bounds.half_extent, k);
+      const auto p = component(positions[i], k);
+      const auto q = component(positions[j], k);
+      CHECK(std::fabs(component(decoded, k) - p) <=
+                position_tolerance<Position>(p, half_extent),
+            "%s decodes %.9g as %.9g", name, p, component(decoded, k));
+      CHECK(std::fabs(component(morph, k) - q) <=
+                position_tolerance<Position>(q, half_extent),
+            "%s decodes morph position %.9g as %.9g", name, q,
+            component(morph, k));
+    }
+  }
+
+  // Set up the attributes and uniforms as the renderer does, after some
+  // unrelated data, and read the vertices back as the shader sees them.
+  GLuint buffer;
+  glGenBuffers(1, &buffer);
+  state.bind_buffer(GL_ARRAY_BUFFER, buffer);
+  const size_t base = 64;
+  std::vector<uint8_t> data(base + vertices.size() * sizeof(vertex));
+  memcpy(data.data() + base, vertices.data(), vertices.size() * sizeof(vertex));
+  glBufferData(GL_ARRAY_BUFFER, data.size(), data.data(), GL_STATIC_DRAW);
+
+  const auto program = glCreateProgram();
+  state.use_program(program);
+  vertex_attributes attributes;
+  attributes.position = glGetAttribLocation(program, "attr_VertexPosition");
+  attributes.color = glGetAttribLocation(program, "attr_VertexColor");
+  if (Morph) {
+    attributes.morph_position =
+        glGetAttribLocation(program, "attr_VertexMorphPosition");
+    attributes.morph_color =
+        glGetAttribLocation(program, "attr_VertexMorphColor");
+  }
+  format::set_attributes(attributes, base);
+  format::enable_attributes(attributes);
+  format::set_uniforms(
+      glGetUniformLocation(program, "uniform_PositionScale"),
+      glGetUniformLocation(program, "uniform_PositionOffset"), bounds);
+  CHECK(glGetError() == GL_NO_ERROR, "%s set up raised a GL error", name);
+
+  const auto prelude = format::shader_prelude();
+  const auto scale = recorder.uniform(program, "uniform_PositionScale");
+  const auto offset = recorder.uniform(program, "uniform_PositionOffset");
+  CHECK(!scale == !offset, "%s sets only one dequantization uniform", name);
+  const bool declared =
+      contains(prelude, "uniform vec3 uniform_PositionScale;") &&
+      contains(prelude, "uniform vec3 uniform_PositionOffset;");
+  CHECK(!scale == !declared,
+        "%s sets different uniforms than its prelude declares", name);
+  CHECK(!scale || (scale->size() == 3 && offset->size() == 3),
+        "%s sets dequantization uniforms of the wrong size", name);
+
+  const std::string color_type = Color::kAttributeType;
+  const GLint color_size = (color_type == "vec4") ? 4 : 3;
+  CHECK(contains(prelude, "attribute vec3 attr_VertexPosition;") &&
+            contains(prelude, "attribute " + color_type + " attr_VertexColor;"),
+        "%s prelude lacks the vertex attributes", name);
+  CHECK(contains(prelude, "attr_VertexMorphPosition") == Morph &&
+            contains(prelude, "attr_VertexMorphColor") == Morph,
+        "%s prelude has the wrong morph attributes", name);
+
+  const auto read_position = [&](GLint location, size_t i) {
+    auto p = fetch(recorder.attributes[location], i);
+    if (scale) {
+      for (size_t k = 0; k < 3; ++k)
+        p[k] = p[k] * (*scale)[k] + (*offset)[k];
+    }
+    return p;
+  };
+
+  // The shader and decode() round differently, by up to a few ulps of the
+  // scaled position and the offset added to it.
+  const auto read_tolerance = [&bounds](size_t k) {
+    return (component(bounds.half_extent, k) +
+            std::fabs(component(bounds.center, k))) *
+           4 * FLT_EPSILON;
+  };
+
+  const auto check_attribute = [&](GLint location, GLint size) {
+    CHECK(location >= 0, "%s has a missing attribute", name);
+    const auto& a = recorder.attributes[location];
+    CHECK(a.enabled && a.buffer == buffer && a.size == size &&
+              a.stride == sizeof(vertex),
+          "%s sets up attribute %d wrongly", name, location);
+  };
+
+  check_attribute(attributes.position, 3);
+  check_attribute(attributes.color, color_size);
+  if (Morph) {
+    check_attribute(attributes.morph_position, 3);
+    check_attribute(attributes.morph_color, color_size);
+  }
+
+  for (size_t i = 0; i < vertices.size(); ++i) {
+    const auto j = Morph ? (i + 1) % positions.size() : i;
+    const auto expected = format::position(vertices[i], bounds);
+    const auto expected_morph = format::morph_position(vertices[i], bounds);
+    const auto position = read_position(attributes.position, i);
+    for (size_t k = 0; k < 3; ++k) {
+      const auto e = component(expected, k);
+      CHECK(std::fabs(position[k] - e) <= read_tolerance(k),
+            "%s attribute reads %.9g, not %.9g", name, position[k], e);
+    }
+
+    const auto color = fetch(recorder.attributes[attributes.color], i);
+    for (size_t k = 0; k < 3; ++k)
+      CHECK(color[k] == colors[i][k] / 255.0f, "%s color differs", name);
+    CHECK(color.w == 1.0f, "%s color is not opaque", name);
+
+    if (!Morph) continue;
+    const auto morph = read_position(attributes.morph_position, i);
+    for (size_t k = 0; k < 3; ++k) {
+      const auto e = component(expected_morph, k);
+      CHECK(std::fabs(morph[k] - e) <= read_tolerance(k),
+            "%s morph attribute reads %.9g, not %.9g", name, morph[k], e);
+    }
+    const auto morph_color =
+        fetch(recorder.attributes[attributes.morph_color], i);
+    for (size_t k = 0; k < 3; ++k)
+      CHECK(morph_color[k] == colors[j][k] / 255.0f,
+            "%s morph color differs", name);
+  }
+}
+
+template <typename Position, typename Color>
+void check_formats(const char* position, const char* color) {
+  const auto name = std::string(position) + "/" + color;
+  check_format<Position, Color, false>(name.c_str());
+  check_format<Position, Color, true>((name + "/morph").c_str());
+}
+
+}  // namespace
+
+int main() {
+  check_float_to_half();
+
+  check_formats<float_position, rgb8_color>("float", "rgb8");
+  check_formats<float_position, rgba8_color>("float", "rgba8");
+  check_formats<snorm16_position, rgb8_color>("snorm16", "rgb8");
+  check_formats<snorm16_position, rgba8_color>("snorm16", "rgba8");
+  check_formats<half_position, rgb8_color>("half", "rgb8");
+  check_formats<half_position, rgba8_color>("half", "rgba8");
+
+  CHECK(float_position::supported("") && snorm16_position::supported(""),
+        "Core formats need no extension");
+  CHECK(!half_position::supported("GL_OES_element_index_uint") &&
+            half_position::supported("GL_OES_vertex_half_float"),
+        "half_position must require GL_OES_vertex_half_float");
+
+  printf("ok\n");
+  return EXIT_SUCCESS;
+}
@@ -5,7 +5,15 @@ include $(CLEAR_VARS)
 LOCAL_MODULE    := hello-world
 LOCAL_CFLAGS    := -Wall
 LOCAL_CXXFLAGS  := -Wall -Wno-format-security -std=c++14 -fexceptions
-LOCAL_SRC_FILES := hello-world.cc
-LOCAL_LDLIBS    := -llog -lGLESv2
+LOCAL_SRC_FILES := hello-world.cc renderer.cc
+LOCAL_LDLIBS    := -landroid -llog -lEGL -lGLESv2
+
+ifneq ($(GL_CHECK),)
+LOCAL_CPPFLAGS  += -DUTILS_GL_CHECK_MODE=UTILS_GL_CHECK_$(GL_CHECK)
+endif
+
+ifeq ($(TARGET_ARCH_ABI),armeabi-v7a)
+LOCAL_ARM_NEON  := true
+endif
 
 include $(BUILD_SHARED_LIBRARY)
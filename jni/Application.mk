@@ -0,0 +1,2 @@
+# armeabi has no NEON, so the SIMD matrix kernels need armeabi-v7a or arm64.
+APP_ABI := armeabi-v7a arm64-v8a
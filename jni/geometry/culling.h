@@ -0,0 +1,441 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "geometry/simd.h"
+#include "geometry/vector.h"
+#include "utils/job_system.h"
+
+// View frustum culling of bounding spheres, either by brute force over
+// structure-of-arrays data, or through a bounding volume hierarchy.
+
+struct bounding_sphere {
+  // Returns a sphere containing all the points, centered on their bounding
+  // box.  This is close to optimal for convex shapes such as sphere() output.
+  static bounding_sphere of(const vec3* points, size_t count) {
+    if (!count) return {vec3(), 0.0f};
+
+    auto min = points[0], max = points[0];
+    for (size_t i = 1; i < count; ++i) {
+      min = vec3(std::min(min.x, points[i].x), std::min(min.y, points[i].y),
+                 std::min(min.z, points[i].z));
+      max = vec3(std::max(max.x, points[i].x), std::max(max.y, points[i].y),
+                 std::max(max.z, points[i].z));
+    }
+
+    const auto center = (min + max) * 0.5f;
+    float radius2 = 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+      const auto d = points[i] - center;
+      radius2 = std::max(radius2, d * d);
+    }
+
+    return {center, std::sqrt(radius2)};
+  }
+
+  vec3 center;
+  float radius;
+};
+
+// Six planes (a, b, c, d) with normals pointing inwards.  A point p is inside
+// when a p.x + b p.y + c p.z + d >= 0 for every plane.
+struct frustum {
+  enum { kLeft, kRight, kBottom, kTop, kNear, kFar };
+
+  // Extracts the planes of a projection or view projection matrix, following
+  // Gribb and Hartmann.  The infinite far plane of mat4x4::projection()
+  // comes out as (0, 0, 0, d) with d > 0, which everything passes.
+  static frustum from_matrix(const mat4x4& m) {
+    const auto r0 = m.row(0), r1 = m.row(1), r2 = m.row(2), r3 = m.row(3);
+
+    frustum result;
+    result.planes = {{r3 + r0, r3 - r0, r3 + r1, r3 - r1, r3 + r2, r3 - r2}};
+
+    for (auto& plane : result.planes) {
+      const auto length =
+          std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+      if (length > 0.0f) plane *= 1.0f / length;
+    }
+
+    return result;
+  }
+
+  // Signed distance from the plane to `point`, positive on the inside.
+  float distance(size_t plane, const vec3& point) const {
+    const auto& p = planes[plane];
+    return p.x * point.x + p.y * point.y + p.z * point.z + p.w;
+  }
+
+  bool intersects(const vec3& center, float radius) const {
+    for (size_t i = 0; i < planes.size(); ++i)
+      if (distance(i, center) < -radius) return false;
+    return true;
+  }
+
+  std::array<vec4, 6> planes;
+};
+
+// Number of spheres processed per iteration by cull_spheres(), and the
+// number of elements it may read past the end of its input.
+constexpr size_t kCullBatch = 8;
+
+// Spheres in structure-of-arrays layout.  The arrays are followed by
+// kCullBatch spheres that are never visible, so that cull_spheres() can run
+// over them without a scalar tail loop.
+class bounding_spheres {
+ public:
+  bounding_spheres() { clear(); }
+
+  void clear() {
+    x_.assign(kCullBatch, 0.0f);
+    y_.assign(kCullBatch, 0.0f);
+    z_.assign(kCullBatch, 0.0f);
+    radius_.assign(kCullBatch, -std::numeric_limits<float>::infinity());
+    size_ = 0;
+  }
+
+  void reserve(size_t count) {
+    x_.reserve(count + kCullBatch);
+    y_.reserve(count + kCullBatch);
+    z_.reserve(count + kCullBatch);
+    radius_.reserve(count + kCullBatch);
+  }
+
+  void push_back(const bounding_sphere& sphere) {
+    // Move the padding one step, and overwrite its first element.
+    x_.push_back(0.0f);
+    y_.push_back(0.0f);
+    z_.push_back(0.0f);
+    radius_.push_back(-std::numeric_limits<float>::infinity());
+    x_[size_] = sphere.center.x;
+    y_[size_] = sphere.center.y;
+    z_[size_] = sphere.center.z;
+    radius_[size_] = sphere.radius;
+    ++size_;
+  }
+
+  bounding_sphere operator[](size_t i) const {
+    return {vec3(x_[i], y_[i], z_[i]), radius_[i]};
+  }
+
+  void set(size_t i, const bounding_sphere& sphere) {
+    x_[i] = sphere.center.x;
+    y_[i] = sphere.center.y;
+    z_[i] = sphere.center.z;
+    radius_[i] = sphere.radius;
+  }
+
+  size_t size() const { return size_; }
+
+  const float* x() const { return x_.data(); }
+  const float* y() const { return y_.data(); }
+  const float* z() const { return z_.data(); }
+  const float* radius() const { return radius_.data(); }
+
+ private:
+  std::vector<float> x_, y_, z_, radius_;
+  size_t size_ = 0;
+};
+
+// Writes `base + i` to `out` for each sphere `i` in [0, count) that
+// intersects the frustum, and returns the number of indices written.  Reads
+// up to kCullBatch - 1 spheres past `count`.
+inline size_t cull_spheres(const frustum& f, const float* x, const float* y,
+                           const float* z, const float* radius, size_t count,
+                           uint32_t base, uint32_t* out) {
+  const auto begin = out;
+
+#if GEOMETRY_SIMD_AVX
+  __m256 a[6], b[6], c[6], d[6];
+  for (size_t j = 0; j < 6; ++j) {
+    a[j] = _mm256_set1_ps(f.planes[j].x);
+    b[j] = _mm256_set1_ps(f.planes[j].y);
+    c[j] = _mm256_set1_ps(f.planes[j].z);
+    d[j] = _mm256_set1_ps(f.planes[j].w);
+  }
+
+  for (size_t i = 0; i < count; i += 8) {
+    const auto cx = _mm256_loadu_ps(x + i);
+    const auto cy = _mm256_loadu_ps(y + i);
+    const auto cz = _mm256_loadu_ps(z + i);
+    const auto r = _mm256_loadu_ps(radius + i);
+
+    // The smallest distance + radius over all planes is >= 0 for visible
+    // spheres.
+    auto min_distance = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+    for (size_t j = 0; j < 6; ++j) {
+      auto distance = _mm256_add_ps(_mm256_mul_ps(a[j], cx), d[j]);
+      distance = _mm256_add_ps(distance, _mm256_mul_ps(b[j], cy));
+      distance = _mm256_add_ps(distance, _mm256_mul_ps(c[j], cz));
+      min_distance = _mm256_min_ps(min_distance, _mm256_add_ps(distance, r));
+    }
+
+    auto mask = static_cast<unsigned>(_mm256_movemask_ps(
+        _mm256_cmp_ps(min_distance, _mm256_setzero_ps(), _CMP_GE_OQ)));
+    if (count - i < 8) mask &= (1u << (count - i)) - 1;
+
+    for (; mask; mask &= mask - 1)
+      *out++ = base + static_cast<uint32_t>(i + __builtin_ctz(mask));
+  }
+#elif GEOMETRY_SIMD
+  simd::f32x4 a[6], b[6], c[6], d[6];
+  for (size_t j = 0; j < 6; ++j) {
+    a[j] = simd::splat(f.planes[j].x);
+    b[j] = simd::splat(f.planes[j].y);
+    c[j] = simd::splat(f.planes[j].z);
+    d[j] = simd::splat(f.planes[j].w);
+  }
+
+  for (size_t i = 0; i < count; i += 4) {
+    const auto cx = simd::load(x + i);
+    const auto cy = simd::load(y + i);
+    const auto cz = simd::load(z + i);
+    const auto r = simd::load(radius + i);
+
+    // The smallest distance + radius over all planes is >= 0 for visible
+    // spheres.
+    auto min_distance = simd::splat(std::numeric_limits<float>::infinity());
+    for (size_t j = 0; j < 6; ++j) {
+      auto distance = simd::add(simd::mul(a[j], cx), d[j]);
+      distance = simd::add(distance, simd::mul(b[j], cy));
+      distance = simd::add(distance, simd::mul(c[j], cz));
+      min_distance = simd::min(min_distance, simd::add(distance, r));
+    }
+
+    auto mask = simd::nonnegative_mask(min_distance);
+    if (count - i < 4) mask &= (1u << (count - i)) - 1;
+
+    for (; mask; mask &= mask - 1)
+      *out++ = base + static_cast<uint32_t>(i + __builtin_ctz(mask));
+  }
+#else
+  for (size_t i = 0; i < count; ++i) {
+    if (f.intersects(vec3(x[i], y[i], z[i]), radius[i]))
+      *out++ = base + static_cast<uint32_t>(i);
+  }
+#endif
+
+  return out - begin;
+}
+
+inline size_t cull_spheres(const frustum& f, const bounding_spheres& spheres,
+                           uint32_t* out) {
+  return cull_spheres(f, spheres.x(), spheres.y(), spheres.z(),
+                      spheres.radius(), spheres.size(), 0, out);
+}
+
+// Bounding volume hierarchy over spheres that rarely move.  Subtrees outside
+// any plane are skipped, and subtrees inside all planes are accepted without
+// further tests.
+class sphere_bvh {
+ public:
+  // Maximum number of spheres in a leaf, tested with cull_spheres().
+  static constexpr size_t kLeafSize = 16;
+
+  void build(const bounding_spheres& spheres) {
+    std::vector<uint32_t> order(spheres.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+
+    nodes_.clear();
+    nodes_.reserve(2 * (order.size() / kLeafSize + 1));
+    if (!order.empty())
+      build_node(spheres, order.data(), order.data(), order.size());
+
+    // Store the spheres in tree order, so that every subtree is a
+    // contiguous range.
+    spheres_.clear();
+    spheres_.reserve(order.size());
+    for (auto i : order) spheres_.push_back(spheres[i]);
+    ids_ = std::move(order);
+
+    positions_.resize(ids_.size());
+    for (size_t i = 0; i < ids_.size(); ++i) positions_[ids_[i]] = i;
+  }
+
+  // Moves sphere `id`.  The nodes above it grow to contain it, but never
+  // shrink, so culling stays correct while the tree loosens; build() again
+  // after large changes.  Logarithmic in size().
+  void update(uint32_t id, const bounding_sphere& sphere) {
+    const auto position = positions_[id];
+    spheres_.set(position, sphere);
+
+    for (size_t index = 0;;) {
+      auto& bounds = nodes_[index].bounds;
+      const auto d = sphere.center - bounds.center;
+      bounds.radius = std::max(bounds.radius, std::sqrt(d * d) + sphere.radius);
+
+      if (!nodes_[index].second_child) break;
+      const auto& first = nodes_[index + 1];
+      index = (position < first.first + first.count)
+                  ? index + 1
+                  : nodes_[index].second_child;
+    }
+  }
+
+  size_t size() const { return ids_.size(); }
+
+  // Writes the indices of the visible spheres to `out`, which must have room
+  // for size() elements, and returns their number.  The order is that of the
+  // tree, which keeps nearby objects together.
+  size_t cull(const frustum& f, uint32_t* out) const {
+    if (nodes_.empty()) return 0;
+    return cull_node(0, f, (1u << f.planes.size()) - 1, out) - out;
+  }
+
+  // Like cull(), but culls up to 2^kParallelDepth subtrees on `jobs`.  Each
+  // subtree writes to the part of `out` matching its range of spheres, and
+  // the results are packed afterwards.
+  size_t cull(const frustum& f, uint32_t* out, job_system& jobs) const {
+    if (size() < kParallelSize || !jobs.thread_count()) return cull(f, out);
+
+    std::array<uint32_t, 1 << kParallelDepth> roots;
+    size_t root_count = 0;
+    collect_subtrees(0, kParallelDepth, roots.data(), &root_count);
+
+    const auto all_planes = (1u << f.planes.size()) - 1;
+    std::array<size_t, 1 << kParallelDepth> counts;
+    jobs.parallel_for(root_count, 1, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        const auto subtree_out = out + nodes_[roots[i]].first;
+        counts[i] =
+            cull_node(roots[i], f, all_planes, subtree_out) - subtree_out;
+      }
+    });
+
+    // Subtrees are in tree order, so every range moves towards the front.
+    size_t result = 0;
+    for (size_t i = 0; i < root_count; ++i) {
+      const auto subtree_out = out + nodes_[roots[i]].first;
+      result = std::copy(subtree_out, subtree_out + counts[i], out + result) -
+               out;
+    }
+    return result;
+  }
+
+ private:
+  // Trees smaller than this are culled on the calling thread.
+  static constexpr size_t kParallelSize = 16384;
+  static constexpr size_t kParallelDepth = 3;
+
+  struct node {
+    bounding_sphere bounds;
+    // The node's spheres, in tree order.
+    uint32_t first;
+    uint32_t count;
+    // Inner nodes have their first child right after them.  Zero for
+    // leaves.
+    uint32_t second_child;
+  };
+
+  // Builds the subtree for `order[0, count)`, whose position in the whole
+  // order array is `order - all`.
+  void build_node(const bounding_spheres& spheres, const uint32_t* all,
+                  uint32_t* order, size_t count) {
+    auto min = spheres[order[0]].center, max = min;
+    vec3 bounds_min(std::numeric_limits<float>::infinity(),
+                    std::numeric_limits<float>::infinity(),
+                    std::numeric_limits<float>::infinity());
+    auto bounds_max = bounds_min * -1.0f;
+    for (size_t i = 0; i < count; ++i) {
+      const auto s = spheres[order[i]];
+      min = vec3(std::min(min.x, s.center.x), std::min(min.y, s.center.y),
+                 std::min(min.z, s.center.z));
+      max = vec3(std::max(max.x, s.center.x), std::max(max.y, s.center.y),
+                 std::max(max.z, s.center.z));
+      bounds_min = vec3(std::min(bounds_min.x, s.center.x - s.radius),
+                        std::min(bounds_min.y, s.center.y - s.radius),
+                        std::min(bounds_min.z, s.center.z - s.radius));
+      bounds_max = vec3(std::max(bounds_max.x, s.center.x + s.radius),
+                        std::max(bounds_max.y, s.center.y + s.radius),
+                        std::max(bounds_max.z, s.center.z + s.radius));
+    }
+
+    node n;
+    n.bounds.center = (bounds_min + bounds_max) * 0.5f;
+    n.bounds.radius = 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+      const auto s = spheres[order[i]];
+      const auto d = s.center - n.bounds.center;
+      n.bounds.radius = std::max(n.bounds.radius, std::sqrt(d * d) + s.radius);
+    }
+    n.first = static_cast<uint32_t>(order - all);
+    n.count = static_cast<uint32_t>(count);
+    n.second_child = 0;
+
+    const auto index = nodes_.size();
+    nodes_.push_back(n);
+    if (count <= kLeafSize) return;
+
+    // Split at the median of the longest axis of the centers.
+    const auto extent = max - min;
+    const auto axis = (extent.x >= extent.y && extent.x >= extent.z)
+                          ? 0
+                          : (extent.y >= extent.z) ? 1 : 2;
+    const auto half = count / 2;
+    std::nth_element(order, order + half, order + count,
+                     [&spheres, axis](uint32_t a, uint32_t b) {
+                       const auto ca = spheres[a].center;
+                       const auto cb = spheres[b].center;
+                       return (axis == 0)   ? ca.x < cb.x
+                              : (axis == 1) ? ca.y < cb.y
+                                            : ca.z < cb.z;
+                     });
+
+    build_node(spheres, all, order, half);
+    nodes_[index].second_child = static_cast<uint32_t>(nodes_.size());
+    build_node(spheres, all, order + half, count - half);
+  }
+
+  // Appends the roots of the subtrees `depth` levels below `index` to
+  // `roots`, in tree order.  Leaves above that depth are roots themselves.
+  void collect_subtrees(size_t index, size_t depth, uint32_t* roots,
+                        size_t* count) const {
+    if (!depth || !nodes_[index].second_child) {
+      roots[(*count)++] = index;
+      return;
+    }
+    collect_subtrees(index + 1, depth - 1, roots, count);
+    collect_subtrees(nodes_[index].second_child, depth - 1, roots, count);
+  }
+
+  // `planes` has a bit set for each plane the node may cross.
+  uint32_t* cull_node(size_t index, const frustum& f, unsigned planes,
+                      uint32_t* out) const {
+    const auto& n = nodes_[index];
+
+    for (size_t i = 0; i < f.planes.size(); ++i) {
+      if (!(planes & (1u << i))) continue;
+      const auto distance = f.distance(i, n.bounds.center);
+      if (distance < -n.bounds.radius) return out;
+      if (distance >= n.bounds.radius) planes &= ~(1u << i);
+    }
+
+    if (!planes) {
+      out = std::copy(ids_.begin() + n.first,
+                      ids_.begin() + n.first + n.count, out);
+    } else if (!n.second_child) {
+      const auto visible =
+          cull_spheres(f, spheres_.x() + n.first, spheres_.y() + n.first,
+                       spheres_.z() + n.first, spheres_.radius() + n.first,
+                       n.count, n.first, out);
+      for (size_t i = 0; i < visible; ++i) out[i] = ids_[out[i]];
+      out += visible;
+    } else {
+      out = cull_node(index + 1, f, planes, out);
+      out = cull_node(n.second_child, f, planes, out);
+    }
+
+    return out;
+  }
+
+  std::vector<node> nodes_;
+  bounding_spheres spheres_;
+  // Original index of each sphere in spheres_, and the reverse.
+  std::vector<uint32_t> ids_;
+  std::vector<uint32_t> positions_;
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "geometry/vector.h"
+
+// Level of detail selection for sphere() meshes, whose level q has edges of
+// about sqrt(2) / 2^q times the radius.  The level follows the projected
+// radius with some hysteresis, and geomorphing blends between neighbouring
+// levels over a few frames instead of switching at once.
+
+// Level of detail of a single object, kept between frames.
+struct lod_state {
+  static constexpr uint8_t kUnset = 0xff;
+
+  uint8_t level = kUnset;
+  // How far the vertices added by `level` have moved from the midpoints of
+  // their parents, from 0 to 1.
+  float morph = 1.0f;
+};
+
+class lod_selector {
+ public:
+  // Edge length of an octahedron relative to its circumradius.
+  static constexpr float kOctahedronEdge = 1.4142f;
+
+  // Levels beyond `max_level` are never selected.  Edges are kept at about
+  // `edge_pixels` on screen, and the level changes only once the ideal level
+  // is `hysteresis` past the next one.  Morphing to a new level takes
+  // `morph_frames` frames, or none if zero.
+  explicit lod_selector(unsigned max_level, float edge_pixels = 12.0f,
+                        float hysteresis = 0.25f, unsigned morph_frames = 8)
+      : max_level_(max_level),
+        edge_pixels_(edge_pixels),
+        hysteresis_(hysteresis),
+        morph_step_(morph_frames ? 1.0f / morph_frames : 1.0f) {}
+
+  unsigned max_level() const { return max_level_; }
+
+  // Returns the radius in pixels of a sphere `distance` units in front of a
+  // camera using `projection`, for a viewport `viewport_height` pixels high.
+  static float screen_radius(const mat4x4& projection, float viewport_height,
+                             float radius, float distance) {
+    if (distance <= 0.0f) return viewport_height;
+    return radius * projection.m[1][1] * 0.5f * viewport_height / distance;
+  }
+
+  // Returns the fractional level whose edges are `edge_pixels` long on screen.
+  float ideal_level(float radius_pixels) const {
+    const auto edges = radius_pixels * kOctahedronEdge / edge_pixels_;
+    if (!(edges > 1.0f)) return 0.0f;
+    return std::min(std::log2(edges), static_cast<float>(max_level_));
+  }
+
+  // Moves `state` one frame towards the level for `radius_pixels`.
+  void update(lod_state& state, float radius_pixels) const {
+    const auto ideal = ideal_level(radius_pixels);
+
+    if (state.level == lod_state::kUnset) {
+      state.level = static_cast<uint8_t>(std::ceil(ideal));
+      state.morph = 1.0f;
+      return;
+    }
+
+    if (state.level > max_level_) {
+      state.level = max_level_;
+      state.morph = 1.0f;
+    }
+
+    if (ideal > state.level + hysteresis_ && state.level < max_level_) {
+      // Finish the current morph first, so that the new level starts from the
+      // shape on screen.
+      if (state.morph < 1.0f) {
+        state.morph = std::min(1.0f, state.morph + morph_step_);
+      } else {
+        ++state.level;
+        state.morph = morph_step_ < 1.0f ? 0.0f : 1.0f;
+      }
+    } else if (ideal < state.level - 1.0f - hysteresis_ && state.level > 0) {
+      state.morph -= morph_step_;
+      if (state.morph <= 0.0f) {
+        --state.level;
+        state.morph = 1.0f;
+      }
+    } else {
+      state.morph = std::min(1.0f, state.morph + morph_step_);
+    }
+  }
+
+ private:
+  unsigned max_level_;
+  float edge_pixels_;
+  float hysteresis_;
+  float morph_step_;
+};
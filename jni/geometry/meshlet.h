@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "geometry/culling.h"
+#include "geometry/vector.h"
+
+// Splitting of triangle meshes into meshlets: runs of consecutive triangles
+// that use a bounded number of distinct vertices, so that each can be drawn
+// with small indices relative to its own vertices, and culled on its own.
+
+struct meshlet {
+  // Ranges in the vertex map and the local indices from build_meshlets().
+  uint32_t first_vertex;
+  uint32_t vertex_count;
+  uint32_t first_index;
+  uint32_t index_count;
+
+  // Bounds in object space.
+  bounding_sphere bounds;
+
+  // Normal cone of the triangles: seen from a point p, every triangle faces
+  // away if dot(bounds.center - p, cone_axis) is at least cone_cutoff times
+  // the distance from p to the center, plus the radius.  The cutoff is above
+  // 1 if the normals are too spread out for that to happen.
+  vec3 cone_axis;
+  float cone_cutoff;
+
+  // Returns false if, with `transform` applied, the meshlet is outside
+  // `view` or faces away from `eye`, both in world space.
+  bool visible(const affine_transform& transform, const frustum& view,
+               const vec3& eye) const {
+    const auto center = transform * bounds.center;
+    const auto radius = bounds.radius * transform.scale;
+    if (!view.intersects(center, radius)) return false;
+    if (cone_cutoff > 1.0f) return true;
+
+    const auto to_center = center - eye;
+    const auto axis = transform.rotation.quat_rotate(cone_axis);
+    return to_center * axis < cone_cutoff * to_center.magnitude() + radius;
+  }
+};
+
+// Splits the triangles in `indices`, in order, into meshlets of at most
+// `max_vertices` vertices.  `position(i)` returns the position of vertex i,
+// which is less than `vertex_count`.  For each meshlet, appends the input
+// vertices it uses to `vertex_map`, in order of first use, and its triangles
+// to `local_indices`, as positions in that list.  Vertices shared between
+// meshlets are listed once per meshlet.
+template <typename IndexType, typename LocalIndexType, typename Position>
+void build_meshlets(const IndexType* indices, size_t index_count,
+                    size_t vertex_count, size_t max_vertices,
+                    Position position, std::vector<meshlet>* meshlets,
+                    std::vector<uint32_t>* vertex_map,
+                    std::vector<LocalIndexType>* local_indices) {
+  constexpr uint32_t kUnused = ~uint32_t(0);
+  std::vector<uint32_t> local(vertex_count, kUnused);
+  max_vertices = std::max<size_t>(max_vertices, 3);
+
+  size_t begin = 0;
+  while (begin + 3 <= index_count) {
+    meshlet m;
+    m.first_vertex = vertex_map->size();
+    m.first_index = local_indices->size();
+
+    auto end = begin;
+    for (; end + 3 <= index_count; end += 3) {
+      size_t added = 0;
+      for (size_t j = 0; j < 3; ++j)
+        added += local[indices[end + j]] == kUnused;
+      if (vertex_map->size() - m.first_vertex + added > max_vertices) break;
+
+      for (size_t j = 0; j < 3; ++j) {
+        const auto v = indices[end + j];
+        if (local[v] == kUnused) {
+          local[v] = vertex_map->size() - m.first_vertex;
+          vertex_map->push_back(v);
+        }
+        local_indices->push_back(static_cast<LocalIndexType>(local[v]));
+      }
+    }
+
+    m.vertex_count = vertex_map->size() - m.first_vertex;
+    m.index_count = local_indices->size() - m.first_index;
+
+    std::vector<vec3> points;
+    points.reserve(m.vertex_count);
+    for (size_t i = m.first_vertex; i < vertex_map->size(); ++i) {
+      points.push_back(position((*vertex_map)[i]));
+      local[(*vertex_map)[i]] = kUnused;
+    }
+    m.bounds = bounding_sphere::of(points.data(), points.size());
+
+    // The cone is centered on the average normal, and as narrow as the
+    // triangle deviating most from it allows.
+    std::vector<vec3> normals;
+    normals.reserve(m.index_count / 3);
+    vec3 sum;
+    for (size_t i = begin; i < end; i += 3) {
+      const auto a = position(indices[i]);
+      const auto n =
+          (position(indices[i + 1]) - a).cross(position(indices[i + 2]) - a);
+      const auto length = n.magnitude();
+      if (length <= 0.0f) continue;
+      normals.push_back(n / length);
+      sum += normals.back();
+    }
+
+    m.cone_axis = vec3();
+    m.cone_cutoff = 2.0f;
+    if (sum.magnitude() > 0.0f) {
+      m.cone_axis = sum.normalize();
+      auto min_dot = 1.0f;
+      for (const auto& n : normals)
+        min_dot = std::min(min_dot, n * m.cone_axis);
+      if (min_dot > 0.0f)
+        m.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+    }
+
+    meshlets->push_back(m);
+    begin = end;
+  }
+}
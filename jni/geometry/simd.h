@@ -0,0 +1,309 @@
+#pragma once
+
+// Four-wide float vectors on top of NEON or SSE intrinsics, selected at
+// compile time.  GEOMETRY_SIMD is defined to 1 when one of them is available,
+// and can be forced to 0 to get the scalar code everywhere.
+
+#ifndef GEOMETRY_SIMD
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define GEOMETRY_SIMD 1
+#define GEOMETRY_SIMD_NEON 1
+#elif defined(__SSE__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define GEOMETRY_SIMD 1
+#define GEOMETRY_SIMD_SSE 1
+#if defined(__AVX__)
+#define GEOMETRY_SIMD_AVX 1
+#endif
+#else
+#define GEOMETRY_SIMD 0
+#endif
+#endif
+
+#include <cfloat>
+
+#if GEOMETRY_SIMD_NEON
+#include <arm_neon.h>
+#elif GEOMETRY_SIMD_AVX
+#include <immintrin.h>
+#elif GEOMETRY_SIMD_SSE
+#include <xmmintrin.h>
+#endif
+
+#if GEOMETRY_SIMD
+
+namespace simd {
+
+#if GEOMETRY_SIMD_NEON
+
+typedef float32x4_t f32x4;
+
+inline f32x4 load(const float* p) { return vld1q_f32(p); }
+inline void store(float* p, f32x4 v) { vst1q_f32(p, v); }
+inline f32x4 splat(float v) { return vdupq_n_f32(v); }
+inline f32x4 set(float x, float y, float z, float w) {
+  const float v[4] = {x, y, z, w};
+  return vld1q_f32(v);
+}
+inline f32x4 add(f32x4 a, f32x4 b) { return vaddq_f32(a, b); }
+inline f32x4 sub(f32x4 a, f32x4 b) { return vsubq_f32(a, b); }
+inline f32x4 mul(f32x4 a, f32x4 b) { return vmulq_f32(a, b); }
+
+// Returns a + b * lane `i` of c.
+template <int i>
+inline f32x4 madd_lane(f32x4 a, f32x4 b, f32x4 c) {
+#if defined(__aarch64__)
+  return vfmaq_laneq_f32(a, b, c, i);
+#else
+  return vmlaq_n_f32(a, b, vgetq_lane_f32(c, i));
+#endif
+}
+
+template <int i>
+inline f32x4 mul_lane(f32x4 a, f32x4 b) {
+#if defined(__aarch64__)
+  return vmulq_laneq_f32(a, b, i);
+#else
+  return vmulq_n_f32(a, vgetq_lane_f32(b, i));
+#endif
+}
+
+inline f32x4 div(f32x4 a, f32x4 b) {
+#if defined(__aarch64__)
+  return vdivq_f32(a, b);
+#else
+  // Two Newton-Raphson steps on the reciprocal estimate give full precision.
+  auto r = vrecpeq_f32(b);
+  r = vmulq_f32(vrecpsq_f32(b, r), r);
+  r = vmulq_f32(vrecpsq_f32(b, r), r);
+  return vmulq_f32(a, r);
+#endif
+}
+
+// Returns {a[x], a[y], b[z], b[w]}.
+template <int x, int y, int z, int w>
+inline f32x4 shuffle(f32x4 a, f32x4 b) {
+  auto r = vdupq_n_f32(vgetq_lane_f32(a, x));
+  r = vsetq_lane_f32(vgetq_lane_f32(a, y), r, 1);
+  r = vsetq_lane_f32(vgetq_lane_f32(b, z), r, 2);
+  return vsetq_lane_f32(vgetq_lane_f32(b, w), r, 3);
+}
+
+template <int i>
+inline float lane(f32x4 v) {
+  return vgetq_lane_f32(v, i);
+}
+
+inline f32x4 min(f32x4 a, f32x4 b) { return vminq_f32(a, b); }
+
+// Returns a bit mask of the lanes that are >= 0, lane 0 in bit 0.
+inline unsigned nonnegative_mask(f32x4 v) {
+  static const uint32_t kBits[4] = {1, 2, 4, 8};
+  const auto bits =
+      vandq_u32(vcgeq_f32(v, vdupq_n_f32(0.0f)), vld1q_u32(kBits));
+#if defined(__aarch64__)
+  return vaddvq_u32(bits);
+#else
+  const auto pairs = vpadd_u32(vget_low_u32(bits), vget_high_u32(bits));
+  return vget_lane_u32(vpadd_u32(pairs, pairs), 0);
+#endif
+}
+
+#else  // GEOMETRY_SIMD_SSE
+
+typedef __m128 f32x4;
+
+inline f32x4 load(const float* p) { return _mm_loadu_ps(p); }
+inline void store(float* p, f32x4 v) { _mm_storeu_ps(p, v); }
+inline f32x4 splat(float v) { return _mm_set1_ps(v); }
+inline f32x4 set(float x, float y, float z, float w) {
+  return _mm_setr_ps(x, y, z, w);
+}
+inline f32x4 add(f32x4 a, f32x4 b) { return _mm_add_ps(a, b); }
+inline f32x4 sub(f32x4 a, f32x4 b) { return _mm_sub_ps(a, b); }
+inline f32x4 mul(f32x4 a, f32x4 b) { return _mm_mul_ps(a, b); }
+inline f32x4 div(f32x4 a, f32x4 b) { return _mm_div_ps(a, b); }
+
+// Returns {a[x], a[y], b[z], b[w]}.
+template <int x, int y, int z, int w>
+inline f32x4 shuffle(f32x4 a, f32x4 b) {
+  return _mm_shuffle_ps(a, b, _MM_SHUFFLE(w, z, y, x));
+}
+
+template <int i>
+inline f32x4 mul_lane(f32x4 a, f32x4 b) {
+  return _mm_mul_ps(a, shuffle<i, i, i, i>(b, b));
+}
+
+// Returns a + b * lane `i` of c.
+template <int i>
+inline f32x4 madd_lane(f32x4 a, f32x4 b, f32x4 c) {
+  return _mm_add_ps(a, mul_lane<i>(b, c));
+}
+
+template <int i>
+inline float lane(f32x4 v) {
+  return _mm_cvtss_f32(shuffle<i, i, i, i>(v, v));
+}
+
+inline f32x4 min(f32x4 a, f32x4 b) { return _mm_min_ps(a, b); }
+
+// Returns a bit mask of the lanes that are >= 0, lane 0 in bit 0.
+inline unsigned nonnegative_mask(f32x4 v) {
+  return _mm_movemask_ps(_mm_cmpge_ps(v, _mm_setzero_ps()));
+}
+
+#endif
+
+// Returns {a[x], a[y], a[z], a[w]}.
+template <int x, int y, int z, int w>
+inline f32x4 swizzle(f32x4 a) {
+  return shuffle<x, y, z, w>(a, a);
+}
+
+// Column-major 4x4 matrix kernels.  All pointers refer to 16 floats, and may
+// be unaligned.
+
+// out = a * b.  `out` may alias either input.
+inline void mat4_multiply(const float* a, const float* b, float* out) {
+#if GEOMETRY_SIMD_AVX
+  // Two result columns per iteration.
+  const auto a0 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a));
+  const auto a1 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a + 4));
+  const auto a2 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a + 8));
+  const auto a3 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a + 12));
+
+  const auto b01 = _mm256_loadu_ps(b);
+  const auto b23 = _mm256_loadu_ps(b + 8);
+
+  auto r01 = _mm256_mul_ps(a0, _mm256_permute_ps(b01, 0x00));
+  r01 = _mm256_add_ps(r01, _mm256_mul_ps(a1, _mm256_permute_ps(b01, 0x55)));
+  r01 = _mm256_add_ps(r01, _mm256_mul_ps(a2, _mm256_permute_ps(b01, 0xaa)));
+  r01 = _mm256_add_ps(r01, _mm256_mul_ps(a3, _mm256_permute_ps(b01, 0xff)));
+
+  auto r23 = _mm256_mul_ps(a0, _mm256_permute_ps(b23, 0x00));
+  r23 = _mm256_add_ps(r23, _mm256_mul_ps(a1, _mm256_permute_ps(b23, 0x55)));
+  r23 = _mm256_add_ps(r23, _mm256_mul_ps(a2, _mm256_permute_ps(b23, 0xaa)));
+  r23 = _mm256_add_ps(r23, _mm256_mul_ps(a3, _mm256_permute_ps(b23, 0xff)));
+
+  _mm256_storeu_ps(out, r01);
+  _mm256_storeu_ps(out + 8, r23);
+#else
+  const auto a0 = load(a);
+  const auto a1 = load(a + 4);
+  const auto a2 = load(a + 8);
+  const auto a3 = load(a + 12);
+
+  f32x4 result[4];
+
+  for (int j = 0; j < 4; ++j) {
+    const auto bj = load(b + 4 * j);
+    auto r = mul_lane<0>(a0, bj);
+    r = madd_lane<1>(r, a1, bj);
+    r = madd_lane<2>(r, a2, bj);
+    r = madd_lane<3>(r, a3, bj);
+    result[j] = r;
+  }
+
+  for (int j = 0; j < 4; ++j) store(out + 4 * j, result[j]);
+#endif
+}
+
+// out = m * v, where v is a column vector of 4 floats.
+inline void mat4_transform(const float* m, const float* v, float* out) {
+  const auto x = load(v);
+  auto r = mul_lane<0>(load(m), x);
+  r = madd_lane<1>(r, load(m + 4), x);
+  r = madd_lane<2>(r, load(m + 8), x);
+  r = madd_lane<3>(r, load(m + 12), x);
+  store(out, r);
+}
+
+// 2x2 matrix helpers for mat4_invert().  A 2x2 matrix | a0 a1 |
+//                                                     | a2 a3 | is stored
+// in one vector.
+
+// a * b
+inline f32x4 mat2_multiply(f32x4 a, f32x4 b) {
+  return add(mul(a, swizzle<0, 3, 0, 3>(b)),
+             mul(swizzle<1, 0, 3, 2>(a), swizzle<2, 1, 2, 1>(b)));
+}
+
+// adj(a) * b
+inline f32x4 mat2_adjugate_multiply(f32x4 a, f32x4 b) {
+  return sub(mul(swizzle<3, 3, 0, 0>(a), b),
+             mul(swizzle<1, 1, 2, 2>(a), swizzle<2, 3, 0, 1>(b)));
+}
+
+// a * adj(b)
+inline f32x4 mat2_multiply_adjugate(f32x4 a, f32x4 b) {
+  return sub(mul(a, swizzle<3, 0, 3, 0>(b)),
+             mul(swizzle<1, 0, 3, 2>(a), swizzle<2, 1, 2, 1>(b)));
+}
+
+// Inverts a 4x4 matrix using 2x2 block matrices and their adjugates.  Since
+// the inverse of the transpose is the transpose of the inverse, columns are
+// treated as rows throughout.  Returns false, leaving `out` untouched, if the
+// determinant is zero, subnormal or not finite.  There is no threshold on
+// pivots as in mat4x4::invert_scalar().
+inline bool mat4_invert(const float* m, float* out) {
+  const auto r0 = load(m);
+  const auto r1 = load(m + 4);
+  const auto r2 = load(m + 8);
+  const auto r3 = load(m + 12);
+
+  // Sub-matrices: | A B |
+  //               | C D |
+  const auto A = shuffle<0, 1, 0, 1>(r0, r1);
+  const auto B = shuffle<2, 3, 2, 3>(r0, r1);
+  const auto C = shuffle<0, 1, 0, 1>(r2, r3);
+  const auto D = shuffle<2, 3, 2, 3>(r2, r3);
+
+  // Determinants of the sub-matrices, as {|A|, |B|, |C|, |D|}.
+  const auto det_sub =
+      sub(mul(shuffle<0, 2, 0, 2>(r0, r2), shuffle<1, 3, 1, 3>(r1, r3)),
+          mul(shuffle<1, 3, 1, 3>(r0, r2), shuffle<0, 2, 0, 2>(r1, r3)));
+  const auto det_a = swizzle<0, 0, 0, 0>(det_sub);
+  const auto det_b = swizzle<1, 1, 1, 1>(det_sub);
+  const auto det_c = swizzle<2, 2, 2, 2>(det_sub);
+  const auto det_d = swizzle<3, 3, 3, 3>(det_sub);
+
+  const auto d_c = mat2_adjugate_multiply(D, C);
+  const auto a_b = mat2_adjugate_multiply(A, B);
+
+  // The inverse is 1/|M| * | X Y |, computed here as adjugates.
+  //                        | Z W |
+  auto x = sub(mul(det_d, A), mat2_multiply(B, d_c));
+  auto w = sub(mul(det_a, D), mat2_multiply(C, a_b));
+  auto y = sub(mul(det_b, C), mat2_multiply_adjugate(D, a_b));
+  auto z = sub(mul(det_c, B), mat2_multiply_adjugate(A, d_c));
+
+  // |M| = |A| |D| + |B| |C| - tr(adj(A) B adj(D) C)
+  auto trace = mul(a_b, swizzle<0, 2, 1, 3>(d_c));
+  trace = add(trace, swizzle<2, 3, 0, 1>(trace));
+  trace = add(trace, swizzle<1, 0, 3, 2>(trace));
+
+  const auto det = sub(add(mul(det_a, det_d), mul(det_b, det_c)), trace);
+  // A zero, subnormal or non-finite determinant has no finite reciprocal.
+  const auto det_scalar = lane<0>(det);
+  const auto det_magnitude = det_scalar < 0.0f ? -det_scalar : det_scalar;
+  if (!(det_magnitude >= FLT_MIN && det_magnitude <= FLT_MAX)) return false;
+
+  const auto rdet = div(set(1.0f, -1.0f, -1.0f, 1.0f), det);
+  x = mul(x, rdet);
+  y = mul(y, rdet);
+  z = mul(z, rdet);
+  w = mul(w, rdet);
+
+  // Undo the adjugates while storing.
+  store(out, shuffle<3, 1, 3, 1>(x, y));
+  store(out + 4, shuffle<2, 0, 2, 0>(x, y));
+  store(out + 8, shuffle<3, 1, 3, 1>(z, w));
+  store(out + 12, shuffle<2, 0, 2, 0>(z, w));
+
+  return true;
+}
+
+}  // namespace simd
+
+#endif  // GEOMETRY_SIMD
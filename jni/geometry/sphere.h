@@ -1,51 +1,124 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <utility>
 #include <vector>
 
 #include "geometry/vector.h"
+#include "utils/arena.h"
+
+// Maps undirected edges, given as pairs of vertex indices, to the index of the
+// vertex at their midpoint.  Uses a flat open addressing table with linear
+// probing, so lookups are O(1) regardless of mesh size.  The table is
+// allocated with `Allocator`.
+template <typename IndexType,
+          typename Allocator = std::allocator<IndexType>>
+class edge_midpoint_cache {
+ public:
+  explicit edge_midpoint_cache(const Allocator& allocator = Allocator())
+      : keys_(allocator), values_(allocator) {}
+
+  // Prepares the table for up to `edge_count` distinct edges.
+  void reset(size_t edge_count) {
+    size_t capacity = 16;
+    while (capacity < edge_count * 2) capacity <<= 1;
+
+    keys_.assign(capacity, kEmpty);
+    values_.resize(capacity);
+    mask_ = capacity - 1;
+  }
+
+  // Looks up the edge (a, b).  Returns true and stores the midpoint index in
+  // `*result` if the edge has been seen before.  Otherwise, `value` is stored
+  // for the edge and false is returned.
+  bool find_or_insert(size_t a, size_t b, IndexType value, IndexType* result) {
+    if (a > b) std::swap(a, b);
+
+    const auto key = (static_cast<uint64_t>(a) << 32) | b;
+    auto slot = hash(key) & mask_;
+
+    for (;;) {
+      if (keys_[slot] == key) {
+        *result = values_[slot];
+        return true;
+      }
+
+      if (keys_[slot] == kEmpty) {
+        keys_[slot] = key;
+        values_[slot] = value;
+        *result = value;
+        return false;
+      }
+
+      slot = (slot + 1) & mask_;
+    }
+  }
+
+ private:
+  static constexpr uint64_t kEmpty = ~uint64_t(0);
+
+  static size_t hash(uint64_t key) {
+    return static_cast<size_t>((key * 0x9e3779b97f4a7c15ULL) >> 32);
+  }
+
+  rebind_vector<uint64_t, Allocator> keys_;
+  rebind_vector<IndexType, Allocator> values_;
+  size_t mask_ = 0;
+};
+
+template <typename IndexType, typename Allocator>
+constexpr uint64_t edge_midpoint_cache<IndexType, Allocator>::kEmpty;
+
+// Returns the number of vertices produced by sphere() at the given quality.
+// Each pass adds one vertex per edge, and an octahedron subdivided `quality`
+// times has 8 * 4^quality faces and 12 * 4^quality edges.
+constexpr size_t sphere_vertex_count(size_t quality) {
+  return 4 * (size_t(1) << (2 * quality)) + 2;
+}
+
+// Returns the number of indices produced by sphere() at the given quality.
+constexpr size_t sphere_index_count(size_t quality) {
+  return 3 * 8 * (size_t(1) << (2 * quality));
+}
 
 // Generates a sphere by repeatedly subdividing an octahedron, at each pass
-// moving vertices out to the unit sphere.
-template <typename IndexType>
-void sphere(const size_t quality, std::vector<vec3>* vertices,
-            std::vector<IndexType>* indices) {
-  // Generate octahedron.
-  vertices->emplace_back(0, 0, 1);
-  vertices->emplace_back(0, 1, 0);
-  vertices->emplace_back(-1, 0, 0);
-  vertices->emplace_back(0, -1, 0);
-  vertices->emplace_back(1, 0, 0);
-  vertices->emplace_back(0, 0, -1);
-
-  indices->emplace_back(0);
-  indices->emplace_back(1);
-  indices->emplace_back(2);
-  indices->emplace_back(0);
-  indices->emplace_back(2);
-  indices->emplace_back(3);
-  indices->emplace_back(0);
-  indices->emplace_back(3);
-  indices->emplace_back(4);
-  indices->emplace_back(0);
-  indices->emplace_back(4);
-  indices->emplace_back(1);
-  indices->emplace_back(1);
-  indices->emplace_back(5);
-  indices->emplace_back(2);
-  indices->emplace_back(2);
-  indices->emplace_back(5);
-  indices->emplace_back(3);
-  indices->emplace_back(3);
-  indices->emplace_back(5);
-  indices->emplace_back(4);
-  indices->emplace_back(4);
-  indices->emplace_back(5);
-  indices->emplace_back(1);
+// moving vertices out to the unit sphere.  `vertices` and `indices` must be
+// empty.  Temporaries are allocated with the allocator of `indices`, so with
+// arena_allocator, repeated calls need no heap allocations.
+template <typename IndexType, typename VertexAllocator,
+          typename IndexAllocator>
+void sphere(const size_t quality, std::vector<vec3, VertexAllocator>* vertices,
+            std::vector<IndexType, IndexAllocator>* indices) {
+  static const vec3 kOctahedronVertices[] = {
+      {0, 0, 1}, {0, 1, 0}, {-1, 0, 0}, {0, -1, 0}, {1, 0, 0}, {0, 0, -1}};
+  static const IndexType kOctahedronIndices[] = {
+      0, 1, 2, 0, 2, 3, 0, 3, 4, 0, 4, 1, 1, 5, 2, 2, 5, 3, 3, 5, 4, 4, 5, 1};
+
+  vertices->reserve(vertices->size() + sphere_vertex_count(quality));
+  indices->reserve(sphere_index_count(quality));
+
+  vertices->insert(vertices->end(), std::begin(kOctahedronVertices),
+                   std::end(kOctahedronVertices));
+  indices->insert(indices->end(), std::begin(kOctahedronIndices),
+                  std::end(kOctahedronIndices));
+
+  if (!quality) return;
+
+  edge_midpoint_cache<IndexType, IndexAllocator> midpoint_cache(
+      indices->get_allocator());
+  std::vector<IndexType, IndexAllocator> new_indices(indices->get_allocator());
+  new_indices.reserve(sphere_index_count(quality));
 
   // Divide all faces into 4 new ones `quality` times.
   for (size_t q = 0; q < quality; ++q) {
-    std::vector<IndexType> new_indices;
+    // Every edge is shared by exactly two faces.
+    midpoint_cache.reset(indices->size() / 2);
+    new_indices.clear();
 
     while (!indices->empty()) {
       size_t points[3];
@@ -57,30 +130,19 @@ void sphere(const size_t quality, std::vector<vec3>* vertices,
       points[0] = indices->back();
       indices->pop_back();
 
-      vec3 midpoints[3];
-
-      midpoints[0] =
-          (((*vertices)[points[0]] + (*vertices)[points[1]]) / 2).normalize();
-      midpoints[1] =
-          (((*vertices)[points[0]] + (*vertices)[points[2]]) / 2).normalize();
-      midpoints[2] =
-          (((*vertices)[points[1]] + (*vertices)[points[2]]) / 2).normalize();
+      static const size_t kEdges[3][2] = {{0, 1}, {0, 2}, {1, 2}};
 
-      size_t midpoint_indices[3];
+      IndexType midpoint_indices[3];
 
       for (size_t i = 0; i < 3; i++) {
-        size_t j;
-
-        for (j = 0; j < vertices->size(); j++) {
-          if ((*vertices)[j] == midpoints[i]) {
-            midpoint_indices[i] = j;
-            break;
-          }
-        }
+        const auto a = points[kEdges[i][0]];
+        const auto b = points[kEdges[i][1]];
 
-        if (j == vertices->size()) {
-          midpoint_indices[i] = vertices->size();
-          vertices->emplace_back(midpoints[i]);
+        if (!midpoint_cache.find_or_insert(
+                a, b, static_cast<IndexType>(vertices->size()),
+                &midpoint_indices[i])) {
+          vertices->emplace_back(
+              (((*vertices)[a] + (*vertices)[b]) / 2).normalize());
         }
       }
 
@@ -101,6 +163,189 @@ void sphere(const size_t quality, std::vector<vec3>* vertices,
       new_indices.emplace_back(points[2]);
     }
 
-    *indices = std::move(new_indices);
+    indices->swap(new_indices);
   }
 }
+
+// Vertex and index tables for a sphere of fixed quality, computed at compile
+// time by constexpr_sphere().
+template <typename IndexType, size_t Quality>
+struct sphere_tables {
+  std::array<vec3, sphere_vertex_count(Quality)> vertices;
+  std::array<IndexType, sphere_index_count(Quality)> indices;
+};
+
+// Scratch space for constexpr_sphere().  std::array cannot be modified in
+// constant expressions before C++17, so plain arrays are used, with the same
+// algorithm as sphere().
+template <typename IndexType, size_t Quality>
+struct constexpr_sphere_builder {
+  static constexpr size_t kVertexCount = sphere_vertex_count(Quality);
+  static constexpr size_t kIndexCount = sphere_index_count(Quality);
+
+  // Open addressing table from edges to midpoints, sized for the last pass
+  // like edge_midpoint_cache.
+  static constexpr size_t table_size() {
+    size_t size = 16;
+    while (size < kIndexCount / 4) size <<= 1;
+    return size;
+  }
+  static constexpr size_t kTableSize = table_size();
+
+  constexpr void build() {
+    constexpr IndexType kOctahedron[24] = {0, 1, 2, 0, 2, 3, 0, 3, 4, 0, 4, 1,
+                                           1, 5, 2, 2, 5, 3, 3, 5, 4, 4, 5, 1};
+
+    vertices[vertex_count++] = vec3(0, 0, 1);
+    vertices[vertex_count++] = vec3(0, 1, 0);
+    vertices[vertex_count++] = vec3(-1, 0, 0);
+    vertices[vertex_count++] = vec3(0, -1, 0);
+    vertices[vertex_count++] = vec3(1, 0, 0);
+    vertices[vertex_count++] = vec3(0, 0, -1);
+
+    for (const auto index : kOctahedron) indices[0][index_count++] = index;
+
+    for (size_t q = 0; q < Quality; ++q) {
+      const auto& src = indices[q & 1];
+      auto& dst = indices[(q + 1) & 1];
+      size_t dst_count = 0;
+
+      for (auto& key : keys) key = ~uint64_t(0);
+
+      while (index_count) {
+        const size_t points[3] = {src[index_count - 3], src[index_count - 2],
+                                  src[index_count - 1]};
+        index_count -= 3;
+
+        const IndexType midpoint_indices[3] = {midpoint(points[0], points[1]),
+                                               midpoint(points[0], points[2]),
+                                               midpoint(points[1], points[2])};
+
+        const IndexType triangles[12] = {
+            IndexType(points[0]), midpoint_indices[0], midpoint_indices[1],
+            midpoint_indices[0],  midpoint_indices[2], midpoint_indices[1],
+            midpoint_indices[0],  IndexType(points[1]), midpoint_indices[2],
+            midpoint_indices[1],  midpoint_indices[2], IndexType(points[2])};
+
+        for (const auto index : triangles) dst[dst_count++] = index;
+      }
+
+      index_count = dst_count;
+    }
+  }
+
+  constexpr IndexType midpoint(size_t a, size_t b) {
+    const auto key = (static_cast<uint64_t>(a < b ? a : b) << 32) |
+                     (a < b ? b : a);
+    auto slot = static_cast<size_t>((key * 0x9e3779b97f4a7c15ULL) >> 32) &
+                (kTableSize - 1);
+
+    while (keys[slot] != ~uint64_t(0)) {
+      if (keys[slot] == key) return values[slot];
+      slot = (slot + 1) & (kTableSize - 1);
+    }
+
+    keys[slot] = key;
+    values[slot] = static_cast<IndexType>(vertex_count);
+    vertices[vertex_count++] =
+        ((vertices[a] + vertices[b]) / 2).constexpr_normalize();
+
+    return values[slot];
+  }
+
+  vec3 vertices[kVertexCount];
+  IndexType indices[2][kIndexCount] = {};
+  size_t vertex_count = 0;
+  size_t index_count = 0;
+
+  uint64_t keys[kTableSize] = {};
+  IndexType values[kTableSize] = {};
+};
+
+template <typename T, size_t N, size_t... I>
+constexpr std::array<T, N> to_std_array(const T (&array)[N],
+                                        std::index_sequence<I...>) {
+  return {{array[I]...}};
+}
+
+// Generates the same mesh as sphere(), at compile time when used to
+// initialize a constexpr variable.  Meant for low qualities only, as compile
+// time and memory grow quickly.
+template <typename IndexType, size_t Quality>
+constexpr sphere_tables<IndexType, Quality> constexpr_sphere() {
+  constexpr_sphere_builder<IndexType, Quality> builder;
+  builder.build();
+
+  return {to_std_array(builder.vertices,
+                       std::make_index_sequence<sphere_vertex_count(Quality)>()),
+          to_std_array(builder.indices[Quality & 1],
+                       std::make_index_sequence<sphere_index_count(Quality)>())};
+}
+
+// Finds the vertices a sphere() vertex was created between: the endpoints of
+// the edge of the next lower quality that it subdivides.  Vertices that exist
+// at the lower quality are returned as their own parents, as are all
+// vertices at quality 0.  The indices must be in the order produced by
+// sphere(), in which the lower quality's vertices come first.
+//
+// A new vertex is adjacent to exactly two older vertices, its parents, so
+// this only needs the index list.  Linear in the number of indices.  Writes
+// sphere_vertex_count(quality) pairs to `result`.
+template <typename IndexType>
+void sphere_parents(size_t quality, const IndexType* indices,
+                    size_t index_count, std::array<IndexType, 2>* result) {
+  const auto vertex_count = sphere_vertex_count(quality);
+  const auto old_count =
+      quality ? sphere_vertex_count(quality - 1) : vertex_count;
+  const auto kUnset = std::numeric_limits<IndexType>::max();
+
+  for (size_t i = 0; i < vertex_count; ++i) {
+    const auto self = static_cast<IndexType>(i);
+    result[i] = (i < old_count) ? std::array<IndexType, 2>{{self, self}}
+                                : std::array<IndexType, 2>{{kUnset, kUnset}};
+  }
+
+  for (size_t i = 0; i < index_count; ++i) {
+    const auto a = indices[i];
+    const auto b = indices[i - i % 3 + (i + 1) % 3];
+    if (a < old_count || b >= old_count) continue;
+
+    auto& parents = result[a];
+    if (parents[0] == kUnset)
+      parents[0] = b;
+    else if (parents[0] != b)
+      parents[1] = b;
+  }
+}
+
+template <typename IndexType>
+std::vector<std::array<IndexType, 2>> sphere_parents(
+    size_t quality, const IndexType* indices, size_t index_count) {
+  std::vector<std::array<IndexType, 2>> result(sphere_vertex_count(quality));
+  sphere_parents(quality, indices, index_count, result.data());
+  return result;
+}
+
+// Like sphere_parents(), but for a single vertex of a constexpr_sphere().
+// Quadratic when used for every vertex, so only for small tables.
+template <typename IndexType, size_t N>
+constexpr std::array<IndexType, 2> constexpr_sphere_parents(
+    size_t quality, const std::array<IndexType, N>& indices, size_t vertex) {
+  const auto self = static_cast<IndexType>(vertex);
+  if (!quality || vertex < sphere_vertex_count(quality - 1))
+    return {{self, self}};
+
+  const auto old_count = sphere_vertex_count(quality - 1);
+  IndexType parents[2] = {self, self};
+  size_t found = 0;
+
+  for (size_t i = 0; i < N && found < 2; ++i) {
+    const auto a = indices[i];
+    const auto b = indices[i - i % 3 + (i + 1) % 3];
+    if (a != vertex || b >= old_count) continue;
+    if (found && parents[0] == b) continue;
+    parents[found++] = b;
+  }
+
+  return {{parents[0], parents[1]}};
+}
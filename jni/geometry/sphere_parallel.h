@@ -0,0 +1,176 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+#include "geometry/sphere.h"
+#include "geometry/vector.h"
+#include "utils/job_system.h"
+
+// A sphere() generator without edge lookups, whose work can be spread over a
+// job_system.  Kept apart from geometry/sphere.h, which has no threading.
+
+// Closed-form numbering of the subdivided octahedron used by
+// analytic_sphere().  Face f has corners (a, b, c) = face(f), and its grid
+// point (i, j), with i + j <= n, lies at a + i/n (b - a) + j/n (c - a).
+//
+// Vertices are numbered by owner: first the 6 corners, then n - 1 for each
+// edge of the octahedron, ordered from its lower corner, then the interior
+// points of each face row by row.  Points on a shared edge thus get the
+// same index from both faces, without any lookup.
+class octahedron_grid {
+ public:
+  // The faces of sphere()'s octahedron, with the same winding.
+  static const size_t* face(size_t f) {
+    static constexpr size_t kFaces[8][3] = {{0, 1, 2}, {0, 2, 3}, {0, 3, 4},
+                                            {0, 4, 1}, {1, 5, 2}, {2, 5, 3},
+                                            {3, 5, 4}, {4, 5, 1}};
+    return kFaces[f];
+  }
+
+  static const size_t* edge(size_t e) {
+    static constexpr size_t kEdges[12][2] = {
+        {0, 1}, {0, 2}, {0, 3}, {0, 4}, {1, 2}, {2, 3},
+        {3, 4}, {1, 4}, {1, 5}, {2, 5}, {3, 5}, {4, 5}};
+    return kEdges[e];
+  }
+
+  explicit octahedron_grid(size_t quality) : n_(size_t(1) << quality) {}
+
+  // Number of subdivisions along each edge.
+  size_t n() const { return n_; }
+
+  // Returns the index of point `k` of `edge`, counted from its lower corner.
+  size_t edge_vertex(size_t e, size_t k) const {
+    if (!k) return edge(e)[0];
+    if (k == n_) return edge(e)[1];
+    return 6 + e * (n_ - 1) + (k - 1);
+  }
+
+  size_t vertex(size_t f, size_t i, size_t j) const {
+    const auto corners = face(f);
+    if (!j) return edge_vertex(corners[0], corners[1], i);
+    if (!i) return edge_vertex(corners[0], corners[2], j);
+    if (i + j == n_) return edge_vertex(corners[1], corners[2], j);
+
+    // Interior rows 1 to n - 2 hold n - 1 - j points each.
+    return 6 + 12 * (n_ - 1) + f * (n_ - 1) * (n_ - 2) / 2 +
+           (j - 1) * (n_ - 1) - (j - 1) * j / 2 + (i - 1);
+  }
+
+  // Index of the first triangle of row `j` of face `f`.  Row j holds n - j
+  // triangles pointing one way and n - j - 1 pointing the other.
+  size_t first_triangle(size_t f, size_t j) const {
+    return f * n_ * n_ + 2 * n_ * j - j * j;
+  }
+
+ private:
+  // Returns the index of the point `k` steps from corner `from` towards
+  // corner `to`.
+  size_t edge_vertex(size_t from, size_t to, size_t k) const {
+    for (size_t e = 0; e < 12; ++e) {
+      if (edge(e)[0] == from && edge(e)[1] == to) return edge_vertex(e, k);
+      if (edge(e)[0] == to && edge(e)[1] == from) return edge_vertex(e, n_ - k);
+    }
+    return 0;
+  }
+
+  size_t n_;
+};
+
+// Generates the same triangles as sphere() with closed-form numbering from
+// octahedron_grid, writing sphere_vertex_count() vertices and
+// sphere_index_count() indices to preallocated buffers.  No edges are looked
+// up, so faces and rows are independent, and are spread over `jobs` if
+// given.  IndexType must hold sphere_vertex_count(quality) - 1.
+//
+// Each midpoint is normalized before the next pass subdivides it further,
+// which has no closed form, so positions are still computed one level at a
+// time.  Every level reads the previous ones only, using the same arithmetic
+// as sphere(), so the results are identical.
+template <typename IndexType>
+void analytic_sphere(size_t quality, vec3* vertices, IndexType* indices,
+                     job_system* jobs = nullptr) {
+  const octahedron_grid grid(quality);
+  const auto n = grid.n();
+
+  auto parallel_for = [jobs](size_t count, size_t grain,
+                             const std::function<void(size_t, size_t)>& f) {
+    if (jobs)
+      jobs->parallel_for(count, grain, f);
+    else if (count)
+      f(0, count);
+  };
+
+  auto midpoint = [vertices](size_t a, size_t b) {
+    return ((vertices[a] + vertices[b]) / 2).normalize();
+  };
+
+  vertices[0] = vec3(0, 0, 1);
+  vertices[1] = vec3(0, 1, 0);
+  vertices[2] = vec3(-1, 0, 0);
+  vertices[3] = vec3(0, -1, 0);
+  vertices[4] = vec3(1, 0, 0);
+  vertices[5] = vec3(0, 0, -1);
+
+  // Edges of the octahedron, bisected level by level.
+  parallel_for(12, 1, [&](size_t begin, size_t end) {
+    for (size_t e = begin; e < end; ++e) {
+      for (size_t step = n; step > 1; step /= 2) {
+        for (size_t k = step / 2; k < n; k += step)
+          vertices[grid.edge_vertex(e, k)] =
+              midpoint(grid.edge_vertex(e, k - step / 2),
+                       grid.edge_vertex(e, k + step / 2));
+      }
+    }
+  });
+
+  // Face interiors.  At each level, the new points sit halfway along the
+  // edges of the previous level's triangles, which run along i, along j, or
+  // diagonally.
+  for (size_t step = n; step > 1; step /= 2) {
+    const auto half = step / 2;
+    const auto rows = n / half - 1;
+    parallel_for(8 * rows, 1, [&](size_t begin, size_t end) {
+      for (size_t item = begin; item < end; ++item) {
+        const auto face = item / rows;
+        const auto j = (item % rows + 1) * half;
+        for (size_t i = half; i + j < n; i += half) {
+          if (!(i % step) && !(j % step)) continue;
+
+          size_t a, b;
+          if (!(j % step)) {
+            a = grid.vertex(face, i - half, j);
+            b = grid.vertex(face, i + half, j);
+          } else if (!(i % step)) {
+            a = grid.vertex(face, i, j - half);
+            b = grid.vertex(face, i, j + half);
+          } else {
+            a = grid.vertex(face, i + half, j - half);
+            b = grid.vertex(face, i - half, j + half);
+          }
+          vertices[grid.vertex(face, i, j)] = midpoint(a, b);
+        }
+      }
+    });
+  }
+
+  // Triangles row by row, alternating between those pointing away from row
+  // j = 0 and those pointing towards it, with the winding of sphere().
+  parallel_for(8 * n, 16, [&](size_t begin, size_t end) {
+    for (size_t item = begin; item < end; ++item) {
+      const auto face = item / n;
+      const auto j = item % n;
+      auto out = indices + 3 * grid.first_triangle(face, j);
+      for (size_t i = 0; i + j < n; ++i) {
+        *out++ = static_cast<IndexType>(grid.vertex(face, i, j));
+        *out++ = static_cast<IndexType>(grid.vertex(face, i + 1, j));
+        *out++ = static_cast<IndexType>(grid.vertex(face, i, j + 1));
+        if (i + j + 1 == n) break;
+        *out++ = static_cast<IndexType>(grid.vertex(face, i + 1, j));
+        *out++ = static_cast<IndexType>(grid.vertex(face, i + 1, j + 1));
+        *out++ = static_cast<IndexType>(grid.vertex(face, i, j + 1));
+      }
+    }
+  });
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "geometry/vector.h"
+
+// A tree of affine transforms, each relative to its parent, with one array
+// per component.  Nodes are numbered in the order they are added, and always
+// come after their parent.
+//
+// set_local() only marks a node dirty.  update() then recomputes the world
+// transforms of the dirty nodes and their descendants, and nothing else, so
+// the cost of a frame follows what moved rather than the size of the tree.
+class transform_hierarchy {
+ public:
+  static constexpr uint32_t kNoParent = ~uint32_t(0);
+
+  void reserve(size_t count) {
+    parents_.reserve(count);
+    first_child_.reserve(count);
+    next_sibling_.reserve(count);
+    local_rotation_.reserve(count);
+    local_translation_.reserve(count);
+    local_scale_.reserve(count);
+    world_rotation_.reserve(count);
+    world_translation_.reserve(count);
+    world_scale_.reserve(count);
+    dirty_.reserve(count);
+    dirty_nodes_.reserve(count);
+  }
+
+  void clear() {
+    parents_.clear();
+    first_child_.clear();
+    next_sibling_.clear();
+    local_rotation_.clear();
+    local_translation_.clear();
+    local_scale_.clear();
+    world_rotation_.clear();
+    world_translation_.clear();
+    world_scale_.clear();
+    dirty_.clear();
+    dirty_nodes_.clear();
+    changed_.clear();
+  }
+
+  size_t size() const { return parents_.size(); }
+
+  // Adds a node below `parent`, which must already exist, and returns its
+  // index.  Its world transform is valid after the next update().
+  uint32_t add(const affine_transform& local, uint32_t parent = kNoParent) {
+    const auto node = static_cast<uint32_t>(size());
+    parents_.push_back(parent);
+    // Copies, since push_back() would need the constant's address.
+    first_child_.push_back(uint32_t(kNoParent));
+    next_sibling_.push_back(uint32_t(kNoParent));
+    if (parent != kNoParent) {
+      next_sibling_[node] = first_child_[parent];
+      first_child_[parent] = node;
+    }
+
+    local_rotation_.push_back(local.rotation);
+    local_translation_.push_back(local.translation);
+    local_scale_.push_back(local.scale);
+    world_rotation_.push_back(local.rotation);
+    world_translation_.push_back(local.translation);
+    world_scale_.push_back(local.scale);
+
+    dirty_.push_back(false);
+    mark_dirty(node);
+    return node;
+  }
+
+  uint32_t parent(uint32_t node) const { return parents_[node]; }
+
+  affine_transform local(uint32_t node) const {
+    return {local_rotation_[node], local_translation_[node],
+            local_scale_[node]};
+  }
+
+  void set_local(uint32_t node, const affine_transform& local) {
+    local_rotation_[node] = local.rotation;
+    local_translation_[node] = local.translation;
+    local_scale_[node] = local.scale;
+    mark_dirty(node);
+  }
+
+  // The transform from the node to the root's parent space, as of the last
+  // update().
+  affine_transform world(uint32_t node) const {
+    return {world_rotation_[node], world_translation_[node],
+            world_scale_[node]};
+  }
+
+  // Recomputes the world transforms of the dirty nodes and everything below
+  // them, and returns the recomputed nodes, each once, parents first within
+  // each subtree.  Does not allocate once the buffers have grown.
+  const std::vector<uint32_t>& update() {
+    changed_.clear();
+
+    // Parents have lower indices, so sorting visits a dirty node before any
+    // dirty descendant, which its subtree then covers.
+    std::sort(dirty_nodes_.begin(), dirty_nodes_.end());
+    for (const auto root : dirty_nodes_) {
+      if (!dirty_[root]) continue;
+
+      stack_.push_back(root);
+      while (!stack_.empty()) {
+        const auto node = stack_.back();
+        stack_.pop_back();
+
+        dirty_[node] = false;
+        update_world(node);
+        changed_.push_back(node);
+
+        for (auto child = first_child_[node]; child != kNoParent;
+             child = next_sibling_[child])
+          stack_.push_back(child);
+      }
+    }
+    dirty_nodes_.clear();
+
+    return changed_;
+  }
+
+ private:
+  void mark_dirty(uint32_t node) {
+    if (dirty_[node]) return;
+    dirty_[node] = true;
+    dirty_nodes_.push_back(node);
+  }
+
+  // Same arithmetic as affine_transform::operator*.
+  void update_world(uint32_t node) {
+    const auto parent = parents_[node];
+    if (parent == kNoParent) {
+      world_rotation_[node] = local_rotation_[node];
+      world_translation_[node] = local_translation_[node];
+      world_scale_[node] = local_scale_[node];
+      return;
+    }
+
+    const auto& rotation = world_rotation_[parent];
+    world_rotation_[node] = rotation.quat_multiply(local_rotation_[node]);
+    world_translation_[node] =
+        rotation.quat_rotate(local_translation_[node] * world_scale_[parent]) +
+        world_translation_[parent];
+    world_scale_[node] = world_scale_[parent] * local_scale_[node];
+  }
+
+  // The tree, with children as linked lists.
+  std::vector<uint32_t> parents_;
+  std::vector<uint32_t> first_child_;
+  std::vector<uint32_t> next_sibling_;
+
+  std::vector<vec4> local_rotation_;
+  std::vector<vec3> local_translation_;
+  std::vector<float> local_scale_;
+  std::vector<vec4> world_rotation_;
+  std::vector<vec3> world_translation_;
+  std::vector<float> world_scale_;
+
+  // Nodes set since the last update(), each listed once.
+  std::vector<uint8_t> dirty_;
+  std::vector<uint32_t> dirty_nodes_;
+
+  std::vector<uint32_t> changed_;
+  std::vector<uint32_t> stack_;
+};
@@ -8,15 +8,33 @@
 #include <sstream>
 #include <string>
 
+#include "geometry/simd.h"
+
+// Square root usable in constant expressions, by Newton's method in double
+// precision.  Correctly rounded like std::sqrt, which `make sphere-check`
+// verifies for all floats from 1/16 to 16.  Use std::sqrt at runtime.
+constexpr float constexpr_sqrt(float v) {
+  if (!(v > 0.0f)) return 0.0f;
+
+  double x = v > 1.0f ? v : 1.0;
+  for (int i = 0; i < 64; ++i) {
+    const double next = 0.5 * (x + v / x);
+    if (next >= x) break;
+    x = next;
+  }
+
+  return static_cast<float>(x);
+}
+
 class vec3 {
  public:
-  vec3(float x, float y, float z) : x(x), y(y), z(z) {}
+  constexpr vec3(float x, float y, float z) : x(x), y(y), z(z) {}
 
   vec3() = default;
   vec3(const vec3&) = default;
   vec3& operator=(const vec3&) = default;
 
-  bool operator==(const vec3& rhs) const {
+  constexpr bool operator==(const vec3& rhs) const {
     return x == rhs.x && y == rhs.y && z == rhs.z;
   }
 
@@ -24,30 +42,40 @@ class vec3 {
 
   float magnitude() const { return std::sqrt(squared_magnitude()); }
 
-  float squared_magnitude() const { return x * x + y * y + z * z; }
+  // Variants of normalize() and magnitude() for constant expressions, with
+  // the same results.  Slower at runtime.
+  constexpr vec3 constexpr_normalize() const {
+    return *this / constexpr_magnitude();
+  }
+
+  constexpr float constexpr_magnitude() const {
+    return constexpr_sqrt(squared_magnitude());
+  }
 
-  vec3 operator*(float v) const { return vec3(x * v, y * v, z * v); }
+  constexpr float squared_magnitude() const { return x * x + y * y + z * z; }
 
-  vec3 operator/(float v) const { return *this * (1.0f / v); }
+  constexpr vec3 operator*(float v) const { return vec3(x * v, y * v, z * v); }
 
-  float operator*(const vec3& rhs) const {
+  constexpr vec3 operator/(float v) const { return *this * (1.0f / v); }
+
+  constexpr float operator*(const vec3& rhs) const {
     return x * rhs.x + y * rhs.y + z * rhs.z;
   }
 
-  vec3 operator+(const vec3& rhs) const {
+  constexpr vec3 operator+(const vec3& rhs) const {
     return vec3(x + rhs.x, y + rhs.y, z + rhs.z);
   }
 
-  vec3 operator-(const vec3& rhs) const {
+  constexpr vec3 operator-(const vec3& rhs) const {
     return vec3(x - rhs.x, y - rhs.y, z - rhs.z);
   }
 
-  vec3 cross(const vec3& rhs) const {
+  constexpr vec3 cross(const vec3& rhs) const {
     return vec3(y * rhs.z - z * rhs.y, z * rhs.x - x * rhs.z,
                 x * rhs.y - y * rhs.x);
   }
 
-  vec3& operator+=(const vec3& rhs) {
+  constexpr vec3& operator+=(const vec3& rhs) {
     x += rhs.x;
     y += rhs.y;
     z += rhs.z;
@@ -55,7 +83,7 @@ class vec3 {
     return *this;
   }
 
-  vec3& operator*=(float v) {
+  constexpr vec3& operator*=(float v) {
     x *= v;
     y *= v;
     z *= v;
@@ -63,7 +91,7 @@ class vec3 {
     return *this;
   }
 
-  float get(size_t idx) const {
+  constexpr float get(size_t idx) const {
     switch (idx) {
       case 0:
         return x;
@@ -83,7 +111,8 @@ class vec3 {
 
 class vec4 {
   public:
-  vec4(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) {}
+  constexpr vec4(float x, float y, float z, float w)
+      : x(x), y(y), z(z), w(w) {}
 
   vec4() = default;
 
@@ -94,25 +123,37 @@ class vec4 {
 
   float magnitude() const { return std::sqrt(squared_magnitude()); }
 
-  float squared_magnitude() const { return x * x + y * y + z * z + w * w; }
+  constexpr vec4 constexpr_normalize() const {
+    return *this / constexpr_magnitude();
+  }
+
+  constexpr float constexpr_magnitude() const {
+    return constexpr_sqrt(squared_magnitude());
+  }
 
-  vec4 operator*(float v) const { return vec4(x * v, y * v, z * v, w * v); }
+  constexpr float squared_magnitude() const {
+    return x * x + y * y + z * z + w * w;
+  }
 
-  vec4 operator/(float v) const { return *this * (1.0f / v); }
+  constexpr vec4 operator*(float v) const {
+    return vec4(x * v, y * v, z * v, w * v);
+  }
 
-  float operator*(const vec4& rhs) const {
+  constexpr vec4 operator/(float v) const { return *this * (1.0f / v); }
+
+  constexpr float operator*(const vec4& rhs) const {
     return x * rhs.x + y * rhs.y + z * rhs.z + w * rhs.w;
   }
 
-  vec4 operator+(const vec4& rhs) const {
+  constexpr vec4 operator+(const vec4& rhs) const {
     return vec4(x + rhs.x, y + rhs.y, z + rhs.z, w + rhs.w);
   }
 
-  vec4 operator-(const vec4& rhs) const {
+  constexpr vec4 operator-(const vec4& rhs) const {
     return vec4(x - rhs.x, y - rhs.y, z - rhs.z, w - rhs.w);
   }
 
-  vec4& operator+=(const vec4& rhs) {
+  constexpr vec4& operator+=(const vec4& rhs) {
     x += rhs.x;
     y += rhs.y;
     z += rhs.z;
@@ -121,7 +162,7 @@ class vec4 {
     return *this;
   }
 
-  vec4& operator*=(float v) {
+  constexpr vec4& operator*=(float v) {
     x *= v;
     y *= v;
     z *= v;
@@ -151,8 +192,33 @@ class vec4 {
     return result;
   }
 
-  float& operator[](size_t idx) { return a[idx]; }
-  const float& operator[](size_t idx) const { return a[idx]; }
+  // Returns the Hamilton product of two quaternions, which is the rotation
+  // `rhs` followed by this rotation.
+  constexpr vec4 quat_multiply(const vec4& rhs) const {
+    return {w * rhs.x + x * rhs.w + y * rhs.z - z * rhs.y,
+            w * rhs.y - x * rhs.z + y * rhs.w + z * rhs.x,
+            w * rhs.z + x * rhs.y - y * rhs.x + z * rhs.w,
+            w * rhs.w - x * rhs.x - y * rhs.y - z * rhs.z};
+  }
+
+  // Returns the inverse of a unit quaternion.
+  constexpr vec4 quat_conjugate() const { return {-x, -y, -z, w}; }
+
+  // Rotates `v` by this unit quaternion.
+  constexpr vec3 quat_rotate(const vec3& v) const {
+    const vec3 u(x, y, z);
+    const auto t = u.cross(v) * 2.0f;
+    return v + t * w + u.cross(t);
+  }
+
+  // Only the named members are accessed, since reading the other member of
+  // the union is not allowed in constant expressions.
+  constexpr float& operator[](size_t idx) {
+    return idx == 0 ? x : idx == 1 ? y : idx == 2 ? z : w;
+  }
+  constexpr const float& operator[](size_t idx) const {
+    return idx == 0 ? x : idx == 1 ? y : idx == 2 ? z : w;
+  }
 
   union {
     struct {
@@ -166,7 +232,12 @@ union mat4x4 {
   public:
   mat4x4() = default;
 
-  static mat4x4 from_quat(const vec4& quat) {
+  // Constructs a matrix from its columns.
+  constexpr mat4x4(const vec4& c0, const vec4& c1, const vec4& c2,
+                   const vec4& c3)
+      : m{c0, c1, c2, c3} {}
+
+  static constexpr mat4x4 from_quat(const vec4& quat) {
     const auto xx = 2.0f * quat.x * quat.x;
     const auto xy = 2.0f * quat.x * quat.y;
     const auto xz = 2.0f * quat.x * quat.z;
@@ -177,31 +248,10 @@ union mat4x4 {
     const auto zz = 2.0f * quat.z * quat.z;
     const auto zw = 2.0f * quat.z * quat.w;
 
-    mat4x4 result;
-
-    result.m[0][0] = 1.0f - yy - zz;
-    result.m[1][0] = xy - zw;
-    result.m[2][0] = xz + yw;
-
-    result.m[0][1] = xy + zw;
-    result.m[1][1] = 1.0f - xx - zz;
-    result.m[2][1] = yz - xw;
-
-    result.m[0][2] = xz - yw;
-    result.m[1][2] = yz + xw;
-    result.m[2][2] = 1.0f - xx - yy;
-
-    result.m[3][0] = 0.0f;
-    result.m[3][1] = 0.0f;
-    result.m[3][2] = 0.0f;
-
-    result.m[0][3] = 0.0f;
-    result.m[1][3] = 0.0f;
-    result.m[2][3] = 0.0f;
-
-    result.m[3][3] = 1.0f;
-
-    return result;
+    return {vec4{1.0f - yy - zz, xy + zw, xz - yw, 0.0f},
+            vec4{xy - zw, 1.0f - xx - zz, yz + xw, 0.0f},
+            vec4{xz + yw, yz - xw, 1.0f - xx - yy, 0.0f},
+            vec4{0.0f, 0.0f, 0.0f, 1.0f}};
   }
 
   static mat4x4 projection(float znear, float fovx, float aspect) {
@@ -234,7 +284,7 @@ union mat4x4 {
     return result;
   }
 
-  static mat4x4 translation(float x, float y, float z) {
+  static constexpr mat4x4 translation(float x, float y, float z) {
     mat4x4 result = identity();
     result.m[3][0] = x;
     result.m[3][1] = y;
@@ -242,29 +292,23 @@ union mat4x4 {
     return result;
   }
 
-  static mat4x4 identity() {
-    mat4x4 result;
-    result.m[0] = vec4{1.0f, 0.0f, 0.0f, 0.0f};
-    result.m[1] = vec4{0.0f, 1.0f, 0.0f, 0.0f};
-    result.m[2] = vec4{0.0f, 0.0f, 1.0f, 0.0f};
-    result.m[3] = vec4{0.0f, 0.0f, 0.0f, 1.0f};
-    return result;
+  static constexpr mat4x4 identity() {
+    return {vec4{1.0f, 0.0f, 0.0f, 0.0f}, vec4{0.0f, 1.0f, 0.0f, 0.0f},
+            vec4{0.0f, 0.0f, 1.0f, 0.0f}, vec4{0.0f, 0.0f, 0.0f, 1.0f}};
   }
 
-  static mat4x4 zero() {
-    mat4x4 result;
-    result.m[0] = vec4{0.0f, 0.0f, 0.0f, 0.0f};
-    result.m[1] = vec4{0.0f, 0.0f, 0.0f, 0.0f};
-    result.m[2] = vec4{0.0f, 0.0f, 0.0f, 0.0f};
-    result.m[3] = vec4{0.0f, 0.0f, 0.0f, 0.0f};
-    return result;
+  static constexpr mat4x4 zero() {
+    return {vec4{0.0f, 0.0f, 0.0f, 0.0f}, vec4{0.0f, 0.0f, 0.0f, 0.0f},
+            vec4{0.0f, 0.0f, 0.0f, 0.0f}, vec4{0.0f, 0.0f, 0.0f, 0.0f}};
   }
 
-  vec4 row(size_t i) const { return {m[0][i], m[1][i], m[2][i], m[3][i]}; }
+  constexpr vec4 row(size_t i) const {
+    return {m[0][i], m[1][i], m[2][i], m[3][i]};
+  }
 
-  const vec4& column(size_t i) const { return m[i]; }
+  constexpr const vec4& column(size_t i) const { return m[i]; }
 
-  bool operator==(const mat4x4& rhs) const {
+  constexpr bool operator==(const mat4x4& rhs) const {
     for (size_t i = 0; i < 4; ++i) {
       for (size_t j = 0; j < 4; ++j) {
         if (m[i][j] != rhs.m[i][j]) return false;
@@ -273,19 +317,29 @@ union mat4x4 {
     return true;
   }
 
-  mat4x4 operator-(const mat4x4& rhs) const {
-    mat4x4 result;
-
-    for (size_t i = 0; i < 4; ++i) result.m[i] = m[i] - rhs.m[i];
-
-    return result;
+  constexpr mat4x4 operator-(const mat4x4& rhs) const {
+    return {m[0] - rhs.m[0], m[1] - rhs.m[1], m[2] - rhs.m[2],
+            m[3] - rhs.m[3]};
   }
 
+  // The SIMD kernels cannot run in constant expressions; use the _scalar
+  // variants there.
   mat4x4 operator*(const mat4x4& rhs) const {
+#if GEOMETRY_SIMD
     mat4x4 result;
+    simd::mat4_multiply(&m[0][0], &rhs.m[0][0], &result.m[0][0]);
+    return result;
+#else
+    return multiply_scalar(rhs);
+#endif
+  }
+
+  // Reference implementation of operator*(const mat4x4&).
+  constexpr mat4x4 multiply_scalar(const mat4x4& rhs) const {
+    auto result = zero();
 
     for (size_t i = 0; i < 4; ++i) {
-      const auto& r = row(i);
+      const auto r = row(i);
       for (size_t j = 0; j < 4; ++j) {
         result.m[j][i] = r * rhs.column(j);
       }
@@ -300,6 +354,17 @@ union mat4x4 {
   }
 
   vec4 operator*(const vec4& rhs) const {
+#if GEOMETRY_SIMD
+    vec4 result;
+    simd::mat4_transform(&m[0][0], &rhs[0], &result[0]);
+    return result;
+#else
+    return transform_scalar(rhs);
+#endif
+  }
+
+  // Reference implementation of operator*(const vec4&).
+  constexpr vec4 transform_scalar(const vec4& rhs) const {
     return {rhs[0] * m[0][0] + rhs[1] * m[1][0] + rhs[2] * m[2][0] +
                 rhs[3] * m[3][0],
             rhs[0] * m[0][1] + rhs[1] * m[1][1] + rhs[2] * m[2][1] +
@@ -310,27 +375,51 @@ union mat4x4 {
                 rhs[3] * m[3][3]};
   }
 
-  // Returns an inverted matrix, using Gauss-Jordan elimination.
+  // Returns an inverted matrix, or a zero matrix if this matrix is singular.
+  //
+  // The SIMD path only treats a matrix as singular if its determinant is
+  // zero, subnormal or not finite.  invert_scalar() instead gives up on any
+  // pivot below 1e-6, so it also rejects uniformly small matrices, which the
+  // SIMD path inverts.  For matrices that are singular up to rounding, the
+  // SIMD path may return huge elements rather than zero, or the other way
+  // around.  Otherwise, the two differ by about 1e-6 times the condition
+  // number, relative to the largest element; `make simd-check` checks this.
   mat4x4 invert() const {
+#if GEOMETRY_SIMD
+    mat4x4 result;
+    if (!simd::mat4_invert(&m[0][0], &result.m[0][0])) return zero();
+    return result;
+#else
+    return invert_scalar();
+#endif
+  }
+
+  // Reference implementation of invert(), using Gauss-Jordan elimination.
+  constexpr mat4x4 invert_scalar() const {
     mat4x4 src = *this;
     auto result = identity();
 
     for (size_t i = 0; i < 4; ++i) {
       // Select column with largest element as pivot column.
-      auto max = std::fabs(src.m[i][i]);
+      auto max = abs(src.m[i][i]);
       auto max_idx = i;
 
       for (size_t j = i + 1; j < 4; ++j) {
-        if (std::fabs(src.m[j][i]) > max) {
-          max = std::fabs(src.m[j][i]);
+        if (abs(src.m[j][i]) > max) {
+          max = abs(src.m[j][i]);
           max_idx = j;
         }
       }
 
       // Swap pivot column into the `i' position.
       if (max_idx != i) {
-        std::swap(src.m[i], src.m[max_idx]);
-        std::swap(result.m[i], result.m[max_idx]);
+        const auto src_column = src.m[i];
+        src.m[i] = src.m[max_idx];
+        src.m[max_idx] = src_column;
+
+        const auto result_column = result.m[i];
+        result.m[i] = result.m[max_idx];
+        result.m[max_idx] = result_column;
       }
 
       // Everything below and including the diagonal is zero, no chance of
@@ -357,6 +446,9 @@ union mat4x4 {
     return result;
   }
 
+  // std::fabs is not constexpr.
+  static constexpr float abs(float v) { return v < 0.0f ? -v : v; }
+
   float norm(float order) {
     float result = 0.0f;
     for (size_t i = 0; i < 4; ++i) {
@@ -368,7 +460,7 @@ union mat4x4 {
     return std::pow(result, 1.0f / order);
   }
 
-  mat4x4& translate(float x, float y, float z) {
+  constexpr mat4x4& translate(float x, float y, float z) {
     for (size_t i = 0; i < 4; ++i) {
       m[i][0] += m[i][3] * x;
       m[i][1] += m[i][3] * y;
@@ -377,13 +469,112 @@ union mat4x4 {
     return *this;
   }
 
-  // Array of columns, as in OpenGL.
+  // Array of columns, as in OpenGL.  Constant expressions may only use this
+  // member.
   vec4 m[4];
 
   // Array of scalar.
   float v[4][4];
 };
 
+// A rotation followed by a translation.  Composes and inverts in closed form,
+// without going through 4x4 matrices.
+class rigid_transform {
+ public:
+  rigid_transform() = default;
+
+  constexpr rigid_transform(const vec4& rotation, const vec3& translation)
+      : rotation(rotation), translation(translation) {}
+
+  static constexpr rigid_transform from_rotation(const vec4& quat) {
+    return {quat, vec3()};
+  }
+
+  static constexpr rigid_transform from_translation(float x, float y, float z) {
+    return {vec4(0.0f, 0.0f, 0.0f, 1.0f), vec3(x, y, z)};
+  }
+
+  // Returns the transform that applies `rhs` first, then this one, like the
+  // product of the corresponding matrices.
+  constexpr rigid_transform operator*(const rigid_transform& rhs) const {
+    return {rotation.quat_multiply(rhs.rotation),
+            rotation.quat_rotate(rhs.translation) + translation};
+  }
+
+  constexpr vec3 operator*(const vec3& point) const {
+    return rotation.quat_rotate(point) + translation;
+  }
+
+  // The inverse rotation is the conjugate, and the inverse translation is the
+  // negated translation rotated back.
+  constexpr rigid_transform invert() const {
+    const auto inverse_rotation = rotation.quat_conjugate();
+    return {inverse_rotation,
+            inverse_rotation.quat_rotate(translation) * -1.0f};
+  }
+
+  constexpr mat4x4 to_mat4x4() const {
+    auto result = mat4x4::from_quat(rotation);
+    result.m[3] = vec4(translation.x, translation.y, translation.z, 1.0f);
+    return result;
+  }
+
+  // Unit quaternion.
+  vec4 rotation{0.0f, 0.0f, 0.0f, 1.0f};
+  vec3 translation;
+};
+
+// A uniform scale, followed by a rotation and a translation.  Non-uniform
+// scale is left out, since it does not stay separable from the rotation under
+// composition.
+class affine_transform {
+ public:
+  affine_transform() = default;
+
+  constexpr affine_transform(const vec4& rotation, const vec3& translation,
+                             float scale)
+      : rotation(rotation), translation(translation), scale(scale) {}
+
+  constexpr affine_transform(const rigid_transform& rhs)
+      : rotation(rhs.rotation), translation(rhs.translation) {}
+
+  static constexpr affine_transform from_scale(float scale) {
+    return {vec4(0.0f, 0.0f, 0.0f, 1.0f), vec3(), scale};
+  }
+
+  constexpr affine_transform operator*(const affine_transform& rhs) const {
+    return {rotation.quat_multiply(rhs.rotation),
+            rotation.quat_rotate(rhs.translation * scale) + translation,
+            scale * rhs.scale};
+  }
+
+  constexpr vec3 operator*(const vec3& point) const {
+    return rotation.quat_rotate(point * scale) + translation;
+  }
+
+  constexpr affine_transform invert() const {
+    const auto inverse_rotation = rotation.quat_conjugate();
+    const auto inverse_scale = 1.0f / scale;
+    return {inverse_rotation,
+            inverse_rotation.quat_rotate(translation) * -inverse_scale,
+            inverse_scale};
+  }
+
+  constexpr mat4x4 to_mat4x4() const {
+    auto result = mat4x4::from_quat(rotation);
+    result.m[0] *= scale;
+    result.m[1] *= scale;
+    result.m[2] *= scale;
+    result.m[3] = vec4(translation.x, translation.y, translation.z, 1.0f);
+    return result;
+  }
+
+  // Unit quaternion.
+  vec4 rotation{0.0f, 0.0f, 0.0f, 1.0f};
+  vec3 translation;
+  float scale = 1.0f;
+};
+
 inline std::ostream& operator<<(std::ostream& out, const vec4& m) {
   out << '[';
   for (size_t i = 0; i < 4; ++i) out << ' ' << m[i];
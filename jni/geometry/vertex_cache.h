@@ -0,0 +1,229 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "utils/arena.h"
+
+// Post-transform vertex cache optimization.  Triangles are reordered with Tom
+// Forsyth's "Linear-Speed Vertex Cache Optimisation", which greedily emits
+// the triangle whose vertices are most likely to still be in an LRU cache,
+// favoring vertices with few remaining triangles.  Vertices are then
+// renumbered in order of first use, for fetch locality.
+
+constexpr size_t kVertexCacheSize = 32;
+
+// Returns the Forsyth score of a vertex at LRU cache position `cache_position`
+// (-1 if not cached), with `remaining` triangles left to emit.
+inline float vertex_cache_score(int cache_position, size_t remaining) {
+  if (!remaining) return -1.0f;
+
+  float score = 0.0f;
+  if (cache_position >= 0) {
+    // The last triangle's vertices get a fixed score, so that strips are not
+    // preferred over fans.
+    if (cache_position < 3) {
+      score = 0.75f;
+    } else {
+      const auto scale = 1.0f / (kVertexCacheSize - 3);
+      score = std::pow(1.0f - (cache_position - 3) * scale, 1.5f);
+    }
+  }
+
+  // Boost vertices with few triangles left, to avoid leaving lone triangles
+  // behind.
+  return score + 2.0f / std::sqrt(static_cast<float>(remaining));
+}
+
+// Reorders the triangles in `indices` for the post-transform vertex cache.
+// Temporaries are allocated with `scratch`.
+template <typename IndexType, typename Allocator = std::allocator<uint32_t>>
+void optimize_vertex_cache(IndexType* indices, size_t index_count,
+                           size_t vertex_count,
+                           const Allocator& scratch = Allocator()) {
+  const auto triangle_count = index_count / 3;
+  if (!triangle_count) return;
+
+  // Triangles using each vertex, as ranges into `adjacency`.  Emitted
+  // triangles are swapped to the end of each range.
+  rebind_vector<uint32_t, Allocator> remaining(vertex_count, 0, scratch);
+  for (size_t i = 0; i < index_count; ++i) ++remaining[indices[i]];
+
+  rebind_vector<uint32_t, Allocator> offsets(vertex_count + 1, 0, scratch);
+  for (size_t v = 0; v < vertex_count; ++v)
+    offsets[v + 1] = offsets[v] + remaining[v];
+
+  rebind_vector<uint32_t, Allocator> adjacency(index_count, scratch);
+  {
+    rebind_vector<uint32_t, Allocator> fill(offsets.begin(), offsets.end() - 1,
+                                            scratch);
+    for (size_t i = 0; i < index_count; ++i)
+      adjacency[fill[indices[i]]++] = i / 3;
+  }
+
+  rebind_vector<int, Allocator> cache_position(vertex_count, -1, scratch);
+  rebind_vector<float, Allocator> vertex_score(vertex_count, scratch);
+  for (size_t v = 0; v < vertex_count; ++v)
+    vertex_score[v] = vertex_cache_score(-1, remaining[v]);
+
+  rebind_vector<float, Allocator> triangle_score(triangle_count, scratch);
+  for (size_t t = 0; t < triangle_count; ++t) {
+    triangle_score[t] = vertex_score[indices[t * 3]] +
+                        vertex_score[indices[t * 3 + 1]] +
+                        vertex_score[indices[t * 3 + 2]];
+  }
+
+  rebind_vector<bool, Allocator> emitted(triangle_count, false, scratch);
+  rebind_vector<IndexType, Allocator> output(scratch);
+  output.reserve(index_count);
+
+  rebind_vector<uint32_t, Allocator> cache(scratch), new_cache(scratch);
+  cache.reserve(kVertexCacheSize + 3);
+  new_cache.reserve(kVertexCacheSize + 3);
+
+  auto best = std::max_element(triangle_score.begin(), triangle_score.end()) -
+              triangle_score.begin();
+  size_t cursor = 0;
+
+  for (size_t n = 0; n < triangle_count; ++n) {
+    if (best < 0) {
+      // Dead end; continue with the next triangle in input order.
+      while (emitted[cursor]) ++cursor;
+      best = cursor;
+    }
+
+    emitted[best] = true;
+
+    const uint32_t tri[3] = {indices[best * 3], indices[best * 3 + 1],
+                             indices[best * 3 + 2]};
+    output.insert(output.end(), tri, tri + 3);
+
+    for (const auto v : tri) {
+      auto begin = &adjacency[offsets[v]];
+      auto end = begin + remaining[v];
+      std::swap(*std::find(begin, end, static_cast<uint32_t>(best)), end[-1]);
+      --remaining[v];
+    }
+
+    // Move the triangle's vertices to the front of the LRU cache.
+    new_cache.assign(tri, tri + 3);
+    for (const auto v : cache) {
+      if (v != tri[0] && v != tri[1] && v != tri[2]) new_cache.push_back(v);
+    }
+
+    for (size_t i = 0; i < new_cache.size(); ++i) {
+      const auto v = new_cache[i];
+      cache_position[v] = (i < kVertexCacheSize) ? static_cast<int>(i) : -1;
+
+      const auto score = vertex_cache_score(cache_position[v], remaining[v]);
+      const auto delta = score - vertex_score[v];
+      vertex_score[v] = score;
+
+      for (size_t j = 0; j < remaining[v]; ++j)
+        triangle_score[adjacency[offsets[v] + j]] += delta;
+    }
+
+    if (new_cache.size() > kVertexCacheSize)
+      new_cache.resize(kVertexCacheSize);
+    cache.swap(new_cache);
+
+    // The next triangle is the best one touching the cache.
+    best = -1;
+    float best_score = -1.0f;
+    for (const auto v : cache) {
+      for (size_t j = 0; j < remaining[v]; ++j) {
+        const auto t = adjacency[offsets[v] + j];
+        if (triangle_score[t] > best_score) {
+          best_score = triangle_score[t];
+          best = t;
+        }
+      }
+    }
+  }
+
+  std::copy(output.begin(), output.end(), indices);
+}
+
+// Renumbers vertices in the order they are first referenced by `indices`,
+// so that vertex fetches move linearly through memory.  Unreferenced vertices
+// are dropped.  Temporaries are allocated with `scratch`, and `vertices`
+// keeps its storage.
+template <typename Vertex, typename VertexAllocator, typename IndexType,
+          typename Allocator = std::allocator<uint32_t>>
+void optimize_vertex_fetch(std::vector<Vertex, VertexAllocator>* vertices,
+                           IndexType* indices, size_t index_count,
+                           const Allocator& scratch = Allocator()) {
+  const IndexType kUnused = ~IndexType(0);
+
+  rebind_vector<IndexType, Allocator> remap(vertices->size(), kUnused,
+                                            scratch);
+  rebind_vector<Vertex, Allocator> result(scratch);
+  result.reserve(vertices->size());
+
+  for (size_t i = 0; i < index_count; ++i) {
+    auto& index = indices[i];
+    if (remap[index] == kUnused) {
+      remap[index] = static_cast<IndexType>(result.size());
+      result.push_back((*vertices)[index]);
+    }
+    index = remap[index];
+  }
+
+  vertices->assign(result.begin(), result.end());
+}
+
+// Applies both optimizations above.
+template <typename Vertex, typename VertexAllocator, typename IndexType,
+          typename IndexAllocator,
+          typename Allocator = std::allocator<uint32_t>>
+void optimize_mesh(std::vector<Vertex, VertexAllocator>* vertices,
+                   std::vector<IndexType, IndexAllocator>* indices,
+                   const Allocator& scratch = Allocator()) {
+  optimize_vertex_cache(indices->data(), indices->size(), vertices->size(),
+                        scratch);
+  optimize_vertex_fetch(vertices, indices->data(), indices->size(), scratch);
+}
+
+// Simulates a FIFO post-transform cache of `cache_size` entries, as found in
+// most mobile GPUs, and returns the number of vertex shader invocations.
+template <typename IndexType>
+size_t vertex_cache_misses(const IndexType* indices, size_t index_count,
+                           size_t vertex_count, size_t cache_size) {
+  // Time stamps of when each vertex entered the cache.
+  std::vector<size_t> entered(vertex_count, 0);
+  size_t misses = 0;
+
+  for (size_t i = 0; i < index_count; ++i) {
+    const auto v = indices[i];
+    if (entered[v] && misses + 1 - entered[v] <= cache_size) continue;
+    ++misses;
+    entered[v] = misses;
+  }
+
+  return misses;
+}
+
+// Average cache miss ratio: vertex shader invocations per triangle.  0.5 is
+// the ideal for large regular meshes, 3 the worst case.
+template <typename IndexType>
+float acmr(const IndexType* indices, size_t index_count, size_t vertex_count,
+           size_t cache_size) {
+  if (!index_count) return 0.0f;
+  return static_cast<float>(vertex_cache_misses(indices, index_count,
+                                                vertex_count, cache_size)) /
+         (index_count / 3);
+}
+
+// Average transformed vertex ratio: vertex shader invocations per vertex.
+// 1 is the ideal.
+template <typename IndexType>
+float atvr(const IndexType* indices, size_t index_count, size_t vertex_count,
+           size_t cache_size) {
+  if (!vertex_count) return 0.0f;
+  return static_cast<float>(vertex_cache_misses(indices, index_count,
+                                                vertex_count, cache_size)) /
+         vertex_count;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include "utils/log.h"
+
+// Frame level support for the UTILS_GL_CHECK() modes in utils/log.h.
+
+// Checks every call until the end of the current frame.  Used around setup
+// code, which runs once and so cannot be narrowed down by a repeated frame.
+inline void gl_check_setup() {
+#if UTILS_GL_CHECK_MODE == UTILS_GL_CHECK_DEFERRED
+  gl_check_every_call() = true;
+#endif
+}
+
+// The error gl_check_frame() found at the end of the previous frame, which
+// was not checked call by call, or 0.
+inline GLenum& gl_pending_error() {
+  static GLenum code = 0;
+  return code;
+}
+
+// Called at the end of every frame.  In the deferred mode, looks for errors
+// raised by the frame, and if there are any, checks every call in the next
+// one, so that UTILS_GL_CHECK() throws with the failing call if the error
+// repeats.  If the next frame has no error, the first one is thrown from
+// here instead, without the call.
+inline void gl_check_frame() {
+#if UTILS_GL_CHECK_MODE == UTILS_GL_CHECK_DEFERRED
+  const auto checked = gl_check_every_call();
+  const auto pending = gl_pending_error();
+  gl_check_every_call() = false;
+  gl_pending_error() = 0;
+
+  const auto code = glGetError();
+  if (code) {
+    // Several errors may be queued.
+    while (glGetError()) {
+    }
+  }
+
+  if (checked && code) {
+    std::ostringstream msg;
+    msg << "GL error " << code << " outside of UTILS_GL_CHECK()";
+    throw std::runtime_error(msg.str());
+  }
+
+  if (pending) {
+    std::ostringstream msg;
+    msg << "GL error " << pending
+        << " in an unchecked frame did not repeat in the next one";
+    throw std::runtime_error(msg.str());
+  }
+
+  if (!code) return;
+
+  error("GL error %u in frame; checking every call in the next one", code);
+  gl_pending_error() = code;
+  gl_check_every_call() = true;
+#endif
+}
+
+#if UTILS_GL_CHECK_MODE == UTILS_GL_CHECK_DEBUG
+inline void GL_APIENTRY gl_debug_callback(GLenum, GLenum type, GLuint,
+                                          GLenum severity, GLsizei,
+                                          const GLchar* message, const void*) {
+  if (type == GL_DEBUG_TYPE_ERROR_KHR) {
+    // Thrown by UTILS_GL_CHECK() once the driver returns.
+    if (gl_debug_error().empty()) gl_debug_error() = message;
+  } else if (severity != GL_DEBUG_SEVERITY_NOTIFICATION_KHR) {
+    info("GL: %s", message);
+  }
+}
+#endif
+
+// In the debug mode, routes GL_KHR_debug messages to gl_debug_callback(), or
+// checks every call if the extension is missing.  Otherwise does nothing.
+inline void gl_enable_debug_output(const std::string& extensions) {
+#if UTILS_GL_CHECK_MODE == UTILS_GL_CHECK_DEBUG
+  PFNGLDEBUGMESSAGECALLBACKKHRPROC debug_message_callback = nullptr;
+  if (extensions.find("GL_KHR_debug") != std::string::npos)
+    debug_message_callback =
+        reinterpret_cast<PFNGLDEBUGMESSAGECALLBACKKHRPROC>(
+            eglGetProcAddress("glDebugMessageCallbackKHR"));
+
+  if (!debug_message_callback) {
+    info("GL_KHR_debug is unavailable; checking every GL call");
+    gl_check_every_call() = true;
+    return;
+  }
+
+  gl_check_every_call() = false;
+  gl_debug_error().clear();
+  debug_message_callback(gl_debug_callback, nullptr);
+  UTILS_GL_CHECK_NOW(glEnable(GL_DEBUG_OUTPUT_KHR));
+  // Runs the callback inside the failing call, so that the UTILS_GL_CHECK()
+  // around it reports the error.
+  UTILS_GL_CHECK_NOW(glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS_KHR));
+#else
+  (void)extensions;
+#endif
+}
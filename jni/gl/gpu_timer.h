@@ -0,0 +1,124 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include "utils/log.h"
+
+// Measures GPU time per frame with GL_EXT_disjoint_timer_query.  Results
+// become available a few frames after the commands complete, so a small ring
+// of queries is kept in flight, and frames are skipped rather than waited on
+// when all of them are busy.  Without the extension, every call does nothing.
+class gpu_timer {
+ public:
+  static constexpr size_t kQueries = 4;
+
+  gpu_timer() = default;
+
+  gpu_timer(const gpu_timer&) = delete;
+  gpu_timer& operator=(const gpu_timer&) = delete;
+
+  // Looks up the extension in the current context, and creates the queries.
+  // Returns false if timing is unavailable.
+  bool prepare(const std::string& extensions) {
+    context_lost();
+
+    if (extensions.find("GL_EXT_disjoint_timer_query") == std::string::npos)
+      return false;
+
+    gen_queries_ = reinterpret_cast<PFNGLGENQUERIESEXTPROC>(
+        eglGetProcAddress("glGenQueriesEXT"));
+    begin_query_ = reinterpret_cast<PFNGLBEGINQUERYEXTPROC>(
+        eglGetProcAddress("glBeginQueryEXT"));
+    end_query_ = reinterpret_cast<PFNGLENDQUERYEXTPROC>(
+        eglGetProcAddress("glEndQueryEXT"));
+    get_query_object_uiv_ = reinterpret_cast<PFNGLGETQUERYOBJECTUIVEXTPROC>(
+        eglGetProcAddress("glGetQueryObjectuivEXT"));
+    get_query_object_ui64v_ =
+        reinterpret_cast<PFNGLGETQUERYOBJECTUI64VEXTPROC>(
+            eglGetProcAddress("glGetQueryObjectui64vEXT"));
+    if (!gen_queries_ || !begin_query_ || !end_query_ ||
+        !get_query_object_uiv_ || !get_query_object_ui64v_)
+      return false;
+
+    UTILS_GL_CHECK(gen_queries_(kQueries, queries_.data()));
+    available_ = true;
+    return true;
+  }
+
+  bool available() const { return available_; }
+
+  // Starts timing the commands issued until end(), unless every query is
+  // still waiting for its result.
+  void begin() {
+    if (!available_ || pending_ == kQueries) return;
+
+    UTILS_GL_CHECK(begin_query_(GL_TIME_ELAPSED_EXT,
+                                queries_[(first_ + pending_) % kQueries]));
+    active_ = true;
+  }
+
+  void end() {
+    if (!active_) return;
+
+    UTILS_GL_CHECK(end_query_(GL_TIME_ELAPSED_EXT));
+    active_ = false;
+    ++pending_;
+  }
+
+  // Stores the GPU time of the oldest timed frame in `*nanoseconds` and
+  // returns true, if its result has arrived.  Results spanning a disjoint
+  // event, such as a frequency change, are discarded.
+  bool poll(uint64_t* nanoseconds) {
+    if (!pending_) return false;
+
+    const auto query = queries_[first_];
+    GLuint ready = GL_FALSE;
+    UTILS_GL_CHECK(
+        get_query_object_uiv_(query, GL_QUERY_RESULT_AVAILABLE_EXT, &ready));
+    if (!ready) return false;
+
+    GLuint64 elapsed = 0;
+    UTILS_GL_CHECK(
+        get_query_object_ui64v_(query, GL_QUERY_RESULT_EXT, &elapsed));
+    first_ = (first_ + 1) % kQueries;
+    --pending_;
+
+    GLint disjoint = GL_FALSE;
+    UTILS_GL_CHECK(glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint));
+    if (disjoint) return false;
+
+    *nanoseconds = elapsed;
+    return true;
+  }
+
+  // Forgets the queries, which went away with the old context.
+  void context_lost() {
+    available_ = false;
+    active_ = false;
+    first_ = 0;
+    pending_ = 0;
+  }
+
+ private:
+  bool available_ = false;
+  // True between begin() and end() if a query was started.
+  bool active_ = false;
+
+  // Queries waiting for results, oldest first, starting at `first_`.
+  std::array<GLuint, kQueries> queries_{};
+  size_t first_ = 0;
+  size_t pending_ = 0;
+
+  PFNGLGENQUERIESEXTPROC gen_queries_ = nullptr;
+  PFNGLBEGINQUERYEXTPROC begin_query_ = nullptr;
+  PFNGLENDQUERYEXTPROC end_query_ = nullptr;
+  PFNGLGETQUERYOBJECTUIVEXTPROC get_query_object_uiv_ = nullptr;
+  PFNGLGETQUERYOBJECTUI64VEXTPROC get_query_object_ui64v_ = nullptr;
+};
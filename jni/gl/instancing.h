@@ -0,0 +1,432 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include "geometry/meshlet.h"
+#include "geometry/vector.h"
+#include "gl/mesh.h"
+#include "gl/program.h"
+#include "gl/state_cache.h"
+#include "gl/vertex_format.h"
+#include "utils/log.h"
+
+// Per-instance data, laid out as vec4s for both vertex attributes and
+// uniform arrays.
+struct instance_data {
+  vec4 rotation;
+  // Translation in xyz, and uniform scale in w.
+  vec4 translation_scale;
+  // Tint in rgb, and the geomorphing factor in w.
+  vec4 color_morph;
+};
+
+static_assert(sizeof(instance_data) == 3 * 4 * sizeof(float),
+              "instance_data must be tightly packed vec4s");
+
+inline instance_data make_instance_data(const affine_transform& t,
+                                        const std::array<uint8_t, 4>& color,
+                                        float morph = 1.0f) {
+  return {t.rotation,
+          vec4(t.translation.x, t.translation.y, t.translation.z, t.scale),
+          vec4(color[0] / 255.0f, color[1] / 255.0f, color[2] / 255.0f,
+               morph)};
+}
+
+// Inverse of make_instance_data(), for culling on the CPU.
+inline affine_transform instance_transform(const instance_data& instance) {
+  const auto& ts = instance.translation_scale;
+  return {instance.rotation, vec3(ts.x, ts.y, ts.z), ts.w};
+}
+
+// Draws many copies of meshes, each with its own transform and color, in as
+// few draw calls as the context allows.  The meshes, called parts, share one
+// vertex and index buffer; typically they are levels of detail of the same
+// object.
+//
+// With GL_EXT_instanced_arrays, the instance data is streamed to a vertex
+// buffer read with an attribute divisor of 1, and all instances of a part are
+// drawn with a single call.  Otherwise, each part is replicated up to
+// batch_size() times with the copy number in an extra attribute, and each
+// batch of instances is passed to the shader in a uniform array.
+//
+// GLES2 has no base vertex for glDrawElements, so every part keeps its own
+// index range, and the attributes are pointed at its vertices before drawing.
+// Indices are 16-bit where they fit.  Larger parts are split into meshlets
+// that each fit, and can be culled separately, unless that would take more
+// than kMaxMeshlets draw calls and GL_OES_element_index_uint is there, in
+// which case the part is drawn whole with 32-bit indices.
+template <typename Format>
+class instanced_mesh {
+ public:
+  typedef typename Format::vertex vertex;
+
+  // Uniform vectors left for the rest of the vertex shader in the uniform
+  // array path.
+  static constexpr GLint kReservedUniformVectors = 16;
+
+  // Limits the size of the replicated parts.
+  static constexpr size_t kMaxBatchSize = 64;
+
+  // Vertices addressable with 16-bit indices.
+  static constexpr size_t kMaxShortIndexVertices = 65536;
+
+  // Size of the meshlets of a split part.  Smaller meshlets cull better, but
+  // take more draw calls.
+  static constexpr size_t kMeshletVertices = 8192;
+  static constexpr size_t kMaxMeshlets = 64;
+
+  instanced_mesh() = default;
+
+  instanced_mesh(const instanced_mesh&) = delete;
+  instanced_mesh& operator=(const instanced_mesh&) = delete;
+
+  // Returns true if the parts have been uploaded since the mesh was last
+  // lost.
+  bool has_data() const { return mesh_.has_data() && uploaded_; }
+
+  // Picks the drawing method for the current context, and removes all parts.
+  void prepare(const std::string& extensions) {
+    uint_indices_ =
+        extensions.find("GL_OES_element_index_uint") != std::string::npos;
+    instanced_ = false;
+    if (extensions.find("GL_EXT_instanced_arrays") != std::string::npos) {
+      draw_elements_instanced_ =
+          reinterpret_cast<PFNGLDRAWELEMENTSINSTANCEDEXTPROC>(
+              eglGetProcAddress("glDrawElementsInstancedEXT"));
+      vertex_attrib_divisor_ =
+          reinterpret_cast<PFNGLVERTEXATTRIBDIVISOREXTPROC>(
+              eglGetProcAddress("glVertexAttribDivisorEXT"));
+      instanced_ = draw_elements_instanced_ && vertex_attrib_divisor_;
+    }
+
+    if (instanced_) {
+      batch_size_ = 1;
+    } else {
+      GLint max_vectors = 0;
+      UTILS_GL_CHECK(
+          glGetIntegerv(GL_MAX_VERTEX_UNIFORM_VECTORS, &max_vectors));
+      batch_size_ = std::min<size_t>(
+          kMaxBatchSize,
+          std::max<GLint>(max_vectors - kReservedUniformVectors, 3) / 3);
+    }
+
+    parts_.clear();
+    meshlets_.clear();
+    vertices_.clear();
+    indices_.clear();
+    copy_numbers_.clear();
+    uploaded_ = false;
+  }
+
+  // Appends a part, split and replicated as needed, and returns its index.
+  // The data is copied.  `bounds` is the box positions are quantized to.
+  template <typename IndexType>
+  size_t add_part(const vertex* vertices, size_t vertex_count,
+                  const IndexType* indices, size_t index_count,
+                  const position_bounds& bounds) {
+    const auto split =
+        vertex_count > kMaxShortIndexVertices &&
+        !(uint_indices_ && vertex_count > kMaxMeshlets * kMeshletVertices);
+
+    std::vector<meshlet> meshlets;
+    std::vector<uint32_t> vertex_map;
+    std::vector<uint32_t> local_indices;
+    build_meshlets(
+        indices, index_count, vertex_count,
+        split ? size_t(kMeshletVertices) : vertex_count,
+        [vertices, &bounds](uint32_t i) {
+          return Format::position(vertices[i], bounds);
+        },
+        &meshlets, &vertex_map, &local_indices);
+
+    // Vertices are drawn anywhere between their two positions.
+    size_t max_vertices = 1;
+    for (auto& m : meshlets) {
+      for (size_t i = m.first_vertex; i < m.first_vertex + m.vertex_count;
+           ++i) {
+        const auto p = Format::morph_position(vertices[vertex_map[i]], bounds);
+        m.bounds.radius =
+            std::max(m.bounds.radius, (p - m.bounds.center).magnitude());
+      }
+      max_vertices = std::max<size_t>(max_vertices, m.vertex_count);
+    }
+
+    // Every copy must be addressable with 16-bit indices, which also bounds
+    // the memory used by replication.
+    const auto copies =
+        instanced_ ? 1
+                   : std::max<size_t>(
+                         1, std::min(batch_size_,
+                                     kMaxShortIndexVertices / max_vertices));
+    const auto wide = max_vertices > kMaxShortIndexVertices;
+
+    parts_.push_back(part{meshlets_.size(), meshlets.size(), copies,
+                          wide ? GLenum(GL_UNSIGNED_INT)
+                               : GLenum(GL_UNSIGNED_SHORT)});
+
+    for (auto m : meshlets) {
+      // 32-bit indices are stored as pairs of 16-bit words, aligned.
+      if (wide && indices_.size() % 2) indices_.push_back(0);
+      const auto first_vertex = vertices_.size();
+      const auto first_index = wide ? indices_.size() / 2 : indices_.size();
+
+      for (size_t copy = 0; copy < copies; ++copy) {
+        for (size_t i = 0; i < m.vertex_count; ++i)
+          vertices_.push_back(vertices[vertex_map[m.first_vertex + i]]);
+        for (size_t i = 0; i < m.index_count; ++i) {
+          const uint32_t index =
+              local_indices[m.first_index + i] + copy * m.vertex_count;
+          if (wide) {
+            uint16_t words[2];
+            memcpy(words, &index, sizeof(index));
+            indices_.insert(indices_.end(), words, words + 2);
+          } else {
+            indices_.push_back(static_cast<uint16_t>(index));
+          }
+        }
+        if (!instanced_)
+          copy_numbers_.insert(copy_numbers_.end(), m.vertex_count,
+                               static_cast<GLfloat>(copy));
+      }
+
+      m.first_vertex = first_vertex;
+      m.first_index = first_index;
+      meshlets_.push_back(m);
+    }
+
+    return parts_.size() - 1;
+  }
+
+  // Sends the parts to GL, and frees the CPU copies.
+  void upload() {
+    mesh_.assign(std::move(vertices_), std::move(indices_));
+    mesh_.upload();
+    mesh_.release_cpu_data();
+
+    if (!instance_buffer_) UTILS_GL_CHECK(glGenBuffers(1, &instance_buffer_));
+    if (!instanced_) {
+      gl_state::current().bind_buffer(GL_ARRAY_BUFFER, instance_buffer_);
+      UTILS_GL_CHECK(glBufferData(GL_ARRAY_BUFFER,
+                                  sizeof(GLfloat) * copy_numbers_.size(),
+                                  copy_numbers_.data(), GL_STATIC_DRAW));
+      std::vector<GLfloat>().swap(copy_numbers_);
+    }
+
+    uploaded_ = true;
+  }
+
+  bool instanced() const { return instanced_; }
+
+  // Number of instances drawn per call in the uniform array path.  Large
+  // parts may use smaller batches.
+  size_t batch_size() const { return batch_size_; }
+
+  size_t part_count() const { return parts_.size(); }
+
+  // The meshlets of a part, with bounds in object space.  A part that is not
+  // split has a single meshlet.
+  const meshlet* meshlets(size_t part_index) const {
+    return &meshlets_[parts_[part_index].first_meshlet];
+  }
+  size_t meshlet_count(size_t part_index) const {
+    return parts_[part_index].meshlet_count;
+  }
+
+  // Declares instance_position(), which transforms a position from object to
+  // world space, instance_color() and instance_morph().  Depends on the
+  // method chosen by prepare().
+  std::string shader_prelude() const {
+    std::string result;
+    if (instanced_) {
+      result =
+          "attribute vec4 attr_InstanceRotation;\n"
+          "attribute vec4 attr_InstanceTranslationScale;\n"
+          "attribute vec4 attr_InstanceColorMorph;\n"
+          "vec4 instance_rotation() { return attr_InstanceRotation; }\n"
+          "vec4 instance_translation_scale() {\n"
+          "  return attr_InstanceTranslationScale;\n"
+          "}\n"
+          "vec4 instance_color_morph() { return attr_InstanceColorMorph; }\n";
+    } else {
+      result =
+          "attribute float attr_InstanceIndex;\n"
+          "uniform vec4 uniform_Instances[" +
+          std::to_string(3 * batch_size_) +
+          "];\n"
+          "int instance_base() { return int(attr_InstanceIndex) * 3; }\n"
+          "vec4 instance_rotation() {\n"
+          "  return uniform_Instances[instance_base()];\n"
+          "}\n"
+          "vec4 instance_translation_scale() {\n"
+          "  return uniform_Instances[instance_base() + 1];\n"
+          "}\n"
+          "vec4 instance_color_morph() {\n"
+          "  return uniform_Instances[instance_base() + 2];\n"
+          "}\n";
+    }
+
+    // Same as affine_transform::operator*(vec3).
+    return result +
+           "vec3 instance_color() { return instance_color_morph().rgb; }\n"
+           "float instance_morph() { return instance_color_morph().a; }\n"
+           "vec3 instance_position(vec3 position) {\n"
+           "  vec4 q = instance_rotation();\n"
+           "  vec4 ts = instance_translation_scale();\n"
+           "  vec3 p = position * ts.w;\n"
+           "  vec3 t = 2.0 * cross(q.xyz, p);\n"
+           "  return p + q.w * t + cross(q.xyz, t) + ts.xyz;\n"
+           "}\n";
+  }
+
+  // Looks up the inputs used by draw() in a program whose vertex shader
+  // includes shader_prelude() and Format::shader_prelude().
+  void set_program(const shader_program& program) {
+    attributes_ = vertex_attributes::of(program);
+
+    if (instanced_) {
+      rotation_location_ = program.attribute("attr_InstanceRotation");
+      translation_scale_location_ =
+          program.attribute("attr_InstanceTranslationScale");
+      color_morph_location_ = program.attribute("attr_InstanceColorMorph");
+    } else {
+      index_location_ = program.attribute("attr_InstanceIndex");
+      instances_location_ = program.uniform("uniform_Instances");
+    }
+  }
+
+  // Draws `count` instances of a part, skipping the meshlets whose entry in
+  // `meshlet_mask`, if given, is zero.  Requires the program passed to
+  // set_program() to be current.
+  void draw(size_t part_index, const instance_data* instances, size_t count,
+            const uint8_t* meshlet_mask = nullptr) {
+    if (!count) return;
+
+    const auto& p = parts_[part_index];
+    const auto index_size =
+        p.index_type == GL_UNSIGNED_INT ? sizeof(uint32_t) : sizeof(uint16_t);
+    auto& state = gl_state::current();
+
+    if (instanced_) {
+      state.bind_buffer(GL_ARRAY_BUFFER, instance_buffer_);
+      UTILS_GL_CHECK(glBufferData(GL_ARRAY_BUFFER,
+                                  sizeof(instance_data) * count, instances,
+                                  GL_STREAM_DRAW));
+      set_instance_attribute(rotation_location_,
+                             offsetof(instance_data, rotation));
+      set_instance_attribute(translation_scale_location_,
+                             offsetof(instance_data, translation_scale));
+      set_instance_attribute(color_morph_location_,
+                             offsetof(instance_data, color_morph));
+    }
+
+    for (size_t i = 0; i < p.meshlet_count; ++i) {
+      if (meshlet_mask && !meshlet_mask[i]) continue;
+
+      const auto& m = meshlets_[p.first_meshlet + i];
+      const auto index_offset = index_size * m.first_index;
+
+      mesh_.bind_for_draw();
+      Format::set_attributes(attributes_, sizeof(vertex) * m.first_vertex);
+      Format::enable_attributes(attributes_);
+
+      if (instanced_) {
+        UTILS_GL_CHECK(draw_elements_instanced_(
+            GL_TRIANGLES, m.index_count, p.index_type,
+            arrayOffset(index_offset), count));
+        continue;
+      }
+
+      state.bind_buffer(GL_ARRAY_BUFFER, instance_buffer_);
+      state.attribute_pointer(index_location_, 1, GL_FLOAT, GL_FALSE, 0,
+                              sizeof(GLfloat) * m.first_vertex);
+      state.enable_attribute(index_location_);
+
+      for (size_t first = 0; first < count; first += p.copies) {
+        const auto n = std::min(p.copies, count - first);
+        UTILS_GL_CHECK(glUniform4fv(instances_location_, 3 * n,
+                                    &instances[first].rotation.x));
+        UTILS_GL_CHECK(glDrawElements(GL_TRIANGLES, n * m.index_count,
+                                      p.index_type,
+                                      arrayOffset(index_offset)));
+      }
+    }
+  }
+
+  // Forgets the GL objects.  The parts must be added and uploaded again.
+  void context_lost() {
+    mesh_.context_lost();
+    instance_buffer_ = 0;
+    uploaded_ = false;
+  }
+
+ private:
+  // Each meshlet of a part covers all copies of it.  Its vertex and index
+  // ranges are those of a single copy, at offsets in the shared buffers, with
+  // indices counted in units of the part's index type.
+  struct part {
+    size_t first_meshlet;
+    size_t meshlet_count;
+    size_t copies;
+    GLenum index_type;
+  };
+
+  void set_instance_attribute(GLint location, size_t offset) {
+    auto& state = gl_state::current();
+    state.attribute_pointer(location, 4, GL_FLOAT, GL_FALSE,
+                            sizeof(instance_data), offset);
+    state.enable_attribute(location);
+    state.attribute_divisor(vertex_attrib_divisor_, location, 1);
+  }
+
+  // 32-bit indices are stored as pairs of 16-bit words.
+  mesh<vertex, uint16_t> mesh_;
+  std::vector<part> parts_;
+  std::vector<meshlet> meshlets_;
+  bool uploaded_ = false;
+
+  // Parts added since prepare(), until upload().
+  std::vector<vertex> vertices_;
+  std::vector<uint16_t> indices_;
+  std::vector<GLfloat> copy_numbers_;
+
+  bool uint_indices_ = false;
+  bool instanced_ = false;
+  size_t batch_size_ = 1;
+  PFNGLDRAWELEMENTSINSTANCEDEXTPROC draw_elements_instanced_ = nullptr;
+  PFNGLVERTEXATTRIBDIVISOREXTPROC vertex_attrib_divisor_ = nullptr;
+
+  // Per-instance data with instancing, and copy numbers without.
+  GLuint instance_buffer_ = 0;
+
+  vertex_attributes attributes_;
+  GLint rotation_location_ = -1;
+  GLint translation_scale_location_ = -1;
+  GLint color_morph_location_ = -1;
+  GLint index_location_ = -1;
+  GLint instances_location_ = -1;
+};
+
+template <typename Format>
+constexpr GLint instanced_mesh<Format>::kReservedUniformVectors;
+
+template <typename Format>
+constexpr size_t instanced_mesh<Format>::kMaxBatchSize;
+
+template <typename Format>
+constexpr size_t instanced_mesh<Format>::kMaxShortIndexVertices;
+
+template <typename Format>
+constexpr size_t instanced_mesh<Format>::kMeshletVertices;
+
+template <typename Format>
+constexpr size_t instanced_mesh<Format>::kMaxMeshlets;
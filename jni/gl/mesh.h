@@ -0,0 +1,228 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <GLES2/gl2.h>
+
+#include "gl/state_cache.h"
+#include "utils/log.h"
+
+template <typename IndexType>
+struct gl_index_type;
+
+template <>
+struct gl_index_type<uint8_t> {
+  static constexpr GLenum value = GL_UNSIGNED_BYTE;
+};
+
+template <>
+struct gl_index_type<uint16_t> {
+  static constexpr GLenum value = GL_UNSIGNED_SHORT;
+};
+
+template <>
+struct gl_index_type<uint32_t> {
+  static constexpr GLenum value = GL_UNSIGNED_INT;
+};
+
+// Half-open range of elements that need to be uploaded again.
+struct dirty_range {
+  bool empty() const { return begin >= end; }
+
+  void add(size_t first, size_t count) {
+    if (!count) return;
+    if (empty()) {
+      begin = first;
+      end = first + count;
+    } else {
+      begin = std::min(begin, first);
+      end = std::max(end, first + count);
+    }
+  }
+
+  void clear() { begin = end = 0; }
+
+  size_t begin = 0;
+  size_t end = 0;
+};
+
+// A vertex and index buffer pair that lives in GL memory.  The data is
+// uploaded with GL_STATIC_DRAW once per GL context, after which only ranges
+// marked dirty are sent again, using glBufferSubData.  Ranges marked between
+// two uploads are sent as one range spanning them all, with one call per
+// buffer.
+template <typename Vertex, typename IndexType>
+class mesh {
+ public:
+  mesh() = default;
+
+  mesh(const mesh&) = delete;
+  mesh& operator=(const mesh&) = delete;
+
+  // Replaces the mesh data.  Existing buffers are reallocated on the next
+  // upload().
+  void assign(std::vector<Vertex> vertices, std::vector<IndexType> indices) {
+    vertices_ = std::move(vertices);
+    indices_ = std::move(indices);
+    set_data(vertices_.data(), vertices_.size(), indices_.data(),
+             indices_.size());
+  }
+
+  // Like assign(), but without copying or taking ownership of the data, which
+  // must stay valid until the mesh is assigned again.  Meant for static
+  // tables and mapped files.  Such a mesh cannot be modified.
+  void assign_external(const Vertex* vertices, size_t vertex_count,
+                       const IndexType* indices, size_t index_count) {
+    std::vector<Vertex>().swap(vertices_);
+    std::vector<IndexType>().swap(indices_);
+    set_data(vertices, vertex_count, indices, index_count);
+  }
+
+  // Gives mutable access to the CPU copy of the vertices.  Changes must be
+  // reported through mark_vertices_dirty().
+  Vertex* vertices() {
+    UTILS_REQUIRE(!vertices_.empty());
+    return vertices_.data();
+  }
+  IndexType* indices() {
+    UTILS_REQUIRE(!indices_.empty());
+    return indices_.data();
+  }
+
+  void mark_vertices_dirty(size_t first, size_t count) {
+    UTILS_REQUIRE(first + count <= vertices_.size());
+    vertex_dirty_.add(first, count);
+  }
+
+  void mark_indices_dirty(size_t first, size_t count) {
+    UTILS_REQUIRE(first + count <= indices_.size());
+    index_dirty_.add(first, count);
+  }
+
+  // Frees the CPU copies of the data.  After this, the mesh can no longer be
+  // modified, and has to be assigned again if the GL context is lost.
+  void release_cpu_data() {
+    UTILS_REQUIRE(!needs_full_upload_);
+    UTILS_REQUIRE(vertex_dirty_.empty() && index_dirty_.empty());
+    std::vector<Vertex>().swap(vertices_);
+    std::vector<IndexType>().swap(indices_);
+    vertex_data_ = nullptr;
+    index_data_ = nullptr;
+  }
+
+  // Forgets the GL buffers without deleting them.  Call this when the GL
+  // context has been destroyed, since the buffer names are no longer valid.
+  void context_lost() {
+    vertex_buffer_ = 0;
+    index_buffer_ = 0;
+    needs_full_upload_ = true;
+    vertex_dirty_.clear();
+    index_dirty_.clear();
+
+    // Without CPU copies there is nothing left to upload.
+    if (!vertex_data_) vertex_count_ = index_count_ = 0;
+  }
+
+  // Deletes the GL buffers.  Requires the owning context to be current.
+  void destroy() {
+    if (vertex_buffer_) gl_state::current().delete_buffers(1, &vertex_buffer_);
+    if (index_buffer_) gl_state::current().delete_buffers(1, &index_buffer_);
+    context_lost();
+  }
+
+  // Returns true if the mesh can be drawn, possibly after an upload().
+  bool has_data() const { return index_count_ > 0; }
+
+  // Sends all pending data to GL, and leaves both buffers bound.
+  void upload() {
+    if (!vertex_buffer_) UTILS_GL_CHECK(glGenBuffers(1, &vertex_buffer_));
+    if (!index_buffer_) UTILS_GL_CHECK(glGenBuffers(1, &index_buffer_));
+
+    bind();
+
+    if (needs_full_upload_) {
+      UTILS_REQUIRE(vertex_data_ && index_data_);
+
+      UTILS_GL_CHECK(glBufferData(GL_ARRAY_BUFFER,
+                                  sizeof(Vertex) * vertex_count_,
+                                  vertex_data_, GL_STATIC_DRAW));
+      UTILS_GL_CHECK(glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                                  sizeof(IndexType) * index_count_,
+                                  index_data_, GL_STATIC_DRAW));
+      needs_full_upload_ = false;
+    } else {
+      if (!vertex_dirty_.empty()) {
+        UTILS_GL_CHECK(glBufferSubData(
+            GL_ARRAY_BUFFER, sizeof(Vertex) * vertex_dirty_.begin,
+            sizeof(Vertex) * (vertex_dirty_.end - vertex_dirty_.begin),
+            &vertices_[vertex_dirty_.begin]));
+      }
+      if (!index_dirty_.empty()) {
+        UTILS_GL_CHECK(glBufferSubData(
+            GL_ELEMENT_ARRAY_BUFFER, sizeof(IndexType) * index_dirty_.begin,
+            sizeof(IndexType) * (index_dirty_.end - index_dirty_.begin),
+            &indices_[index_dirty_.begin]));
+      }
+    }
+
+    vertex_dirty_.clear();
+    index_dirty_.clear();
+  }
+
+  // Binds the vertex and index buffers, uploading first if anything changed.
+  void bind_for_draw() {
+    if (needs_full_upload_ || !vertex_dirty_.empty() || !index_dirty_.empty())
+      upload();
+    else
+      bind();
+  }
+
+  // Returns the data to be uploaded, or nullptr after release_cpu_data().
+  const Vertex* vertex_data() const { return vertex_data_; }
+  const IndexType* index_data() const { return index_data_; }
+
+  size_t vertex_count() const { return vertex_count_; }
+  size_t index_count() const { return index_count_; }
+  static constexpr GLenum index_type() {
+    return gl_index_type<IndexType>::value;
+  }
+
+ private:
+  void set_data(const Vertex* vertices, size_t vertex_count,
+                const IndexType* indices, size_t index_count) {
+    vertex_data_ = vertices;
+    index_data_ = indices;
+    vertex_count_ = vertex_count;
+    index_count_ = index_count;
+    needs_full_upload_ = true;
+    vertex_dirty_.clear();
+    index_dirty_.clear();
+  }
+
+  void bind() const {
+    auto& state = gl_state::current();
+    state.bind_buffer(GL_ARRAY_BUFFER, vertex_buffer_);
+    state.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer_);
+  }
+
+  // Owned CPU copies, if any.
+  std::vector<Vertex> vertices_;
+  std::vector<IndexType> indices_;
+
+  // The data to upload, either pointing into the vectors above or to
+  // external storage.
+  const Vertex* vertex_data_ = nullptr;
+  const IndexType* index_data_ = nullptr;
+
+  size_t vertex_count_ = 0;
+  size_t index_count_ = 0;
+
+  GLuint vertex_buffer_ = 0;
+  GLuint index_buffer_ = 0;
+
+  bool needs_full_upload_ = true;
+  dirty_range vertex_dirty_;
+  dirty_range index_dirty_;
+};
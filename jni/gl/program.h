@@ -0,0 +1,313 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include "gl/state_cache.h"
+#include "utils/log.h"
+#include "utils/mapped_file.h"
+
+// A linked program, with its attribute and uniform locations looked up once.
+class shader_program {
+ public:
+  explicit shader_program(GLuint id) : id_(id) {}
+
+  shader_program(const shader_program&) = delete;
+  shader_program& operator=(const shader_program&) = delete;
+
+  GLuint id() const { return id_; }
+
+  // Returns the location of an attribute or uniform, or -1 if the linker
+  // removed it.
+  GLint attribute(const char* name) const {
+    return location(&attributes_, name, glGetAttribLocation);
+  }
+
+  GLint uniform(const char* name) const {
+    return location(&uniforms_, name, glGetUniformLocation);
+  }
+
+ private:
+  typedef std::vector<std::pair<std::string, GLint>> location_cache;
+
+  GLint location(location_cache* cache, const char* name,
+                 GLint (*lookup)(GLuint, const GLchar*)) const {
+    for (const auto& entry : *cache)
+      if (entry.first == name) return entry.second;
+
+    GLint result;
+    UTILS_GL_CHECK(result = lookup(id_, name));
+    cache->emplace_back(name, result);
+    return result;
+  }
+
+  GLuint id_;
+  mutable location_cache attributes_;
+  mutable location_cache uniforms_;
+};
+
+// Compiles each pair of shader sources once per GL context.  With
+// GL_OES_get_program_binary, linked programs are also stored in a cache
+// directory, keyed by a hash of the sources and the driver's vendor,
+// renderer and version strings, and later contexts load them without
+// compiling anything.
+class program_registry {
+ public:
+  program_registry() = default;
+
+  program_registry(const program_registry&) = delete;
+  program_registry& operator=(const program_registry&) = delete;
+
+  ~program_registry() { context_lost(); }
+
+  // Sets up the registry for a new context.  Binaries are cached in
+  // `cache_directory`, unless it is empty.
+  void prepare(const std::string& extensions,
+               const std::string& cache_directory) {
+    context_lost();
+    cache_directory_ = cache_directory;
+
+    get_program_binary_ = nullptr;
+    program_binary_ = nullptr;
+    if (cache_directory_.empty() ||
+        extensions.find("GL_OES_get_program_binary") == std::string::npos)
+      return;
+
+    GLint formats = 0;
+    UTILS_GL_CHECK(glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats));
+    if (!formats) return;
+
+    get_program_binary_ = reinterpret_cast<PFNGLGETPROGRAMBINARYOESPROC>(
+        eglGetProcAddress("glGetProgramBinaryOES"));
+    program_binary_ = reinterpret_cast<PFNGLPROGRAMBINARYOESPROC>(
+        eglGetProcAddress("glProgramBinaryOES"));
+    if (!get_program_binary_ || !program_binary_) {
+      get_program_binary_ = nullptr;
+      program_binary_ = nullptr;
+      return;
+    }
+
+    driver_ = gl_string(GL_VENDOR) + '\n' + gl_string(GL_RENDERER) + '\n' +
+              gl_string(GL_VERSION);
+  }
+
+  // Returns the program for the given sources, loading or building it the
+  // first time in this context.  Throws std::runtime_error if it does not
+  // compile or link.
+  const shader_program& get(const std::string& vertex_source,
+                            const std::string& fragment_source) {
+    for (const auto& e : programs_)
+      if (e->vertex_source == vertex_source &&
+          e->fragment_source == fragment_source)
+        return e->program;
+
+    const auto key = hash(vertex_source + '\0' + fragment_source);
+    auto id = load_binary(key);
+    if (!id) {
+      id = build(vertex_source.c_str(), fragment_source.c_str());
+      store_binary(key, id);
+    }
+
+    programs_.emplace_back(new entry(vertex_source, fragment_source, id));
+    return programs_.back()->program;
+  }
+
+  size_t size() const { return programs_.size(); }
+
+  // Forgets the programs, which went away with the old context.
+  void context_lost() { programs_.clear(); }
+
+ private:
+  struct entry {
+    entry(const std::string& vertex_source, const std::string& fragment_source,
+          GLuint id)
+        : vertex_source(vertex_source),
+          fragment_source(fragment_source),
+          program(id) {}
+
+    std::string vertex_source;
+    std::string fragment_source;
+    shader_program program;
+  };
+
+  static constexpr uint32_t kBinaryMagic = 0x47525043;  // "CPRG"
+  static constexpr uint32_t kBinaryVersion = 1;
+
+  struct binary_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t format;
+    uint32_t length;
+    uint64_t key;
+  };
+
+  static std::string gl_string(GLenum name) {
+    const auto result = glGetString(name);
+    return result ? reinterpret_cast<const char*>(result) : "";
+  }
+
+  // 64-bit FNV-1a.
+  static uint64_t hash(const std::string& data) {
+    uint64_t result = 0xcbf29ce484222325ULL;
+    for (const auto c : data) {
+      result ^= static_cast<uint8_t>(c);
+      result *= 0x100000001b3ULL;
+    }
+    return result;
+  }
+
+  static GLuint compile(GLenum type, const char* source) {
+    GLuint shader;
+    UTILS_REQUIRE(shader = glCreateShader(type));
+
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    GLint compiled = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (compiled != GL_TRUE) {
+      GLchar log[1024];
+      GLsizei log_length;
+      glGetShaderInfoLog(shader, sizeof(log), &log_length, log);
+      glDeleteShader(shader);
+      throw std::runtime_error{std::string(log, log_length)};
+    }
+
+    return shader;
+  }
+
+  // Compiles and links a program.  The shader objects are only needed for
+  // linking, and are deleted afterwards.
+  static GLuint build(const char* vertex_source, const char* fragment_source) {
+    const auto vertex_shader = compile(GL_VERTEX_SHADER, vertex_source);
+    GLuint fragment_shader;
+    try {
+      fragment_shader = compile(GL_FRAGMENT_SHADER, fragment_source);
+    } catch (...) {
+      glDeleteShader(vertex_shader);
+      throw;
+    }
+
+    GLuint program;
+    UTILS_REQUIRE(program = glCreateProgram());
+    glAttachShader(program, vertex_shader);
+    glAttachShader(program, fragment_shader);
+    glLinkProgram(program);
+    glDetachShader(program, vertex_shader);
+    glDetachShader(program, fragment_shader);
+    glDeleteShader(vertex_shader);
+    glDeleteShader(fragment_shader);
+
+    GLint link_status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &link_status);
+    if (link_status != GL_TRUE) {
+      GLchar log[1024];
+      GLsizei log_length;
+      glGetProgramInfoLog(program, sizeof(log), &log_length, log);
+      glDeleteProgram(program);
+      throw std::runtime_error{std::string(log, log_length)};
+    }
+
+    return program;
+  }
+
+  // The binary's key also covers the driver, whose binaries are not
+  // portable across versions.
+  std::string binary_path(uint64_t key) const {
+    char name[40];
+    snprintf(name, sizeof(name), "/program-%016llx.bin",
+             static_cast<unsigned long long>(key ^ hash(driver_)));
+    return cache_directory_ + name;
+  }
+
+  // Returns a program created from a cached binary, or 0 if there is no
+  // usable one.
+  GLuint load_binary(uint64_t key) {
+    if (!program_binary_) return 0;
+
+    const auto file = mapped_file::open(binary_path(key));
+    if (file.size() < sizeof(binary_header)) return 0;
+
+    binary_header header;
+    memcpy(&header, file.data(), sizeof(header));
+    if (header.magic != kBinaryMagic || header.version != kBinaryVersion ||
+        header.key != key ||
+        header.length > file.size() - sizeof(binary_header))
+      return 0;
+
+    GLuint program;
+    UTILS_REQUIRE(program = glCreateProgram());
+    program_binary_(program, header.format, file.data() + sizeof(header),
+                    header.length);
+
+    // Drivers reject binaries from other versions by failing the link,
+    // without raising an error.
+    GLint link_status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &link_status);
+    if (link_status != GL_TRUE) {
+      glDeleteProgram(program);
+      return 0;
+    }
+
+    return program;
+  }
+
+  // Writes the program's binary to the cache directory, atomically.  Errors
+  // are logged, since the program still works without its binary.
+  void store_binary(uint64_t key, GLuint program) {
+    if (!get_program_binary_) return;
+
+    GLint length = 0;
+    UTILS_GL_CHECK(
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &length));
+    if (length <= 0) return;
+
+    std::vector<uint8_t> binary(length);
+    GLenum format = 0;
+    GLsizei written = 0;
+    UTILS_GL_CHECK(get_program_binary_(program, length, &written, &format,
+                                       binary.data()));
+
+    binary_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = kBinaryMagic;
+    header.version = kBinaryVersion;
+    header.format = format;
+    header.length = written;
+    header.key = key;
+
+    const auto path = binary_path(key);
+    const auto tmp_path = path + ".tmp";
+    auto file = fopen(tmp_path.c_str(), "wb");
+    if (!file) {
+      error("%s: %s", tmp_path.c_str(), strerror(errno));
+      return;
+    }
+
+    const auto ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                    fwrite(binary.data(), 1, written, file) ==
+                        static_cast<size_t>(written);
+    if (fclose(file) != 0 || !ok ||
+        rename(tmp_path.c_str(), path.c_str()) != 0) {
+      error("%s: %s", path.c_str(), strerror(errno));
+      remove(tmp_path.c_str());
+    }
+  }
+
+  std::vector<std::unique_ptr<entry>> programs_;
+
+  std::string cache_directory_;
+  std::string driver_;
+  PFNGLGETPROGRAMBINARYOESPROC get_program_binary_ = nullptr;
+  PFNGLPROGRAMBINARYOESPROC program_binary_ = nullptr;
+};
@@ -0,0 +1,231 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include "utils/log.h"
+
+// Converts an array offset in bytes to void*, as required by
+// glVertexAttribPointer.
+constexpr void* arrayOffset(uintptr_t offset) {
+  union union_type {
+    constexpr union_type(uintptr_t i) : i_{i} {}
+    uintptr_t i_;
+    void* v_;
+  } x{offset};
+  return x.v_;
+}
+
+// Shadows the GL state that is set for every draw, and skips calls that
+// would not change it: the current program, buffer bindings, vertex
+// attribute arrays, capabilities and the clear color.
+//
+// Everything that changes this state must do so through here.  The cache
+// starts out knowing nothing, so the first call of each kind always reaches
+// GL, and is emptied again by invalidate() when the context is lost.  Only
+// the thread that owns the context may use it.
+class gl_state {
+ public:
+  // Attributes above this are passed through uncached.
+  static constexpr GLint kMaxAttributes = 16;
+
+  static gl_state& current() {
+    static gl_state state;
+    return state;
+  }
+
+  gl_state(const gl_state&) = delete;
+  gl_state& operator=(const gl_state&) = delete;
+
+  // Forgets all state.  Call this when the context changes, or after GL
+  // calls that bypass the cache.
+  void invalidate() {
+    program_.invalidate();
+    array_buffer_.invalidate();
+    element_array_buffer_.invalidate();
+    for (auto& a : attributes_) {
+      a.enabled.invalidate();
+      a.pointer.invalidate();
+      a.divisor.invalidate();
+    }
+    capabilities_.clear();
+    clear_color_.invalidate();
+  }
+
+  void use_program(GLuint program) {
+    if (program_.is(program)) return;
+    UTILS_GL_CHECK(glUseProgram(program));
+    program_.set(program);
+  }
+
+  // Deleting the current program leaves it in use until another is chosen,
+  // but its name may be reused right away.
+  void program_deleted(GLuint program) {
+    if (program_.is(program)) program_.invalidate();
+  }
+
+  void bind_buffer(GLenum target, GLuint buffer) {
+    auto& binding = buffer_binding(target);
+    if (binding.is(buffer)) return;
+    UTILS_GL_CHECK(glBindBuffer(target, buffer));
+    binding.set(buffer);
+  }
+
+  // Deletes buffers.  GL unbinds them, and attributes still pointing at them
+  // keep the old objects alive, which a new buffer with the same name must
+  // not be mistaken for.
+  void delete_buffers(GLsizei count, const GLuint* buffers) {
+    UTILS_GL_CHECK(glDeleteBuffers(count, buffers));
+    for (GLsizei i = 0; i < count; ++i) {
+      if (array_buffer_.is(buffers[i])) array_buffer_.set(0);
+      if (element_array_buffer_.is(buffers[i])) element_array_buffer_.set(0);
+      for (auto& a : attributes_)
+        if (a.pointer.valid() && a.pointer.value().buffer == buffers[i])
+          a.pointer.invalidate();
+    }
+  }
+
+  void enable_attribute(GLint location) {
+    if (location < 0 || location >= kMaxAttributes) {
+      UTILS_GL_CHECK(glEnableVertexAttribArray(location));
+      return;
+    }
+    auto& enabled = attributes_[location].enabled;
+    if (enabled.is(true)) return;
+    UTILS_GL_CHECK(glEnableVertexAttribArray(location));
+    enabled.set(true);
+  }
+
+  void disable_attribute(GLint location) {
+    if (location < 0 || location >= kMaxAttributes) {
+      UTILS_GL_CHECK(glDisableVertexAttribArray(location));
+      return;
+    }
+    auto& enabled = attributes_[location].enabled;
+    if (enabled.is(false)) return;
+    UTILS_GL_CHECK(glDisableVertexAttribArray(location));
+    enabled.set(false);
+  }
+
+  // Points an attribute at `offset` in the bound array buffer.
+  void attribute_pointer(GLint location, GLint size, GLenum type,
+                         GLboolean normalized, GLsizei stride, size_t offset) {
+    if (location < 0 || location >= kMaxAttributes ||
+        !array_buffer_.valid()) {
+      UTILS_GL_CHECK(glVertexAttribPointer(location, size, type, normalized,
+                                           stride, arrayOffset(offset)));
+      if (location >= 0 && location < kMaxAttributes)
+        attributes_[location].pointer.invalidate();
+      return;
+    }
+
+    const attribute_source source{array_buffer_.value(), size, type,
+                                  normalized, stride, offset};
+    auto& pointer = attributes_[location].pointer;
+    if (pointer.is(source)) return;
+    UTILS_GL_CHECK(glVertexAttribPointer(location, size, type, normalized,
+                                         stride, arrayOffset(offset)));
+    pointer.set(source);
+  }
+
+  // Sets an attribute's divisor through `vertex_attrib_divisor`, loaded
+  // from GL_EXT_instanced_arrays.
+  void attribute_divisor(PFNGLVERTEXATTRIBDIVISOREXTPROC vertex_attrib_divisor,
+                         GLint location, GLuint divisor) {
+    if (location < 0 || location >= kMaxAttributes) {
+      UTILS_GL_CHECK(vertex_attrib_divisor(location, divisor));
+      return;
+    }
+    auto& current = attributes_[location].divisor;
+    if (current.is(divisor)) return;
+    UTILS_GL_CHECK(vertex_attrib_divisor(location, divisor));
+    current.set(divisor);
+  }
+
+  void set_capability(GLenum capability, bool enabled) {
+    auto i = capabilities_.begin();
+    while (i != capabilities_.end() && i->first != capability) ++i;
+    if (i != capabilities_.end() && i->second == enabled) return;
+
+    if (enabled)
+      UTILS_GL_CHECK(glEnable(capability));
+    else
+      UTILS_GL_CHECK(glDisable(capability));
+
+    if (i != capabilities_.end())
+      i->second = enabled;
+    else
+      capabilities_.emplace_back(capability, enabled);
+  }
+
+  void clear_color(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha) {
+    const std::array<GLfloat, 4> color{{red, green, blue, alpha}};
+    if (clear_color_.is(color)) return;
+    UTILS_GL_CHECK(glClearColor(red, green, blue, alpha));
+    clear_color_.set(color);
+  }
+
+ private:
+  // A value that is either known to be current in GL, or unknown.
+  template <typename T>
+  class cached {
+   public:
+    bool valid() const { return valid_; }
+    const T& value() const { return value_; }
+    bool is(const T& value) const { return valid_ && value_ == value; }
+
+    void set(const T& value) {
+      value_ = value;
+      valid_ = true;
+    }
+
+    void invalidate() { valid_ = false; }
+
+   private:
+    T value_{};
+    bool valid_ = false;
+  };
+
+  // Arguments of glVertexAttribPointer(), and the buffer it captured.
+  struct attribute_source {
+    GLuint buffer;
+    GLint size;
+    GLenum type;
+    GLboolean normalized;
+    GLsizei stride;
+    size_t offset;
+
+    bool operator==(const attribute_source& rhs) const {
+      return buffer == rhs.buffer && size == rhs.size && type == rhs.type &&
+             normalized == rhs.normalized && stride == rhs.stride &&
+             offset == rhs.offset;
+    }
+  };
+
+  struct attribute {
+    cached<bool> enabled;
+    cached<attribute_source> pointer;
+    cached<GLuint> divisor;
+  };
+
+  gl_state() = default;
+
+  cached<GLuint>& buffer_binding(GLenum target) {
+    UTILS_REQUIRE(target == GL_ARRAY_BUFFER ||
+                  target == GL_ELEMENT_ARRAY_BUFFER);
+    return target == GL_ARRAY_BUFFER ? array_buffer_ : element_array_buffer_;
+  }
+
+  cached<GLuint> program_;
+  cached<GLuint> array_buffer_;
+  cached<GLuint> element_array_buffer_;
+  std::array<attribute, kMaxAttributes> attributes_;
+  std::vector<std::pair<GLenum, bool>> capabilities_;
+  cached<std::array<GLfloat, 4>> clear_color_;
+};
@@ -0,0 +1,396 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include "geometry/vector.h"
+#include "gl/program.h"
+#include "gl/state_cache.h"
+#include "utils/log.h"
+
+// Vertex layouts assembled from a position encoding and a color encoding.
+// Each encoding knows its storage type, how to set up its attribute, and the
+// GLSL needed to decode it, so that compact formats can be swapped in by
+// changing a template argument.
+//
+// Vertex shaders using a format start with shader_prelude(), and read the
+// vertex through vertex_position() and vertex_color().
+//
+// Formats with geomorphing also store the position and color each vertex
+// has in the next coarser level of detail, and blend towards them as the
+// shader function instance_morph() goes from 1 to 0.  That function must be
+// declared before the prelude.
+
+// Axis-aligned box that quantized positions are expressed relative to.
+struct position_bounds {
+  static position_bounds of(const vec3* positions, size_t count) {
+    if (!count) return position_bounds();
+
+    auto min = positions[0], max = positions[0];
+    for (size_t i = 1; i < count; ++i) {
+      min = vec3(std::min(min.x, positions[i].x),
+                 std::min(min.y, positions[i].y),
+                 std::min(min.z, positions[i].z));
+      max = vec3(std::max(max.x, positions[i].x),
+                 std::max(max.y, positions[i].y),
+                 std::max(max.z, positions[i].z));
+    }
+
+    return {(min + max) * 0.5f, (max - min) * 0.5f};
+  }
+
+  vec3 center;
+  vec3 half_extent{1.0f, 1.0f, 1.0f};
+};
+
+// 32-bit float positions; 12 bytes.
+struct float_position {
+  typedef vec3 storage;
+
+  static constexpr storage encode(const vec3& position,
+                                  const position_bounds&) {
+    return position;
+  }
+
+  static vec3 decode(const storage& position, const position_bounds&) {
+    return position;
+  }
+
+  static bool supported(const std::string&) { return true; }
+
+  static void set_attribute(GLint location, GLsizei stride, size_t offset) {
+    gl_state::current().attribute_pointer(location, 3, GL_FLOAT, GL_FALSE,
+                                          stride, offset);
+  }
+
+  static void set_uniforms(GLint, GLint, const position_bounds&) {}
+
+  static constexpr const char* kShaderPrelude =
+      "vec3 decode_position(vec3 p) { return p; }\n";
+};
+
+// Signed 16-bit positions within a bounding box, padded to 8 bytes.  The
+// integers are passed unnormalized, since GLES 2 and 3 disagree on how
+// normalized signed integers map to floats, and scaled in the shader.
+struct snorm16_position {
+  typedef std::array<int16_t, 4> storage;
+
+  static constexpr int16_t quantize(float v) {
+    return static_cast<int16_t>(v < 0.0f ? v * 32767.0f - 0.5f
+                                         : v * 32767.0f + 0.5f);
+  }
+
+  static constexpr storage encode(const vec3& position,
+                                  const position_bounds& bounds) {
+    return {{quantize((position.x - bounds.center.x) / bounds.half_extent.x),
+             quantize((position.y - bounds.center.y) / bounds.half_extent.y),
+             quantize((position.z - bounds.center.z) / bounds.half_extent.z),
+             0}};
+  }
+
+  static vec3 decode(const storage& position, const position_bounds& bounds) {
+    return vec3(position[0] * bounds.half_extent.x / 32767.0f,
+                position[1] * bounds.half_extent.y / 32767.0f,
+                position[2] * bounds.half_extent.z / 32767.0f) +
+           bounds.center;
+  }
+
+  static bool supported(const std::string&) { return true; }
+
+  static void set_attribute(GLint location, GLsizei stride, size_t offset) {
+    gl_state::current().attribute_pointer(location, 3, GL_SHORT, GL_FALSE,
+                                          stride, offset);
+  }
+
+  static void set_uniforms(GLint scale_location, GLint offset_location,
+                           const position_bounds& bounds) {
+    const auto scale = vec3(bounds.half_extent.x, bounds.half_extent.y,
+                            bounds.half_extent.z) /
+                       32767.0f;
+    UTILS_GL_CHECK(glUniform3fv(scale_location, 1, &scale.x));
+    UTILS_GL_CHECK(glUniform3fv(offset_location, 1, &bounds.center.x));
+  }
+
+  static constexpr const char* kShaderPrelude =
+      "uniform vec3 uniform_PositionScale;\n"
+      "uniform vec3 uniform_PositionOffset;\n"
+      "vec3 decode_position(vec3 p) {\n"
+      "  return p * uniform_PositionScale + uniform_PositionOffset;\n"
+      "}\n";
+};
+
+// Converts a float to IEEE 754 half precision, rounding to nearest even.
+inline uint16_t float_to_half(float value) {
+  uint32_t f;
+  memcpy(&f, &value, sizeof(f));
+
+  const uint32_t sign = (f >> 16) & 0x8000;
+  const int32_t exponent = static_cast<int32_t>((f >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = f & 0x7fffff;
+
+  if (((f >> 23) & 0xff) == 0xff)  // Infinity or NaN.
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+  if (exponent >= 0x1f) return sign | 0x7c00;  // Overflow.
+
+  if (exponent <= 0) {
+    // Subnormal or zero.
+    if (exponent < -10) return sign;
+    mantissa |= 0x800000;
+    const auto shift = 14 - exponent;
+    auto half = mantissa >> shift;
+    const auto rest = mantissa & ((1u << shift) - 1);
+    const auto halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1))) ++half;
+    return sign | half;
+  }
+
+  auto half = (exponent << 10) | (mantissa >> 13);
+  const auto rest = mantissa & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) ++half;
+  return sign | half;
+}
+
+inline float half_to_float(uint16_t half) {
+  const uint32_t sign = (half & 0x8000u) << 16;
+  const uint32_t exponent = (half >> 10) & 0x1f;
+  const uint32_t mantissa = half & 0x3ff;
+  if (!exponent) {
+    // Subnormal or zero.
+    const auto value = std::ldexp(static_cast<float>(mantissa), -24);
+    return sign ? -value : value;
+  }
+
+  uint32_t bits = sign | (mantissa << 13);
+  bits |= (exponent == 0x1f) ? 0x7f800000u : (exponent + 112) << 23;
+  float result;
+  memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+// Half precision float positions, padded to 8 bytes.  Requires
+// GL_OES_vertex_half_float, and cannot be encoded in constant expressions.
+struct half_position {
+  typedef std::array<uint16_t, 4> storage;
+
+  static storage encode(const vec3& position, const position_bounds&) {
+    return {{float_to_half(position.x), float_to_half(position.y),
+             float_to_half(position.z), 0}};
+  }
+
+  static vec3 decode(const storage& position, const position_bounds&) {
+    return vec3(half_to_float(position[0]), half_to_float(position[1]),
+                half_to_float(position[2]));
+  }
+
+  static bool supported(const std::string& extensions) {
+    return extensions.find("GL_OES_vertex_half_float") != std::string::npos;
+  }
+
+  static void set_attribute(GLint location, GLsizei stride, size_t offset) {
+    gl_state::current().attribute_pointer(
+        location, 3, GL_HALF_FLOAT_OES, GL_FALSE, stride, offset);
+  }
+
+  static void set_uniforms(GLint, GLint, const position_bounds&) {}
+
+  static constexpr const char* kShaderPrelude = float_position::kShaderPrelude;
+};
+
+// 8-bit RGB colors; 3 bytes, leaving the vertex unaligned.
+struct rgb8_color {
+  typedef std::array<uint8_t, 3> storage;
+
+  static constexpr storage encode(const std::array<uint8_t, 3>& color) {
+    return color;
+  }
+
+  static void set_attribute(GLint location, GLsizei stride, size_t offset) {
+    gl_state::current().attribute_pointer(
+        location, 3, GL_UNSIGNED_BYTE, GL_TRUE, stride, offset);
+  }
+
+  static constexpr const char* kAttributeType = "vec3";
+  static constexpr const char* kShaderPrelude =
+      "vec3 decode_color(vec3 c) { return c; }\n";
+};
+
+// 8-bit RGBA colors with opaque alpha, keeping vertices 4-byte aligned.
+struct rgba8_color {
+  typedef std::array<uint8_t, 4> storage;
+
+  static constexpr storage encode(const std::array<uint8_t, 3>& color) {
+    return {{color[0], color[1], color[2], 255}};
+  }
+
+  static void set_attribute(GLint location, GLsizei stride, size_t offset) {
+    gl_state::current().attribute_pointer(
+        location, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, offset);
+  }
+
+  static constexpr const char* kAttributeType = "vec4";
+  static constexpr const char* kShaderPrelude =
+      "vec3 decode_color(vec4 c) { return c.rgb; }\n";
+};
+
+// Attribute locations of the vertex inputs declared by
+// vertex_format::shader_prelude().
+struct vertex_attributes {
+  static vertex_attributes of(const shader_program& program) {
+    vertex_attributes result;
+    result.position = program.attribute("attr_VertexPosition");
+    result.color = program.attribute("attr_VertexColor");
+    result.morph_position = program.attribute("attr_VertexMorphPosition");
+    result.morph_color = program.attribute("attr_VertexMorphColor");
+    return result;
+  }
+
+  GLint position = -1;
+  GLint color = -1;
+  // -1 without geomorphing.
+  GLint morph_position = -1;
+  GLint morph_color = -1;
+};
+
+template <typename Position, typename Color, bool Morph>
+struct vertex_layout {
+  typename Position::storage position;
+  typename Color::storage color;
+};
+
+template <typename Position, typename Color>
+struct vertex_layout<Position, Color, true> {
+  typename Position::storage position;
+  typename Position::storage morph_position;
+  typename Color::storage color;
+  typename Color::storage morph_color;
+};
+
+template <typename Position, typename Color, bool Morph = false>
+struct vertex_format {
+  typedef vertex_layout<Position, Color, Morph> vertex;
+
+  static constexpr bool kMorph = Morph;
+
+  static constexpr vertex encode(const vec3& position,
+                                 const std::array<uint8_t, 3>& color,
+                                 const position_bounds& bounds) {
+    return {Position::encode(position, bounds), Color::encode(color)};
+  }
+
+  // For formats with geomorphing.
+  static constexpr vertex encode(const vec3& position,
+                                 const std::array<uint8_t, 3>& color,
+                                 const vec3& morph_position,
+                                 const std::array<uint8_t, 3>& morph_color,
+                                 const position_bounds& bounds) {
+    return {Position::encode(position, bounds),
+            Position::encode(morph_position, bounds), Color::encode(color),
+            Color::encode(morph_color)};
+  }
+
+  // Decodes the position of a vertex, for bounds computed on the CPU.
+  static vec3 position(const vertex& v, const position_bounds& bounds) {
+    return Position::decode(v.position, bounds);
+  }
+
+  // Decodes the position a vertex morphs from, which is the same as
+  // position() without geomorphing.
+  static vec3 morph_position(const vertex& v, const position_bounds& bounds) {
+    return morph_position(v, bounds, std::integral_constant<bool, Morph>());
+  }
+
+  static bool supported(const std::string& extensions) {
+    return Position::supported(extensions);
+  }
+
+  static std::string shader_prelude() {
+    const std::string color_type = Color::kAttributeType;
+    std::string result = std::string(Position::kShaderPrelude) +
+                         Color::kShaderPrelude +
+                         "attribute vec3 attr_VertexPosition;\n"
+                         "attribute " +
+                         color_type + " attr_VertexColor;\n";
+    if (!Morph) {
+      return result +
+             "vec3 vertex_position() {\n"
+             "  return decode_position(attr_VertexPosition);\n"
+             "}\n"
+             "vec3 vertex_color() { return decode_color(attr_VertexColor); }\n";
+    }
+
+    return result +
+           "attribute vec3 attr_VertexMorphPosition;\n"
+           "attribute " +
+           color_type +
+           " attr_VertexMorphColor;\n"
+           "vec3 vertex_position() {\n"
+           "  return mix(decode_position(attr_VertexMorphPosition),\n"
+           "             decode_position(attr_VertexPosition),\n"
+           "             instance_morph());\n"
+           "}\n"
+           "vec3 vertex_color() {\n"
+           "  return mix(decode_color(attr_VertexMorphColor),\n"
+           "             decode_color(attr_VertexColor), instance_morph());\n"
+           "}\n";
+  }
+
+  // Points the attributes at the currently bound vertex buffer, whose
+  // vertices start at byte `base`.
+  static void set_attributes(const vertex_attributes& attributes,
+                             size_t base = 0) {
+    Position::set_attribute(attributes.position, sizeof(vertex),
+                            base + offsetof(vertex, position));
+    Color::set_attribute(attributes.color, sizeof(vertex),
+                         base + offsetof(vertex, color));
+    set_morph_attributes(attributes, base,
+                         std::integral_constant<bool, Morph>());
+  }
+
+  static void enable_attributes(const vertex_attributes& attributes) {
+    auto& state = gl_state::current();
+    state.enable_attribute(attributes.position);
+    state.enable_attribute(attributes.color);
+    if (Morph) {
+      state.enable_attribute(attributes.morph_position);
+      state.enable_attribute(attributes.morph_color);
+    }
+  }
+
+  // Sets the dequantization uniforms, if the position encoding has any.
+  // Requires the program to be current.
+  static void set_uniforms(GLint scale_location, GLint offset_location,
+                           const position_bounds& bounds) {
+    Position::set_uniforms(scale_location, offset_location, bounds);
+  }
+
+ private:
+  static void set_morph_attributes(const vertex_attributes&, size_t,
+                                   std::false_type) {}
+
+  static void set_morph_attributes(const vertex_attributes& attributes,
+                                   size_t base, std::true_type) {
+    Position::set_attribute(attributes.morph_position, sizeof(vertex),
+                            base + offsetof(vertex, morph_position));
+    Color::set_attribute(attributes.morph_color, sizeof(vertex),
+                         base + offsetof(vertex, morph_color));
+  }
+
+  static vec3 morph_position(const vertex& v, const position_bounds& bounds,
+                             std::false_type) {
+    return position(v, bounds);
+  }
+
+  static vec3 morph_position(const vertex& v, const position_bounds& bounds,
+                             std::true_type) {
+    return Position::decode(v.morph_position, bounds);
+  }
+};
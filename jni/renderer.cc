@@ -0,0 +1,527 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include "geometry/culling.h"
+#include "geometry/lod.h"
+#include "geometry/meshlet.h"
+#include "geometry/sphere.h"
+#include "geometry/vector.h"
+#include "gl/error_check.h"
+#include "gl/gpu_timer.h"
+#include "gl/instancing.h"
+#include "gl/mesh.h"
+#include "gl/program.h"
+#include "gl/state_cache.h"
+#include "renderer.h"
+#include "scene.h"
+#include "sphere_mesh.h"
+#include "utils/arena.h"
+#include "utils/frame_stats.h"
+#include "utils/input_ring.h"
+#include "utils/job_system.h"
+#include "utils/log.h"
+#include "utils/mapped_file.h"
+#include "utils/mesh_file.h"
+
+namespace {
+
+// Follows the instancing and the vertex format prelude, which declare the
+// attributes.
+static const char kVertexShader[] =
+    "varying vec3 var_Color;\n"
+    "uniform mat4 uniform_ModelViewProjection;\n"
+    "\n"
+    "void main(void) {\n"
+    "  gl_Position = (uniform_ModelViewProjection\n"
+    "                 * vec4(instance_position(vertex_position()), 1.0));\n"
+    "  var_Color = vertex_color() * instance_color().rgb;\n"
+    "}\n";
+
+static const char kFragmentShader[] =
+    "precision mediump float;\n"
+    "varying vec3 var_Color;\n"
+    "void main(void) {\n"
+    "  gl_FragColor = vec4(var_Color, 1.0);\n"
+    "}\n";
+
+int window_width, window_height;
+
+// Depends only on the window size, so it is computed in surfaceChanged().
+mat4x4 projection;
+
+// Programs of the current context.
+program_registry programs;
+const shader_program* program;
+
+// Shader variables.
+GLint guModelViewProjection;
+GLint guPositionScale;
+GLint guPositionOffset;
+
+// The sphere at this quality is generated at compile time, and lives in
+// read-only data.  Other qualities are loaded from pre-baked or cached mesh
+// files, or generated at runtime.
+constexpr size_t kStaticSphereQuality = 1;
+
+constexpr auto kSphere = constexpr_sphere<uint16_t, kStaticSphereQuality>();
+constexpr auto kSphereVertices =
+    make_vertices(kSphere, std::make_index_sequence<kSphere.vertices.size()>());
+
+// The highest level of detail.  Every level from 0 up is loaded, and each
+// sphere is drawn at the level that matches its size on screen.
+size_t sphere_quality = 5;
+
+std::string cache_directory;
+mapped_file (*asset_loader)(const std::string& name);
+
+// All levels of detail of the sphere, one part per level.
+instanced_mesh<sphere_vertex_format> sphere_instances;
+
+// Bounds of the sphere mesh, which is the same at every quality.
+const auto kSphereBoundingSphere = [] {
+  auto result =
+      bounding_sphere::of(kSphere.vertices.data(), kSphere.vertices.size());
+  result.center = result.center * kSphereRadius;
+  result.radius *= kSphereRadius;
+  return result;
+}();
+
+size_t sphere_count = 1;
+scene objects;
+
+// Bounds of an object in world space, as of the last scene update.
+bounding_sphere object_bounds(size_t index) {
+  const auto transform = objects.transform(index);
+  return {transform * kSphereBoundingSphere.center,
+          kSphereBoundingSphere.radius * transform.scale};
+}
+
+// Bounding volume hierarchy over the objects, which do not move, and the
+// indices of the objects visible in the current frame.
+sphere_bvh object_bvh;
+std::vector<uint32_t> visible_objects;
+
+// Level of detail of each object.
+std::vector<lod_state> object_lods;
+
+// The level and instance data of each visible object, and the instance data
+// grouped by level for drawing, starting at lod_offsets[level].
+std::vector<uint8_t> visible_levels;
+std::vector<instance_data> visible_instances;
+std::vector<instance_data> lod_instances;
+std::vector<size_t> lod_offsets;
+
+// Runs per-frame work that does not touch GL.  Created with the first
+// surface, and kept for the life of the process.
+std::unique_ptr<job_system> jobs;
+
+// Visible objects handled by each job in level of detail selection.
+constexpr size_t kLodGrain = 1024;
+
+// Meshlet visibility tests handled by each job when masking meshlets.
+constexpr size_t kMeshletTestGrain = 4096;
+
+// Temporaries of the current frame, freed when the next one starts.
+arena frame_arena;
+
+// Keeps a mapped mesh file alive until it has been uploaded.
+mapped_file sphere_file;
+
+// Touch events, and the background flash they control.  Only touched by the
+// render thread.
+input_ring input;
+bool hold = false;
+float gray;
+
+uint64_t frame_counter;
+
+// Frames the camera has moved for, which sets its angle.
+bool camera_animation = true;
+uint64_t camera_frame;
+
+// Frame timing, logged every kStatsLogInterval frames.
+constexpr uint64_t kStatsLogInterval = 600;
+frame_stats stats;
+gpu_timer frame_gpu_timer;
+
+// Start of the previous frame, or the epoch if there was none since the
+// surface changed or the picture went still.  Gaps while paused or idle are
+// not frame intervals.
+frame_phase_timer::clock::time_point last_frame_start;
+
+// Maps a mesh file, and assigns it to `sphere_mesh` if it is current.
+template <typename IndexType>
+bool loadSphereFile(mapped_file file, size_t quality,
+                    mesh<vertex, IndexType>* sphere_mesh) {
+  mesh_file_view<vertex, IndexType> view;
+  if (!parse_mesh_file(file, sphere_mesh_key(quality), &view)) return false;
+
+  sphere_file = std::move(file);
+  sphere_mesh->assign_external(view.vertices, view.vertex_count, view.indices,
+                               view.index_count);
+  return true;
+}
+
+// Assigns the sphere mesh generated at compile time, if it has the quality.
+bool loadStaticSphere(size_t quality, mesh<vertex, uint16_t>* sphere_mesh) {
+  if (quality != kStaticSphereQuality) return false;
+  sphere_mesh->assign_external(kSphereVertices.data(), kSphereVertices.size(),
+                               kSphere.indices.data(), kSphere.indices.size());
+  return true;
+}
+
+bool loadStaticSphere(size_t, mesh<vertex, uint32_t>*) { return false; }
+
+// Assigns a sphere mesh from the first available source: the compile time
+// tables, a mesh file shipped with the application, a mesh file cached by a
+// previous run, or the generator.  A generated mesh lives in `scratch` until
+// it is reset.  Qualities that need 32-bit indices have them in every
+// source.
+template <typename IndexType>
+void loadSphere(size_t quality, mesh<vertex, IndexType>* sphere_mesh,
+                arena* scratch) {
+  if (loadStaticSphere(quality, sphere_mesh)) return;
+
+  const auto name = sphere_mesh_file_name(quality);
+  const auto cache_path = cache_directory + "/" + name;
+
+  if (asset_loader && loadSphereFile(asset_loader(name), quality, sphere_mesh))
+    return;
+  if (!cache_directory.empty() &&
+      loadSphereFile(mapped_file::open(cache_path), quality, sphere_mesh))
+    return;
+
+  std::vector<vertex, arena_allocator<vertex>> vertices(
+      (arena_allocator<vertex>(scratch)));
+  std::vector<IndexType, arena_allocator<IndexType>> indices(
+      (arena_allocator<IndexType>(scratch)));
+  make_sphere_mesh(quality, &vertices, &indices,
+                   arena_allocator<vec3>(scratch));
+
+  if (!cache_directory.empty()) {
+    try {
+      write_mesh_file(cache_path, sphere_mesh_key(quality),
+                      vertices.data(), vertices.size(), indices.data(),
+                      indices.size());
+    } catch (std::runtime_error& e) {
+      // Not fatal; the mesh is generated again next time.
+      error("Failed to cache mesh: %s", e.what());
+    }
+  }
+
+  // The arena does not free the vectors' storage when they go out of scope.
+  sphere_mesh->assign_external(vertices.data(), vertices.size(),
+                               indices.data(), indices.size());
+}
+
+// Adds one level of detail to the instanced mesh.
+template <typename IndexType>
+void loadSphereLevel(size_t level, arena* scratch) {
+  mesh<vertex, IndexType> level_mesh;
+  loadSphere(level, &level_mesh, scratch);
+  sphere_instances.add_part(level_mesh.vertex_data(),
+                            level_mesh.vertex_count(), level_mesh.index_data(),
+                            level_mesh.index_count(), kSphereBounds);
+  sphere_file.reset();
+  scratch->reset();
+}
+
+// Adds every level of detail up to sphere_quality to the instanced mesh.
+void loadSphereLevels(const std::string& extensions) {
+  sphere_instances.prepare(extensions);
+
+  arena scratch;
+  for (size_t level = 0; level <= sphere_quality; ++level) {
+    if (sphere_fits_uint16(level))
+      loadSphereLevel<uint16_t>(level, &scratch);
+    else
+      loadSphereLevel<uint32_t>(level, &scratch);
+  }
+
+  // Only the GL copy is needed from here on.  If the context is lost, the
+  // levels are loaded again.
+  sphere_instances.upload();
+}
+
+// Places the spheres in a cubic grid the size of a single sphere.  A single
+// sphere is white, and the others get random tints.
+void populateScene() {
+  objects.clear();
+  objects.reserve(sphere_count);
+
+  const auto side = static_cast<size_t>(
+      std::ceil(std::cbrt(static_cast<double>(sphere_count)) - 1e-9));
+  const auto spacing = 2.5f * kSphereRadius / side;
+  const auto origin = -0.5f * spacing * (side - 1);
+
+  for (size_t i = 0; i < sphere_count; ++i) {
+    const vec3 position(origin + spacing * (i % side),
+                        origin + spacing * (i / side % side),
+                        origin + spacing * (i / side / side));
+    std::array<uint8_t, 4> color{{255, 255, 255, 255}};
+    if (sphere_count > 1) {
+      const auto random = vertex_color(i + 0x10000);
+      for (size_t j = 0; j < 3; ++j) color[j] = 128 + random[j] / 2;
+    }
+    objects.add(affine_transform(vec4(0.0f, 0.0f, 0.0f, 1.0f), position,
+                                 1.0f / side),
+                color);
+  }
+  objects.update();
+
+  bounding_spheres bounds;
+  bounds.reserve(objects.size());
+  for (size_t i = 0; i < objects.size(); ++i)
+    bounds.push_back(object_bounds(i));
+  object_bvh.build(bounds);
+  visible_objects.resize(objects.size());
+  visible_levels.resize(objects.size());
+  visible_instances.resize(objects.size());
+  lod_instances.resize(objects.size());
+  object_lods.assign(objects.size(), lod_state());
+}
+
+// Handles the touch events added since the previous frame.  Touching flashes
+// the background, which fades once released.  Positions are not used yet, so
+// only the last of each run of moves is looked at.
+void handleInput() {
+  input.drain_coalesced([](const input_event& event) {
+    switch (event.action) {
+      case input_action::down:
+        gray = 1.0f;
+        hold = true;
+        break;
+
+      case input_action::move:
+        break;
+
+      case input_action::up:
+        hold = false;
+        break;
+    }
+  });
+}
+
+}  // namespace
+
+void setSphereQuality(int quality) {
+  if (quality >= 0) sphere_quality = quality;
+}
+
+void setSphereCount(int count) { sphere_count = std::max(count, 1); }
+
+void setCameraAnimation(bool enabled) { camera_animation = enabled; }
+
+void setCacheDirectory(const std::string& path) { cache_directory = path; }
+
+void setAssetLoader(mapped_file (*loader)(const std::string& name)) {
+  asset_loader = loader;
+}
+
+void setInputBuffer(void* buffer, size_t size) {
+  input = input_ring(buffer, size);
+}
+
+void surfaceCreated() {
+  // A new GL context has been created, and the old one is gone along with
+  // all of its objects.
+  sphere_instances.context_lost();
+  frame_gpu_timer.context_lost();
+  programs.context_lost();
+  gl_state::current().invalidate();
+}
+
+void surfaceChanged(int width, int height) {
+  const std::string extensions =
+      reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+  UTILS_REQUIRE(sphere_vertex_format::supported(extensions));
+
+  gl_enable_debug_output(extensions);
+  gl_check_setup();
+
+  if (!sphere_instances.has_data()) loadSphereLevels(extensions);
+  if (!frame_gpu_timer.available()) frame_gpu_timer.prepare(extensions);
+  if (!jobs) jobs.reset(new job_system());
+  last_frame_start = {};
+
+  if (objects.size() != sphere_count) populateScene();
+
+  const auto vertex_shader = sphere_instances.shader_prelude() +
+                             sphere_vertex_format::shader_prelude() +
+                             kVertexShader;
+  // A rotation recreates the activity and its context, so surfaceCreated()
+  // has forgotten the program, which is then loaded from the binary cache if
+  // the driver supports it.  Later surface changes find it already built.
+  if (!programs.size()) programs.prepare(extensions, cache_directory);
+  program = &programs.get(vertex_shader, kFragmentShader);
+
+  sphere_instances.set_program(*program);
+  guModelViewProjection = program->uniform("uniform_ModelViewProjection");
+  guPositionScale = program->uniform("uniform_PositionScale");
+  guPositionOffset = program->uniform("uniform_PositionOffset");
+
+  gl_state::current().use_program(program->id());
+  sphere_vertex_format::set_uniforms(guPositionScale, guPositionOffset,
+                                     kSphereBounds);
+
+  UTILS_GL_CHECK(glViewport(0, 0, width, height));
+  projection = mat4x4::projection(1.0f, M_PI / 8.0f,
+                                  static_cast<float>(width) / height);
+
+  gl_state::current().set_capability(GL_CULL_FACE, true);
+  gl_state::current().set_capability(GL_DEPTH_TEST, true);
+
+  window_width = width;
+  window_height = height;
+}
+
+bool drawFrame() {
+  frame_sample sample;
+  const auto frame_start = frame_phase_timer::clock::now();
+  if (last_frame_start != frame_phase_timer::clock::time_point())
+    sample[frame_metric::interval] =
+        std::chrono::duration_cast<std::chrono::microseconds>(frame_start -
+                                                              last_frame_start)
+            .count();
+  last_frame_start = frame_start;
+  frame_phase_timer total_timer(sample, frame_metric::cpu_total);
+  frame_arena.reset();
+
+  handleInput();
+  if (!hold) gray = std::max(0.0f, gray - 0.08f);
+
+  const auto camera_angle = (camera_frame % 180) * 2 * M_PI / 180;
+  const auto camera =
+      rigid_transform::from_rotation(
+          vec4::rotation(0.0f, 1.0f, 0.0f, camera_angle)) *
+      rigid_transform::from_translation(0.0f, 0.0f, 50.0f);
+  const auto view = camera.invert();
+  const auto camera_projection = projection * view.to_mat4x4();
+
+  frame_phase_timer scene_timer(sample, frame_metric::cpu_scene);
+
+  // Only objects that moved, and those attached to them, cost anything here.
+  for (const auto index : objects.update())
+    object_bvh.update(index, object_bounds(index));
+
+  const auto view_frustum = frustum::from_matrix(camera_projection);
+  const auto visible_count =
+      object_bvh.cull(view_frustum, visible_objects.data(), *jobs);
+
+  // Objects that leave the view keep their level, and catch up with
+  // hysteresis when they come back.
+  const lod_selector selector(sphere_quality);
+  std::atomic<bool> lod_changed(false);
+  jobs->parallel_for(visible_count, kLodGrain, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const auto index = visible_objects[i];
+      const auto transform = objects.transform(index);
+      const auto center = view * (transform * kSphereBoundingSphere.center);
+      const auto radius = selector.screen_radius(
+          projection, window_height,
+          kSphereBoundingSphere.radius * transform.scale, -center.z);
+
+      auto& lod = object_lods[index];
+      const auto previous = lod;
+      selector.update(lod, radius);
+      if (lod.level != previous.level || lod.morph != previous.morph)
+        lod_changed.store(true, std::memory_order_relaxed);
+      visible_levels[i] = lod.level;
+      visible_instances[i] =
+          make_instance_data(transform, objects.color(index), lod.morph);
+    }
+  });
+
+  // Group the instances by level, keeping their order within each.
+  lod_offsets.assign(sphere_quality + 2, 0);
+  for (size_t i = 0; i < visible_count; ++i)
+    ++lod_offsets[visible_levels[i] + 1];
+  for (size_t level = 1; level < lod_offsets.size(); ++level)
+    lod_offsets[level] += lod_offsets[level - 1];
+  {
+    const auto next = frame_arena.allocate_array<size_t>(lod_offsets.size());
+    std::copy(lod_offsets.begin(), lod_offsets.end(), next);
+    for (size_t i = 0; i < visible_count; ++i)
+      lod_instances[next[visible_levels[i]]++] = visible_instances[i];
+  }
+
+  // Levels split into meshlets only draw those some instance can show.
+  const auto eye = camera.translation;
+  const auto meshlet_masks =
+      frame_arena.allocate_array<const uint8_t*>(sphere_quality + 1);
+  for (size_t level = 0; level <= sphere_quality; ++level) {
+    meshlet_masks[level] = nullptr;
+    const auto meshlet_count = sphere_instances.meshlet_count(level);
+    if (meshlet_count < 2) continue;
+
+    // Each meshlet takes up to one test per instance at its level.
+    const auto meshlets = sphere_instances.meshlets(level);
+    const auto mask = frame_arena.allocate_array<uint8_t>(meshlet_count);
+    const auto instance_count = lod_offsets[level + 1] - lod_offsets[level];
+    const auto grain = kMeshletTestGrain / std::max<size_t>(instance_count, 1);
+    jobs->parallel_for(meshlet_count, grain, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        mask[i] = 0;
+        for (auto j = lod_offsets[level];
+             j < lod_offsets[level + 1] && !mask[i]; ++j)
+          mask[i] = meshlets[i].visible(instance_transform(lod_instances[j]),
+                                        view_frustum, eye);
+      }
+    });
+    meshlet_masks[level] = mask;
+  }
+
+  scene_timer.stop();
+  frame_phase_timer submit_timer(sample, frame_metric::cpu_submit);
+  frame_gpu_timer.begin();
+
+  gl_state::current().clear_color(gray * 0.5, gray, gray, 1.0f);
+  UTILS_GL_CHECK(glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT));
+
+  gl_state::current().use_program(program->id());
+  UTILS_GL_CHECK(glUniformMatrix4fv(guModelViewProjection, 1, GL_FALSE,
+                                    &camera_projection.m[0][0]));
+
+  for (size_t level = 0; level + 1 < lod_offsets.size(); ++level)
+    sphere_instances.draw(level, lod_instances.data() + lod_offsets[level],
+                          lod_offsets[level + 1] - lod_offsets[level],
+                          meshlet_masks[level]);
+
+  frame_gpu_timer.end();
+  gl_check_frame();
+  submit_timer.stop();
+
+  uint64_t gpu_nanoseconds;
+  if (frame_gpu_timer.poll(&gpu_nanoseconds))
+    sample[frame_metric::gpu] = gpu_nanoseconds / 1000;
+
+  total_timer.stop();
+  stats.commit(sample);
+  if (stats.frames() % kStatsLogInterval == 0) stats.log();
+
+  ++frame_counter;
+  if (camera_animation) ++camera_frame;
+
+  // A held touch keeps the background still, and morphs settle once every
+  // visible object is at its level.
+  const auto animating = camera_animation || (!hold && gray > 0.0f) ||
+                         lod_changed.load(std::memory_order_relaxed);
+  if (!animating) last_frame_start = frame_phase_timer::clock::time_point();
+  return animating;
+}
+
+void getFrameStats(std::array<float, frame_stats::kSnapshotSize>* result) {
+  stats.snapshot(result);
+}
+
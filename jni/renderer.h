@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <string>
+
+#include "utils/frame_stats.h"
+#include "utils/mapped_file.h"
+
+// The native renderer.  The functions from surfaceCreated() on must be called
+// from the thread that owns the GL context, and throw std::runtime_error on
+// failure.  The configuration functions must be called before the renderer
+// thread starts.
+
+// Selects the highest subdivision level of the spheres.  Negative values keep
+// the default.
+void setSphereQuality(int quality);
+
+// Sets the number of spheres drawn, arranged in a grid.
+void setSphereCount(int count);
+
+// Turns the orbiting of the camera around the spheres on or off.  It is on
+// by default.
+void setCameraAnimation(bool enabled);
+
+// Sets a writable directory where generated meshes are cached between runs.
+void setCacheDirectory(const std::string& path);
+
+// Sets a function that maps pre-baked mesh files shipped with the
+// application, returning an empty mapping if `name` does not exist.
+void setAssetLoader(mapped_file (*loader)(const std::string& name));
+
+// Sets the ring buffer of touch events written by the UI thread, laid out as
+// described in utils/input_ring.h.  drawFrame() handles the events added
+// since the previous frame.
+void setInputBuffer(void* buffer, size_t size);
+
+// Called when a new GL context has been created.
+void surfaceCreated();
+
+// Called when the surface size changes, including right after creation.
+void surfaceChanged(int width, int height);
+
+// Draws a frame.  Returns true if the next frame would differ, as when the
+// camera is moving or an animation is running, and false once the picture is
+// still, after which frames only need to be drawn again on input.
+bool drawFrame();
+
+// Copies the frame count, followed by the 50th, 95th and 99th percentiles in
+// milliseconds of each frame_metric over the last few seconds.  May be called
+// from any thread.
+void getFrameStats(std::array<float, frame_stats::kSnapshotSize>* result);
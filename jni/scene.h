@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "geometry/transform_hierarchy.h"
+#include "geometry/vector.h"
+
+// The objects drawn each frame: instances of the sphere mesh, each with a
+// transform, which may be relative to another object's, and a color that
+// tints the mesh's vertex colors.
+class scene {
+ public:
+  static constexpr uint32_t kNoParent = transform_hierarchy::kNoParent;
+
+  void reserve(size_t count) {
+    transforms_.reserve(count);
+    colors_.reserve(count);
+  }
+
+  // Adds an object below `parent`, and returns its index.
+  size_t add(const affine_transform& transform,
+             const std::array<uint8_t, 4>& color,
+             uint32_t parent = kNoParent) {
+    colors_.push_back(color);
+    return transforms_.add(transform, parent);
+  }
+
+  // Moves an object relative to its parent.  Takes effect in update().
+  void set_transform(size_t i, const affine_transform& transform) {
+    transforms_.set_local(i, transform);
+  }
+
+  // Recomputes the world transforms of moved objects and their descendants,
+  // and returns their indices.
+  const std::vector<uint32_t>& update() { return transforms_.update(); }
+
+  // The world transform of an object, as of the last update().
+  affine_transform transform(size_t i) const { return transforms_.world(i); }
+
+  const std::array<uint8_t, 4>& color(size_t i) const { return colors_[i]; }
+
+  size_t size() const { return colors_.size(); }
+  bool empty() const { return colors_.empty(); }
+
+  void clear() {
+    transforms_.clear();
+    colors_.clear();
+  }
+
+ private:
+  transform_hierarchy transforms_;
+  std::vector<std::array<uint8_t, 4>> colors_;
+};
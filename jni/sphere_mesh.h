@@ -0,0 +1,121 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "geometry/sphere.h"
+#include "geometry/vector.h"
+#include "geometry/vertex_cache.h"
+#include "gl/vertex_format.h"
+#include "utils/arena.h"
+#include "utils/log.h"
+
+// The colored sphere drawn by the renderer, shared with the host tools that
+// pre-bake it.
+
+// 16-bit positions and padded RGBA colors, with the same again for the next
+// coarser level of detail to morph towards; 24 bytes per vertex.
+typedef vertex_format<snorm16_position, rgba8_color, true>
+    sphere_vertex_format;
+typedef sphere_vertex_format::vertex vertex;
+
+constexpr float kSphereRadius = 10.0f;
+
+// Positions are quantized relative to the sphere's bounding box.
+constexpr position_bounds kSphereBounds{
+    vec3(), vec3(kSphereRadius, kSphereRadius, kSphereRadius)};
+
+// Bump whenever the generated mesh changes, so that cached files go stale.
+constexpr uint32_t kSphereMeshVersion = 5;
+
+// Returns a pseudo-random color for vertex `i`.  std::mt19937_64 cannot be
+// used in constant expressions, so this is the splitmix64 finalizer.
+constexpr std::array<uint8_t, 3> vertex_color(uint64_t i) {
+  auto x = (i + 1) * 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return {{static_cast<uint8_t>(x), static_cast<uint8_t>(x >> 8),
+           static_cast<uint8_t>(x >> 16)}};
+}
+
+// Returns the color a coarser level of detail shows halfway between two
+// vertices.
+constexpr std::array<uint8_t, 3> average_color(
+    const std::array<uint8_t, 3>& a, const std::array<uint8_t, 3>& b) {
+  return {{static_cast<uint8_t>((a[0] + b[0] + 1) / 2),
+           static_cast<uint8_t>((a[1] + b[1] + 1) / 2),
+           static_cast<uint8_t>((a[2] + b[2] + 1) / 2)}};
+}
+
+// Encodes vertex `i` of a sphere() mesh, morphing towards the midpoint of its
+// parents.
+template <typename Positions, typename IndexType>
+constexpr vertex make_vertex(const Positions& positions, size_t i,
+                             const std::array<IndexType, 2>& parents) {
+  return sphere_vertex_format::encode(
+      positions[i] * kSphereRadius, vertex_color(i),
+      (positions[parents[0]] + positions[parents[1]]) * (0.5f * kSphereRadius),
+      average_color(vertex_color(parents[0]), vertex_color(parents[1])),
+      kSphereBounds);
+}
+
+template <size_t Quality, size_t... I>
+constexpr std::array<vertex, sizeof...(I)> make_vertices(
+    const sphere_tables<uint16_t, Quality>& tables,
+    std::index_sequence<I...>) {
+  return {{make_vertex(
+      tables.vertices, I,
+      constexpr_sphere_parents(Quality, tables.indices, I))...}};
+}
+
+// Returns true if sphere meshes of the given quality can use 16-bit indices.
+// Higher qualities need 32-bit indices.
+constexpr bool sphere_fits_uint16(size_t quality) {
+  return sphere_vertex_count(quality) <= size_t(1) << 16;
+}
+
+// Generates the sphere at runtime, for any quality the index type can
+// address, ordered for the vertex cache.  Temporaries are allocated with
+// `scratch`, and the outputs keep their storage, so with an arena_allocator
+// and reused outputs, repeated builds need no heap allocations.
+template <typename IndexType, typename VertexAllocator,
+          typename IndexAllocator, typename Allocator = std::allocator<vec3>>
+void make_sphere_mesh(size_t quality,
+                      std::vector<vertex, VertexAllocator>* vertices,
+                      std::vector<IndexType, IndexAllocator>* indices,
+                      const Allocator& scratch = Allocator()) {
+  UTILS_REQUIRE(sphere_vertex_count(quality) - 1 <=
+                std::numeric_limits<IndexType>::max());
+
+  rebind_vector<vec3, Allocator> positions(scratch);
+  rebind_vector<IndexType, Allocator> sphere_indices(scratch);
+  sphere(quality, &positions, &sphere_indices);
+
+  rebind_vector<std::array<IndexType, 2>, Allocator> parents(positions.size(),
+                                                             scratch);
+  sphere_parents(quality, sphere_indices.data(), sphere_indices.size(),
+                 parents.data());
+
+  vertices->clear();
+  vertices->reserve(positions.size());
+  for (size_t i = 0; i < positions.size(); ++i)
+    vertices->push_back(make_vertex(positions, i, parents[i]));
+  indices->assign(sphere_indices.begin(), sphere_indices.end());
+
+  optimize_mesh(vertices, indices, scratch);
+}
+
+// Key identifying a cached sphere mesh file.
+inline uint64_t sphere_mesh_key(size_t quality) {
+  return (static_cast<uint64_t>(kSphereMeshVersion) << 32) | quality;
+}
+
+inline std::string sphere_mesh_file_name(size_t quality) {
+  return "sphere-q" + std::to_string(quality) + ".mesh";
+}
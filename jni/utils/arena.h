@@ -0,0 +1,135 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// A bump allocator for scratch data that dies all at once, such as the
+// temporaries of one frame or of one mesh load.  allocate() hands out
+// consecutive pieces of a block, and reset() frees everything by rewinding,
+// in constant time.  Nothing is freed individually.
+//
+// When the block runs out, more blocks are chained on.  The next reset()
+// replaces them with a single block of the combined size, so once the
+// largest round has been seen, the same work runs without touching the heap.
+class arena {
+ public:
+  explicit arena(size_t initial_size = 0) { grow(initial_size); }
+
+  arena(const arena&) = delete;
+  arena& operator=(const arena&) = delete;
+
+  // Returns `size` bytes aligned to `alignment`, which must be a power of
+  // two no greater than alignof(std::max_align_t).
+  void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+    auto offset = (offset_ + alignment - 1) & ~(alignment - 1);
+    if (offset + size > size_) {
+      overflow(size);
+      offset = 0;
+    }
+    offset_ = offset + size;
+    used_ += size;
+    return block_ + offset;
+  }
+
+  // Returns uninitialized storage for `count` objects of type T.
+  template <typename T>
+  T* allocate_array(size_t count) {
+    return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+  }
+
+  // Frees everything allocated since the last reset().
+  void reset() {
+    if (!overflow_.empty()) {
+      overflow_.clear();
+      grow(capacity_ + overflow_bytes_);
+      overflow_bytes_ = 0;
+    }
+    block_ = reinterpret_cast<uint8_t*>(storage_.get());
+    size_ = capacity_;
+    offset_ = 0;
+    used_ = 0;
+  }
+
+  // Bytes handed out since the last reset(), without alignment padding.
+  size_t used() const { return used_; }
+
+  // Size of the block reused after reset().
+  size_t capacity() const { return capacity_; }
+
+ private:
+  static constexpr size_t kMinimumBlockSize = 4096;
+
+  void grow(size_t size) {
+    capacity_ = std::max(size, size_t(kMinimumBlockSize));
+    storage_.reset(new std::max_align_t[block_units(capacity_)]);
+    block_ = reinterpret_cast<uint8_t*>(storage_.get());
+    size_ = capacity_;
+    offset_ = 0;
+  }
+
+  // Chains a block large enough for `size` bytes, and at least as large as
+  // everything allocated so far, so that chains stay short.
+  void overflow(size_t size) {
+    const auto block_size =
+        std::max(size, std::max(capacity_, overflow_bytes_));
+    overflow_.emplace_back(new std::max_align_t[block_units(block_size)]);
+    overflow_bytes_ += block_size;
+    block_ = reinterpret_cast<uint8_t*>(overflow_.back().get());
+    size_ = block_size;
+  }
+
+  static size_t block_units(size_t size) {
+    return (size + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t);
+  }
+
+  std::unique_ptr<std::max_align_t[]> storage_;
+  std::vector<std::unique_ptr<std::max_align_t[]>> overflow_;
+  size_t capacity_ = 0;
+  size_t overflow_bytes_ = 0;
+
+  // The block being allocated from, its size, and the first free byte.
+  uint8_t* block_ = nullptr;
+  size_t size_ = 0;
+  size_t offset_ = 0;
+  size_t used_ = 0;
+};
+
+// Standard allocator handing out memory from an arena, for containers of
+// scratch data.  Deallocation does nothing, so a growing vector leaves its
+// old storage behind until the arena is reset; reserve() up front.
+template <typename T>
+class arena_allocator {
+ public:
+  typedef T value_type;
+
+  explicit arena_allocator(arena* a) : arena_(a) {}
+
+  template <typename U>
+  arena_allocator(const arena_allocator<U>& rhs) : arena_(rhs.get_arena()) {}
+
+  T* allocate(size_t n) { return arena_->allocate_array<T>(n); }
+  void deallocate(T*, size_t) {}
+
+  arena* get_arena() const { return arena_; }
+
+  template <typename U>
+  bool operator==(const arena_allocator<U>& rhs) const {
+    return arena_ == rhs.get_arena();
+  }
+  template <typename U>
+  bool operator!=(const arena_allocator<U>& rhs) const {
+    return arena_ != rhs.get_arena();
+  }
+
+ private:
+  arena* arena_;
+};
+
+// A std::vector of T whose allocator is `Allocator` rebound to T.  Used for
+// scratch buffers that take their allocator from a caller.
+template <typename T, typename Allocator>
+using rebind_vector = std::vector<
+    T, typename std::allocator_traits<Allocator>::template rebind_alloc<T>>;
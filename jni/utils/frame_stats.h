@@ -0,0 +1,195 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+
+#include "utils/log.h"
+
+// Rolling frame time statistics, cheap enough to leave on in release builds.
+// The render thread measures a frame into a frame_sample and commits it once;
+// other threads read percentiles through snapshot().
+
+// The measured quantities, in the order they appear in snapshots.
+enum class frame_metric {
+  // Time from the start of the previous frame to the start of this one,
+  // including buffer swaps and vsync waits.  Jank shows up here first.
+  interval,
+  // CPU time spent in drawFrame().
+  cpu_total,
+  // Culling and level of detail selection.
+  cpu_scene,
+  // Issuing GL commands.
+  cpu_submit,
+  // GPU time, from GL_EXT_disjoint_timer_query.  Arrives a few frames late,
+  // and is missing without the extension.
+  gpu,
+  count,
+};
+
+constexpr size_t kFrameMetricCount = static_cast<size_t>(frame_metric::count);
+
+// Histogram of durations over the last kWindow samples, with buckets about 6%
+// wide from 32 microseconds up to two minutes.
+class duration_histogram {
+ public:
+  // About ten seconds at 60 frames per second.
+  static constexpr size_t kWindow = 600;
+
+  void add(uint32_t microseconds) {
+    if (count_ == kWindow)
+      --counts_[window_[next_]];
+    else
+      ++count_;
+
+    const auto b = bucket(microseconds);
+    window_[next_] = b;
+    ++counts_[b];
+    next_ = (next_ + 1) % kWindow;
+  }
+
+  size_t count() const { return count_; }
+
+  // Returns the upper bound, in milliseconds, of the bucket holding the
+  // fraction `p` of the samples, or 0 if there are none.
+  float percentile(float p) const {
+    if (!count_) return 0.0f;
+
+    const auto target = std::max<size_t>(1, std::ceil(p * count_));
+    size_t seen = 0;
+    for (size_t b = 0; b < kBuckets; ++b) {
+      seen += counts_[b];
+      if (seen >= target) return upper_bound(b) * 1e-3f;
+    }
+    return upper_bound(kBuckets - 1) * 1e-3f;
+  }
+
+ private:
+  // Values below 32 get a bucket each; above, each power of two is split in
+  // 16.
+  static constexpr unsigned kLinear = 32;
+  static constexpr unsigned kSubBuckets = 16;
+  static constexpr unsigned kMaxExponent = 26;
+  static constexpr size_t kBuckets =
+      kLinear + (kMaxExponent - 4) * kSubBuckets;
+
+  static uint16_t bucket(uint32_t value) {
+    if (value < kLinear) return value;
+
+    unsigned exponent = 31 - __builtin_clz(value);
+    if (exponent > kMaxExponent) return kBuckets - 1;
+    const auto sub = (value >> (exponent - 4)) & (kSubBuckets - 1);
+    return kLinear + (exponent - 5) * kSubBuckets + sub;
+  }
+
+  static uint32_t upper_bound(size_t bucket) {
+    if (bucket < kLinear) return bucket;
+
+    const auto exponent = (bucket - kLinear) / kSubBuckets + 5;
+    const auto sub = (bucket - kLinear) % kSubBuckets;
+    return ((kSubBuckets + sub + 1) << (exponent - 4)) - 1;
+  }
+
+  std::array<uint16_t, kBuckets> counts_{};
+  std::array<uint16_t, kWindow> window_{};
+  size_t next_ = 0;
+  size_t count_ = 0;
+};
+
+// Durations of one frame, in microseconds.  Negative values are not
+// recorded.
+struct frame_sample {
+  frame_sample() { durations.fill(-1); }
+
+  int64_t& operator[](frame_metric metric) {
+    return durations[static_cast<size_t>(metric)];
+  }
+
+  std::array<int64_t, kFrameMetricCount> durations;
+};
+
+// Measures the time from construction to stop(), or to destruction, into a
+// frame_sample.
+class frame_phase_timer {
+ public:
+  typedef std::chrono::steady_clock clock;
+
+  frame_phase_timer(frame_sample& sample, frame_metric metric)
+      : sample_(sample), metric_(metric), start_(clock::now()) {}
+
+  ~frame_phase_timer() { stop(); }
+
+  void stop() {
+    if (stopped_) return;
+    stopped_ = true;
+    sample_[metric_] = std::chrono::duration_cast<std::chrono::microseconds>(
+                           clock::now() - start_)
+                           .count();
+  }
+
+ private:
+  frame_sample& sample_;
+  frame_metric metric_;
+  clock::time_point start_;
+  bool stopped_ = false;
+};
+
+class frame_stats {
+ public:
+  // Number of floats written by snapshot(): the frame count, followed by the
+  // 50th, 95th and 99th percentiles of each metric in milliseconds.
+  static constexpr size_t kSnapshotSize = 1 + 3 * kFrameMetricCount;
+
+  void commit(const frame_sample& sample) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++frames_;
+    for (size_t i = 0; i < kFrameMetricCount; ++i) {
+      const auto duration = sample.durations[i];
+      if (duration >= 0)
+        histograms_[i].add(static_cast<uint32_t>(
+            std::min<int64_t>(duration, std::numeric_limits<uint32_t>::max())));
+    }
+  }
+
+  uint64_t frames() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return frames_;
+  }
+
+  void snapshot(std::array<float, kSnapshotSize>* result) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto out = result->begin();
+    *out++ = static_cast<float>(frames_);
+    for (const auto& histogram : histograms_) {
+      *out++ = histogram.percentile(0.50f);
+      *out++ = histogram.percentile(0.95f);
+      *out++ = histogram.percentile(0.99f);
+    }
+  }
+
+  // Logs the percentiles of every metric with samples.
+  void log() const {
+    static const char* const kNames[kFrameMetricCount] = {
+        "interval", "cpu_total", "cpu_scene", "cpu_submit", "gpu"};
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < kFrameMetricCount; ++i) {
+      const auto& histogram = histograms_[i];
+      if (!histogram.count()) continue;
+      info("frame %llu %s p50=%.2fms p95=%.2fms p99=%.2fms",
+           static_cast<unsigned long long>(frames_), kNames[i],
+           histogram.percentile(0.50f), histogram.percentile(0.95f),
+           histogram.percentile(0.99f));
+    }
+  }
+
+ private:
+  mutable std::mutex mutex_;
+  uint64_t frames_ = 0;
+  std::array<duration_histogram, kFrameMetricCount> histograms_;
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Touch events passed from the UI thread to the render thread through a
+// single-producer, single-consumer ring buffer in memory shared with Java, a
+// direct ByteBuffer allocated by OpenGLView.  Adding an event costs no JNI
+// call, and the render thread drains the ring once per frame.
+//
+// Layout, in native byte order:
+//
+//   0    int32  events written, ever; stored by the producer
+//   64   int32  events read, ever; stored by the consumer
+//   128  input_event[capacity], where capacity is a power of two
+//
+// The counters wrap, and their difference is the number of pending events.
+// Each side reads the other's counter with acquire semantics, and publishes
+// its own with release semantics, after touching the events.  The Java
+// producer mirrors push().
+//
+// The last free slot only takes ups, so that when the ring fills up, a down
+// that got in is always followed by its up, and the renderer does not see a
+// touch that never ends.
+
+enum class input_action : int32_t { down = 0, move = 1, up = 2 };
+
+struct input_event {
+  float x, y;
+  input_action action;
+  // SystemClock.uptimeMillis() of the sample, truncated to 32 bits.
+  int32_t time_ms;
+};
+
+static_assert(sizeof(input_event) == 16, "input_event is shared with Java");
+
+class input_ring {
+ public:
+  static constexpr size_t kWriteOffset = 0;
+  static constexpr size_t kReadOffset = 64;
+  static constexpr size_t kHeaderSize = 128;
+
+  // Returns the size of a buffer holding `capacity` events.
+  static constexpr size_t buffer_size(size_t capacity) {
+    return kHeaderSize + capacity * sizeof(input_event);
+  }
+
+  input_ring() = default;
+
+  // Attaches to a buffer of `size` bytes, which must be laid out as above
+  // and aligned to 4 bytes.  The capacity is the largest power of two that
+  // fits, and at least 2, so that there is a slot besides the one kept for
+  // ups.
+  input_ring(void* buffer, size_t size) {
+    if (size < buffer_size(2)) return;
+    base_ = static_cast<uint8_t*>(buffer);
+    capacity_ = 2;
+    while (buffer_size(capacity_ * 2) <= size) capacity_ *= 2;
+  }
+
+  bool attached() const { return base_ != nullptr; }
+  size_t capacity() const { return capacity_; }
+
+  // Producer side.  Adds an event, or returns false if the ring is full, or
+  // only has the slot kept for ups left.
+  bool push(const input_event& event) {
+    const auto written = load(kWriteOffset, __ATOMIC_RELAXED);
+    const auto read = load(kReadOffset, __ATOMIC_ACQUIRE);
+    const uint32_t reserved = (event.action == input_action::up) ? 0 : 1;
+    if (written - read >= capacity_ - reserved) return false;
+
+    memcpy(slot(written), &event, sizeof(event));
+    store(kWriteOffset, written + 1);
+    return true;
+  }
+
+  // Consumer side.  Calls `f` for every pending event, in order, and
+  // returns their number.
+  template <typename Function>
+  size_t drain(Function f) {
+    if (!base_) return 0;
+
+    const auto read = load(kReadOffset, __ATOMIC_RELAXED);
+    const auto written = load(kWriteOffset, __ATOMIC_ACQUIRE);
+    for (auto i = read; i != written; ++i) {
+      input_event event;
+      memcpy(&event, slot(i), sizeof(event));
+      f(event);
+    }
+    store(kReadOffset, written);
+    return written - read;
+  }
+
+  // Like drain(), but only passes on the last of each run of consecutive
+  // moves, since a frame only needs the latest position.  Downs and ups are
+  // all passed on, in order.
+  template <typename Function>
+  size_t drain_coalesced(Function f) {
+    input_event move;
+    bool pending_move = false;
+    const auto result = drain([&](const input_event& event) {
+      if (event.action == input_action::move) {
+        move = event;
+        pending_move = true;
+        return;
+      }
+      if (pending_move) f(move);
+      pending_move = false;
+      f(event);
+    });
+    if (pending_move) f(move);
+    return result;
+  }
+
+ private:
+  uint8_t* slot(uint32_t index) const {
+    const auto i = index & (capacity_ - 1);
+    return base_ + kHeaderSize + i * sizeof(input_event);
+  }
+
+  // The counters are plain Java ints, so they are accessed with the atomic
+  // builtins rather than through std::atomic objects.
+  uint32_t load(size_t offset, int order) const {
+    return __atomic_load_n(reinterpret_cast<uint32_t*>(base_ + offset), order);
+  }
+
+  void store(size_t offset, uint32_t value) {
+    __atomic_store_n(reinterpret_cast<uint32_t*>(base_ + offset), value,
+                     __ATOMIC_RELEASE);
+  }
+
+  uint8_t* base_ = nullptr;
+  uint32_t capacity_ = 0;
+};
@@ -0,0 +1,333 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A work-stealing thread pool for per-frame work that does not touch GL.
+//
+// Every worker has its own deque of ready jobs.  A worker pushes and pops at
+// the back of its own deque, which keeps related work on one core, and steals
+// from the front of the others when it runs dry.  Threads outside the pool
+// push to a shared deque, and help run jobs while they wait, so the calling
+// thread is never idle either.
+//
+// A job may depend on other jobs, and is queued only once all of them have
+// finished.  Exceptions thrown by a job are rethrown by wait().
+class job_system {
+  struct job;
+
+ public:
+  typedef std::shared_ptr<job> handle;
+
+  // Starts `threads` workers.  The default leaves one core for the thread
+  // that submits work, which takes part while it waits.
+  explicit job_system(size_t threads = default_thread_count())
+      : queues_(threads + 1) {
+    pool_.reserve(kMaxPooledJobs);
+    workers_.reserve(threads);
+    for (size_t i = 0; i < threads; ++i)
+      workers_.emplace_back([this, i] { work(i + 1); });
+  }
+
+  // Jobs still queued are dropped; wait for the ones that matter first.
+  ~job_system() {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) worker.join();
+  }
+
+  job_system(const job_system&) = delete;
+  job_system& operator=(const job_system&) = delete;
+
+  static size_t default_thread_count() {
+    const auto cores = std::thread::hardware_concurrency();
+    return cores > 1 ? cores - 1 : 0;
+  }
+
+  size_t thread_count() const { return workers_.size(); }
+
+  // Schedules `function` to run after every job in `dependencies`.  Null
+  // dependencies are ignored.
+  handle run(std::function<void()> function,
+             std::initializer_list<handle> dependencies = {}) {
+    return run(std::move(function), dependencies.begin(), dependencies.end());
+  }
+
+  template <typename Iterator>
+  handle run(std::function<void()> function, Iterator first_dependency,
+             Iterator last_dependency) {
+    auto result = new_job();
+    result->function = std::move(function);
+
+    // The extra count keeps the job from being queued before all of its
+    // dependencies are registered.
+    result->pending = 1;
+    for (auto i = first_dependency; i != last_dependency; ++i) {
+      const auto& dependency = *i;
+      if (!dependency) continue;
+      std::lock_guard<std::mutex> lock(dependency->mutex);
+      if (dependency->done) continue;
+      ++result->pending;
+      dependency->dependents.push_back(result);
+    }
+
+    release(result);
+    return result;
+  }
+
+  // Runs other jobs until `j` has finished, then rethrows its exception, if
+  // any.
+  void wait(const handle& j) {
+    if (!j) return;
+
+    const auto queue = current_queue();
+    while (!j->done.load(std::memory_order_acquire)) {
+      if (!run_one(queue)) std::this_thread::yield();
+    }
+
+    if (j->exception) std::rethrow_exception(j->exception);
+  }
+
+  // Calls function(begin, end) for consecutive ranges of at most `grain`
+  // indices covering [0, count), in parallel, and returns once all calls
+  // have returned.  Ranges are claimed dynamically, so uneven costs balance
+  // out.  Does not allocate once the job pool has warmed up.
+  template <typename Function>
+  void parallel_for(size_t count, size_t grain, const Function& function) {
+    grain = std::max<size_t>(grain, 1);
+    const auto ranges = (count + grain - 1) / grain;
+    if (ranges <= 1 || workers_.empty()) {
+      if (count) function(size_t(0), count);
+      return;
+    }
+
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    std::exception_ptr exception;
+    auto body = [&] {
+      try {
+        for (;;) {
+          const auto range = next.fetch_add(1, std::memory_order_relaxed);
+          if (range >= ranges) break;
+          const auto begin = range * grain;
+          function(begin, std::min(begin + grain, count));
+        }
+      } catch (...) {
+        next = ranges;
+        if (!failed.exchange(true)) exception = std::current_exception();
+      }
+    };
+
+    // Helper jobs hold a reference to `helper`, which std::function stores
+    // without allocating.
+    const auto helpers = std::min(ranges, workers_.size() + 1) - 1;
+    std::atomic<size_t> running(helpers);
+    auto helper = [&body, &running] {
+      body();
+      running.fetch_sub(1, std::memory_order_release);
+    };
+    for (size_t i = 0; i < helpers; ++i) run(std::ref(helper));
+
+    // The caller runs one share itself, and other jobs until the helpers
+    // are done.
+    body();
+    const auto queue = current_queue();
+    while (running.load(std::memory_order_acquire)) {
+      if (!run_one(queue)) std::this_thread::yield();
+    }
+
+    if (exception) std::rethrow_exception(exception);
+  }
+
+ private:
+  struct job {
+    std::function<void()> function;
+    // Unfinished dependencies, plus one until run() has registered them all.
+    std::atomic<size_t> pending{0};
+    std::atomic<bool> done{false};
+    std::exception_ptr exception;
+
+    // Guards `dependents` against jobs added while this one finishes.
+    std::mutex mutex;
+    std::vector<handle> dependents;
+  };
+
+  // A ring buffer of ready jobs.  Unlike std::deque, it keeps its storage,
+  // so steady work does not allocate.
+  struct queue {
+    std::mutex mutex;
+    // Power of two sized.
+    std::vector<handle> jobs;
+    size_t head = 0;
+    size_t size = 0;
+
+    void push_back(handle j) {
+      if (size == jobs.size()) grow();
+      jobs[(head + size++) & (jobs.size() - 1)] = std::move(j);
+    }
+
+    handle pop_back() {
+      return std::move(jobs[(head + --size) & (jobs.size() - 1)]);
+    }
+
+    handle pop_front() {
+      auto result = std::move(jobs[head]);
+      head = (head + 1) & (jobs.size() - 1);
+      --size;
+      return result;
+    }
+
+    void grow() {
+      std::vector<handle> larger(std::max<size_t>(16, jobs.size() * 2));
+      for (size_t i = 0; i < size; ++i)
+        larger[i] = std::move(jobs[(head + i) & (jobs.size() - 1)]);
+      jobs.swap(larger);
+      head = 0;
+    }
+  };
+
+  // Jobs are recycled once the pool holds the only handle to them, which
+  // also means that they have finished.  Only a few are probed, so a busy
+  // pool falls back to allocating.
+  static constexpr size_t kMaxPooledJobs = 256;
+  static constexpr size_t kPoolProbes = 8;
+
+  handle new_job() {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    for (size_t i = std::min(pool_.size(), size_t(kPoolProbes)); i; --i) {
+      auto& candidate = pool_[pool_next_++ % pool_.size()];
+      if (candidate.use_count() != 1) continue;
+
+      // Pairs with the release in the last owner's handle destructor.
+      std::atomic_thread_fence(std::memory_order_acquire);
+      candidate->pending = 0;
+      candidate->done = false;
+      candidate->exception = nullptr;
+      candidate->dependents.clear();
+      return candidate;
+    }
+
+    auto result = std::make_shared<job>();
+    if (pool_.size() < kMaxPooledJobs) pool_.push_back(result);
+    return result;
+  }
+
+  // Index of the calling thread's queue; 0 for threads outside the pool.
+  size_t current_queue() const {
+    return current_pool() == this ? current_index() : 0;
+  }
+
+  static const job_system*& current_pool() {
+    static thread_local const job_system* pool = nullptr;
+    return pool;
+  }
+
+  static size_t& current_index() {
+    static thread_local size_t index = 0;
+    return index;
+  }
+
+  // Drops one pending count, and queues the job when none remain.
+  void release(const handle& j) {
+    if (j->pending.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+    auto& q = queues_[current_queue()];
+    {
+      std::lock_guard<std::mutex> lock(q.mutex);
+      q.push_back(j);
+    }
+
+    // Sequentially consistent, so that either this thread sees the sleeper,
+    // or the sleeper sees the job.
+    ++queued_;
+    if (sleeping_.load()) {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      wake_.notify_one();
+    }
+  }
+
+  // Takes a job from the back of `own`, or else from the front of another
+  // queue.
+  handle take(size_t own) {
+    {
+      auto& q = queues_[own];
+      std::lock_guard<std::mutex> lock(q.mutex);
+      if (q.size) return q.pop_back();
+    }
+
+    for (size_t i = 1; i < queues_.size(); ++i) {
+      auto& q = queues_[(own + i) % queues_.size()];
+      std::lock_guard<std::mutex> lock(q.mutex);
+      if (q.size) return q.pop_front();
+    }
+
+    return nullptr;
+  }
+
+  // Runs a single job, if one is ready.
+  bool run_one(size_t own) {
+    const auto j = take(own);
+    if (!j) return false;
+    --queued_;
+
+    try {
+      j->function();
+    } catch (...) {
+      j->exception = std::current_exception();
+    }
+    j->function = nullptr;
+
+    std::vector<handle> dependents;
+    {
+      std::lock_guard<std::mutex> lock(j->mutex);
+      j->done.store(true, std::memory_order_release);
+      dependents.swap(j->dependents);
+    }
+    for (const auto& dependent : dependents) release(dependent);
+
+    return true;
+  }
+
+  void work(size_t index) {
+    current_pool() = this;
+    current_index() = index;
+
+    for (;;) {
+      if (run_one(index)) continue;
+
+      std::unique_lock<std::mutex> lock(sleep_mutex_);
+      ++sleeping_;
+      wake_.wait(lock, [this] { return stopping_ || queued_.load() > 0; });
+      --sleeping_;
+      if (stopping_) return;
+    }
+  }
+
+  std::vector<queue> queues_;
+  std::vector<std::thread> workers_;
+
+  std::mutex pool_mutex_;
+  std::vector<handle> pool_;
+  size_t pool_next_ = 0;
+
+  // Jobs sitting in queues, and workers waiting for one.  The count of jobs
+  // may dip below zero when a job is taken before it is counted.
+  std::atomic<ptrdiff_t> queued_{0};
+  std::atomic<size_t> sleeping_{0};
+
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+  bool stopping_ = false;
+};
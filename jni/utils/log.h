@@ -2,6 +2,7 @@
 
 #include <sstream>
 #include <stdexcept>
+#include <string>
 
 #include <android/log.h>
 
@@ -22,7 +23,47 @@ static void error(Args... args) {
       throw std::runtime_error(msg.str());                 \
   } while (0)
 
-#define UTILS_GL_CHECK(glcode, ...)                                       \
+// How UTILS_GL_CHECK() finds GL errors.  Set UTILS_GL_CHECK_MODE to one of:
+//
+// UTILS_GL_CHECK_OFF: never checks.  The default with NDEBUG, since even one
+//   glGetError() per frame waits for the driver's command thread on some
+//   drivers.
+// UTILS_GL_CHECK_IMMEDIATE: calls glGetError() after every call, which may
+//   stall the pipeline on some drivers.  The default without NDEBUG.
+// UTILS_GL_CHECK_DEFERRED: gl_check_frame() calls glGetError() once per
+//   frame.  After an error, every call in the next frame is checked, so that
+//   the failing call is reported if it fails again.  An error that does not
+//   repeat is reported without the call at the end of the next frame.
+// UTILS_GL_CHECK_DEBUG: reports errors from a synchronous GL_KHR_debug
+//   callback, installed by gl_enable_debug_output().  Falls back to immediate
+//   checks without the extension.
+#define UTILS_GL_CHECK_OFF 0
+#define UTILS_GL_CHECK_IMMEDIATE 1
+#define UTILS_GL_CHECK_DEFERRED 2
+#define UTILS_GL_CHECK_DEBUG 3
+
+#ifndef UTILS_GL_CHECK_MODE
+#ifdef NDEBUG
+#define UTILS_GL_CHECK_MODE UTILS_GL_CHECK_OFF
+#else
+#define UTILS_GL_CHECK_MODE UTILS_GL_CHECK_IMMEDIATE
+#endif
+#endif
+
+// True while every UTILS_GL_CHECK() calls glGetError(), in the deferred and
+// debug modes.
+inline bool& gl_check_every_call() {
+  static bool enabled = false;
+  return enabled;
+}
+
+// The last error reported by the GL_KHR_debug callback, if not yet thrown.
+inline std::string& gl_debug_error() {
+  static std::string message;
+  return message;
+}
+
+#define UTILS_GL_CHECK_NOW(glcode)                                        \
   do {                                                                    \
     glcode;                                                               \
     auto error = glGetError();                                            \
@@ -33,3 +74,40 @@ static void error(Args... args) {
       throw std::runtime_error(msg.str());                                \
     }                                                                     \
   } while (0)
+
+#if UTILS_GL_CHECK_MODE == UTILS_GL_CHECK_OFF
+#define UTILS_GL_CHECK(glcode, ...) \
+  do {                              \
+    glcode;                         \
+  } while (0)
+#elif UTILS_GL_CHECK_MODE == UTILS_GL_CHECK_IMMEDIATE
+#define UTILS_GL_CHECK(glcode, ...) UTILS_GL_CHECK_NOW(glcode)
+#elif UTILS_GL_CHECK_MODE == UTILS_GL_CHECK_DEFERRED
+#define UTILS_GL_CHECK(glcode, ...)    \
+  do {                                 \
+    if (gl_check_every_call()) {       \
+      UTILS_GL_CHECK_NOW(glcode);      \
+    } else {                           \
+      glcode;                          \
+    }                                  \
+  } while (0)
+#elif UTILS_GL_CHECK_MODE == UTILS_GL_CHECK_DEBUG
+#define UTILS_GL_CHECK(glcode, ...)                                     \
+  do {                                                                  \
+    if (gl_check_every_call()) {                                        \
+      UTILS_GL_CHECK_NOW(glcode);                                       \
+    } else {                                                            \
+      glcode;                                                           \
+      if (!gl_debug_error().empty()) {                                  \
+        std::ostringstream msg;                                         \
+        msg << __FILE__ << ":" << __LINE__                              \
+            << ": GL call failed: " << #glcode << " ("                  \
+            << gl_debug_error() << ")";                                 \
+        gl_debug_error().clear();                                       \
+        throw std::runtime_error(msg.str());                            \
+      }                                                                 \
+    }                                                                   \
+  } while (0)
+#else
+#error "Unknown UTILS_GL_CHECK_MODE"
+#endif
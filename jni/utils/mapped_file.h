@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A read-only memory mapping of a file, or of part of one.  Unmapped when
+// destroyed.
+class mapped_file {
+ public:
+  mapped_file() = default;
+
+  mapped_file(mapped_file&& rhs) { *this = std::move(rhs); }
+
+  mapped_file& operator=(mapped_file&& rhs) {
+    if (this != &rhs) {
+      reset();
+      std::swap(base_, rhs.base_);
+      std::swap(base_size_, rhs.base_size_);
+      std::swap(data_, rhs.data_);
+      std::swap(size_, rhs.size_);
+    }
+    return *this;
+  }
+
+  mapped_file(const mapped_file&) = delete;
+  mapped_file& operator=(const mapped_file&) = delete;
+
+  ~mapped_file() { reset(); }
+
+  // Maps `size` bytes from `offset` in `fd`.  The offset need not be page
+  // aligned.  Returns an empty mapping on failure.  `fd` may be closed
+  // afterwards.
+  static mapped_file map(int fd, off_t offset, size_t size) {
+    mapped_file result;
+    if (!size) return result;
+
+    const auto page_size = static_cast<off_t>(sysconf(_SC_PAGESIZE));
+    const auto page_offset = offset % page_size;
+
+    auto base = mmap(nullptr, size + page_offset, PROT_READ, MAP_PRIVATE, fd,
+                     offset - page_offset);
+    if (base == MAP_FAILED) return result;
+
+    result.base_ = base;
+    result.base_size_ = size + page_offset;
+    result.data_ = static_cast<const char*>(base) + page_offset;
+    result.size_ = size;
+
+    return result;
+  }
+
+  // Maps an entire file.  Returns an empty mapping if the file does not exist
+  // or cannot be mapped.
+  static mapped_file open(const std::string& path) {
+    const auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return mapped_file();
+
+    mapped_file result;
+    struct stat st;
+    if (fstat(fd, &st) == 0) result = map(fd, 0, st.st_size);
+    close(fd);
+
+    return result;
+  }
+
+  void reset() {
+    if (base_) munmap(base_, base_size_);
+    base_ = nullptr;
+    base_size_ = 0;
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  explicit operator bool() const { return data_ != nullptr; }
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  void* base_ = nullptr;
+  size_t base_size_ = 0;
+
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+};
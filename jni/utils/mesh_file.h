@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include "utils/mapped_file.h"
+
+// Binary mesh files.  The vertex and index blocks are stored in their in-memory
+// layout at aligned offsets, so a mapped file can be handed straight to
+// glBufferData.  Files are only valid on machines with the same byte order and
+// vertex layout as the writer, which is checked when loading.
+
+constexpr uint32_t kMeshFileMagic = 0x4853454d;  // "MESH"
+constexpr uint32_t kMeshFileVersion = 1;
+constexpr uint32_t kMeshFileByteOrder = 0x01020304;
+constexpr size_t kMeshFileAlignment = 16;
+
+struct mesh_file_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t vertex_size;
+  uint32_t index_size;
+  uint32_t reserved;
+  // Identifies the generator and its parameters.  A file with a different key
+  // is stale.
+  uint64_t key;
+  uint64_t vertex_count;
+  uint64_t vertex_offset;
+  uint64_t index_count;
+  uint64_t index_offset;
+};
+
+static_assert(sizeof(mesh_file_header) % kMeshFileAlignment == 0,
+              "mesh data must start aligned");
+
+// A mesh inside a mapped file.
+template <typename Vertex, typename IndexType>
+struct mesh_file_view {
+  const Vertex* vertices = nullptr;
+  size_t vertex_count = 0;
+  const IndexType* indices = nullptr;
+  size_t index_count = 0;
+};
+
+inline uint64_t mesh_file_align(uint64_t offset) {
+  return (offset + kMeshFileAlignment - 1) & ~uint64_t(kMeshFileAlignment - 1);
+}
+
+// Writes a mesh file atomically, by writing to a temporary file and renaming
+// it into place.  Throws std::runtime_error on failure.
+template <typename Vertex, typename IndexType>
+void write_mesh_file(const std::string& path, uint64_t key,
+                     const Vertex* vertices, size_t vertex_count,
+                     const IndexType* indices, size_t index_count) {
+  static_assert(std::is_trivially_copyable<Vertex>::value,
+                "vertices are stored as raw bytes");
+
+  mesh_file_header header;
+  memset(&header, 0, sizeof(header));
+  header.magic = kMeshFileMagic;
+  header.version = kMeshFileVersion;
+  header.byte_order = kMeshFileByteOrder;
+  header.vertex_size = sizeof(Vertex);
+  header.index_size = sizeof(IndexType);
+  header.key = key;
+  header.vertex_count = vertex_count;
+  header.vertex_offset = sizeof(header);
+  header.index_count = index_count;
+  header.index_offset =
+      mesh_file_align(header.vertex_offset + sizeof(Vertex) * vertex_count);
+
+  const auto tmp_path = path + ".tmp";
+  auto file = fopen(tmp_path.c_str(), "wb");
+  if (!file) {
+    throw std::runtime_error(tmp_path + ": " + strerror(errno));
+  }
+
+  static const char kPadding[kMeshFileAlignment] = {};
+  const auto padding = header.index_offset - header.vertex_offset -
+                       sizeof(Vertex) * vertex_count;
+
+  const auto ok =
+      fwrite(&header, sizeof(header), 1, file) == 1 &&
+      fwrite(vertices, sizeof(Vertex), vertex_count, file) == vertex_count &&
+      fwrite(kPadding, 1, padding, file) == padding &&
+      fwrite(indices, sizeof(IndexType), index_count, file) == index_count;
+
+  if (fclose(file) != 0 || !ok) {
+    const auto message = tmp_path + ": " + strerror(errno);
+    remove(tmp_path.c_str());
+    throw std::runtime_error(message);
+  }
+
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    const auto message = path + ": " + strerror(errno);
+    remove(tmp_path.c_str());
+    throw std::runtime_error(message);
+  }
+}
+
+// Locates the mesh in a mapped file.  Returns false if the file is missing,
+// truncated, from another version or machine, or was written with a
+// different key.
+template <typename Vertex, typename IndexType>
+bool parse_mesh_file(const mapped_file& file, uint64_t key,
+                     mesh_file_view<Vertex, IndexType>* view) {
+  if (file.size() < sizeof(mesh_file_header)) return false;
+
+  mesh_file_header header;
+  memcpy(&header, file.data(), sizeof(header));
+
+  if (header.magic != kMeshFileMagic || header.version != kMeshFileVersion ||
+      header.byte_order != kMeshFileByteOrder ||
+      header.vertex_size != sizeof(Vertex) ||
+      header.index_size != sizeof(IndexType) || header.key != key)
+    return false;
+
+  const auto size = file.size();
+  if (header.vertex_offset > size || header.index_offset > size ||
+      header.vertex_count > (size - header.vertex_offset) / sizeof(Vertex) ||
+      header.index_count > (size - header.index_offset) / sizeof(IndexType))
+    return false;
+
+  view->vertices =
+      reinterpret_cast<const Vertex*>(file.data() + header.vertex_offset);
+  view->vertex_count = header.vertex_count;
+  view->indices =
+      reinterpret_cast<const IndexType*>(file.data() + header.index_offset);
+  view->index_count = header.index_count;
+
+  return true;
+}
@@ -9,7 +9,11 @@ public class HelloWorld extends Activity {
   @Override
   protected void onCreate(Bundle savedInstanceState) {
     super.onCreate(savedInstanceState);
-    mView = new OpenGLView(getApplication());
+    int sphereQuality = getIntent().getIntExtra("sphere_quality", -1);
+    int sphereCount = getIntent().getIntExtra("sphere_count", 1);
+    boolean animateCamera = getIntent().getBooleanExtra("animate_camera", true);
+    mView = new OpenGLView(getApplication(), sphereQuality, sphereCount,
+                           animateCamera);
     setContentView(mView);
   }
 
@@ -1,11 +1,15 @@
 package com.mortehu.helloworld;
 
 import android.content.Context;
+import android.content.res.AssetManager;
 import android.opengl.GLSurfaceView;
 import android.util.Log;
 import android.view.KeyEvent;
 import android.view.MotionEvent;
 
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
 import javax.microedition.khronos.egl.EGL10;
 import javax.microedition.khronos.egl.EGLConfig;
 import javax.microedition.khronos.egl.EGLContext;
@@ -21,10 +25,54 @@ class OpenGLView extends GLSurfaceView {
   private static int EGL_CONTEXT_CLIENT_VERSION = 0x3098;
   private static int EGL_OPENGL_ES2_BIT = 4;
 
+  public static native void setAssetManager(AssetManager manager);
+  public static native void setCacheDirectory(String path);
+  public static native void setSphereQuality(int quality);
+  public static native void setSphereCount(int count);
+  public static native void setCameraAnimation(boolean enabled);
   public static native void surfaceCreated();
   public static native void surfaceChanged(int width, int height);
-  public static native void drawFrame();
-  public static native void touchEvent(float x, float y, int state);
+  // Returns true if the next frame would differ from this one.
+  public static native boolean drawFrame();
+  public static native void setInputBuffer(ByteBuffer buffer);
+
+  // Layout of getFrameStats(): the frame count, followed by the 50th, 95th
+  // and 99th percentiles in milliseconds of each metric, in this order.
+  public static final int STATS_FRAMES = 0;
+  public static final int STATS_INTERVAL = 1;
+  public static final int STATS_CPU_TOTAL = 4;
+  public static final int STATS_CPU_SCENE = 7;
+  public static final int STATS_CPU_SUBMIT = 10;
+  public static final int STATS_GPU = 13;
+
+  // Frame timing over the last few seconds.  GPU times are zero without
+  // GL_EXT_disjoint_timer_query.  May be called from any thread.
+  public static native float[] getFrameStats();
+
+  // Touch events for the renderer, in a ring buffer shared with native code,
+  // so that adding one costs no JNI call.  See jni/utils/input_ring.h for the
+  // layout.  Only the UI thread writes here.
+  private static final int INPUT_DOWN = 0;
+  private static final int INPUT_MOVE = 1;
+  private static final int INPUT_UP = 2;
+  private static final int INPUT_WRITTEN = 0;
+  private static final int INPUT_READ = 64;
+  private static final int INPUT_HEADER_SIZE = 128;
+  private static final int INPUT_EVENT_SIZE = 16;
+  private static final int INPUT_CAPACITY = 256;
+
+  private final ByteBuffer mInput =
+      ByteBuffer.allocateDirect(INPUT_HEADER_SIZE + INPUT_CAPACITY * INPUT_EVENT_SIZE)
+          .order(ByteOrder.nativeOrder());
+  private int mInputWritten;
+
+  // Only used as a memory barrier.  ByteBuffer has no ordered loads or
+  // stores, so accesses to the shared counters go through a volatile write
+  // and read of this field: the write keeps earlier accesses before the pair,
+  // and the read keeps later ones after it.  inputRead() uses it as an
+  // acquire load of the read count, and publishInput() as a release store of
+  // the written count.
+  private volatile int mInputFence;
 
   private static class ContextFactory implements GLSurfaceView.EGLContextFactory {
     public EGLContext createContext(EGL10 egl, EGLDisplay display, EGLConfig eglConfig) {
@@ -58,7 +106,16 @@ class OpenGLView extends GLSurfaceView {
     }
   }
 
+  // Draws continuously while the picture changes, and otherwise only on
+  // requestRender(), which input calls.
   private static class Renderer implements GLSurfaceView.Renderer {
+    private final GLSurfaceView mView;
+    private boolean mContinuous = true;
+
+    Renderer(GLSurfaceView view) {
+      mView = view;
+    }
+
     public void onSurfaceCreated(GL10 gl, EGLConfig config) {
       OpenGLView.surfaceCreated();
     }
@@ -68,41 +125,90 @@ class OpenGLView extends GLSurfaceView {
     }
 
     public void onDrawFrame(GL10 gl) {
-      OpenGLView.drawFrame();
+      boolean continuous = OpenGLView.drawFrame();
+      if (continuous != mContinuous) {
+        mContinuous = continuous;
+        mView.setRenderMode(
+            continuous ? RENDERMODE_CONTINUOUSLY : RENDERMODE_WHEN_DIRTY);
+      }
     }
   }
 
 
-  public OpenGLView(Context context) {
+  public OpenGLView(Context context, int sphereQuality, int sphereCount,
+                    boolean animateCamera) {
     super(context);
 
+    // Must be set before the renderer thread starts.
+    setAssetManager(context.getAssets());
+    setCacheDirectory(context.getCacheDir().getAbsolutePath());
+    setSphereQuality(sphereQuality);
+    setSphereCount(sphereCount);
+    setCameraAnimation(animateCamera);
+    setInputBuffer(mInput);
+
     setEGLContextFactory(new ContextFactory());
     setEGLConfigChooser(new ConfigChooser());
-    setRenderer(new Renderer());
+    setRenderer(new Renderer(this));
   }
 
   @Override
   public boolean onTouchEvent(MotionEvent e) {
-    float x = e.getX();
-    float y = e.getY();
-
     switch (e.getAction()) {
       case MotionEvent.ACTION_DOWN:
-        touchEvent(x, y, 0);
+        addInput(INPUT_DOWN, e.getX(), e.getY(), e.getEventTime());
         break;
 
       case MotionEvent.ACTION_MOVE:
-        touchEvent(x, y, 1);
+        // Moves are batched; pass on every sample since the last event.
+        for (int i = 0; i < e.getHistorySize(); ++i)
+          addInput(INPUT_MOVE, e.getHistoricalX(i), e.getHistoricalY(i),
+                   e.getHistoricalEventTime(i));
+        addInput(INPUT_MOVE, e.getX(), e.getY(), e.getEventTime());
         break;
 
       case MotionEvent.ACTION_UP:
-        touchEvent(x, y, 2);
+      case MotionEvent.ACTION_CANCEL:
+        addInput(INPUT_UP, e.getX(), e.getY(), e.getEventTime());
         break;
     }
+    publishInput();
+    requestRender();
 
     return true;
   }
 
+  // Writes an event after the last one added, without publishing it.  Drops
+  // the event if the renderer has fallen a whole ring behind.  The last slot
+  // is kept for ups, so that the up ending an accepted down always fits.
+  // Mirrors input_ring::push().
+  private void addInput(int action, float x, float y, long time) {
+    int reserved = (action == INPUT_UP) ? 0 : 1;
+    if (mInputWritten - inputRead() >= INPUT_CAPACITY - reserved) return;
+
+    int offset =
+        INPUT_HEADER_SIZE + (mInputWritten & (INPUT_CAPACITY - 1)) * INPUT_EVENT_SIZE;
+    mInput.putFloat(offset, x);
+    mInput.putFloat(offset + 4, y);
+    mInput.putInt(offset + 8, action);
+    mInput.putInt(offset + 12, (int) time);
+    ++mInputWritten;
+  }
+
+  // Returns the number of events the renderer has read, before this thread
+  // may overwrite their slots.
+  private int inputRead() {
+    mInputFence = mInput.getInt(INPUT_READ);
+    return mInputFence;
+  }
+
+  // Makes the events added so far visible to the renderer, by storing the
+  // count after the event stores.
+  private void publishInput() {
+    mInputFence = mInputWritten;
+    mInput.putInt(INPUT_WRITTEN, mInputFence);
+  }
+
   private static void logEglErrors(EGL10 egl) {
     int error;
     while (EGL10.EGL_SUCCESS != (error = egl.eglGetError()))